@@ -0,0 +1,66 @@
+#pragma once
+
+#include <benchmark/benchmark.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <vector>
+
+#include "library/memory/AlignedAllocator.h"
+
+//
+// Shared reporting for the benchmarks. Every case reports the rates
+// (printed with a /s suffix)
+//
+//   GB        bytes moved per second (reads + writes of the operands)
+//   GFLOP     floating point operations per second
+//   STREAM%   bandwidth as a percentage of the STREAM triad on this machine
+//
+// The baseline is measured once per process: the best of several triads
+// a = b + s * c over arrays far larger than the last-level cache.
+//
+
+namespace bench {
+
+inline constexpr size_t stream_elements = size_t{1} << 24;  // 128 MiB each
+
+inline double stream_bandwidth() {
+  static const double bytes_per_second = [] {
+    using Buffer = std::vector<double, AlignedAllocator<double>>;
+    Buffer a(stream_elements, 0.0), b(stream_elements, 1.0),
+        c(stream_elements, 2.0);
+    double best = 0;
+    for (int rep = 0; rep < 8; rep++) {
+      const auto t0 = std::chrono::steady_clock::now();
+      double* pa = a.data();
+      const double *pb = b.data(), *pc = c.data();
+      for (size_t i = 0; i < stream_elements; i++) pa[i] = pb[i] + 3.0 * pc[i];
+      benchmark::ClobberMemory();
+      const std::chrono::duration<double> dt =
+          std::chrono::steady_clock::now() - t0;
+      best = std::max(best, 3 * sizeof(double) * stream_elements / dt.count());
+    }
+    benchmark::DoNotOptimize(a.data());
+    return best;
+  }();
+  return bytes_per_second;
+}
+
+// Sets the counters for one iteration moving `bytes` and doing `flops`.
+inline void report(benchmark::State& state, double bytes, double flops) {
+  using benchmark::Counter;
+  state.counters["GB"] =
+      Counter(bytes * 1e-9, Counter::kIsIterationInvariantRate);
+  state.counters["GFLOP"] =
+      Counter(flops * 1e-9, Counter::kIsIterationInvariantRate);
+  state.counters["STREAM%"] = Counter(bytes / stream_bandwidth() * 100,
+                                      Counter::kIsIterationInvariantRate);
+}
+
+// Sizes from well inside L1 to well beyond the last-level cache.
+inline void cache_sizes(benchmark::internal::Benchmark* b) {
+  for (long n = 1 << 9; n <= 1 << 25; n <<= 2) b->Arg(n);
+}
+
+}  // namespace bench
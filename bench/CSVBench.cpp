@@ -0,0 +1,103 @@
+#include <benchmark/benchmark.h>
+
+#include <cmath>
+#include <filesystem>
+#include <string>
+
+#include "bench/Baseline.h"
+#include "library/fileio/CSVWriter.h"
+#include "library/vectormatrix/Matrix.h"
+
+//
+// CSVWriter throughput in rows/s and MB/s of formatted output, to /dev/null
+// (formatting only) and to a file in the temporary directory.
+//
+
+namespace {
+
+constexpr size_t rows = 1 << 16;
+constexpr size_t cols = 8;
+
+Matrix<double> table() {
+  Matrix<double> M(rows, cols, uninitialized);
+  for (size_t i = 0; i < M.size(); i++) M[i] = std::sin(double(i)) * 1e3;
+  return M;
+}
+
+std::string target(bool file) {
+  if (!file) return "/dev/null";
+  return (std::filesystem::temp_directory_path() / "swnumeric_bench.csv")
+      .string();
+}
+
+// Bytes of output one call of write(CSVWriter&) produces.
+template <typename F>
+size_t output_size(F&& write) {
+  const std::string probe = target(true);
+  {
+    CSVWriter w(probe);
+    write(w);
+  }
+  const size_t bytes = std::filesystem::file_size(probe);
+  std::filesystem::remove(probe);
+  return bytes;
+}
+
+void report_csv(benchmark::State& state, size_t bytes_per_iteration) {
+  using benchmark::Counter;
+  state.counters["rows"] =
+      Counter(double(rows), Counter::kIsIterationInvariantRate);
+  state.counters["MB"] = Counter(bytes_per_iteration * 1e-6,
+                                   Counter::kIsIterationInvariantRate);
+  // bytes read from the matrix plus bytes written
+  bench::report(state, double(rows * cols * sizeof(double)) +
+                           double(bytes_per_iteration),
+                0);
+}
+
+// state.range(0): 0 writes to /dev/null, 1 to a file
+// state.range(1): 0 blocking, 1 async
+void BM_CSVWriteMatrix(benchmark::State& state) {
+  const Matrix<double> M = table();
+  const std::string path = target(state.range(0));
+  const WriteMode mode =
+      state.range(1) ? WriteMode::async : WriteMode::blocking;
+  const auto write = [&](CSVWriter& w) { w.write_matrix(M); };
+  for (auto _ : state) {
+    CSVWriter w(path, ',', 1000, FloatFormat{}, mode, 4);
+    write(w);
+  }
+  report_csv(state, output_size(write));
+}
+BENCHMARK(BM_CSVWriteMatrix)
+    ->ArgNames({"file", "async"})
+    ->Args({0, 0})
+    ->Args({1, 0})
+    ->Args({1, 1})
+    ->Unit(benchmark::kMillisecond)
+    ->UseRealTime();
+
+// one write_row call per row, mixed field types
+void BM_CSVWriteRows(benchmark::State& state) {
+  const Matrix<double> M = table();
+  const std::string path = target(state.range(0));
+  const auto write = [&](CSVWriter& w) {
+    for (size_t i = 0; i < rows; i++) {
+      const double* r = M.data() + i * cols;
+      w.write_row(i, "id", r[0], r[1], r[2], r[3]);
+    }
+  };
+  for (auto _ : state) {
+    CSVWriter w(path);
+    write(w);
+  }
+  report_csv(state, output_size(write));
+}
+BENCHMARK(BM_CSVWriteRows)
+    ->ArgName("file")
+    ->Arg(0)
+    ->Arg(1)
+    ->Unit(benchmark::kMillisecond)
+    ->UseRealTime();
+
+}  // namespace
@@ -0,0 +1,87 @@
+#include <benchmark/benchmark.h>
+
+#include "bench/Baseline.h"
+#include "library/parallel/Parallel.h"
+#include "library/vectormatrix/Vector.h"
+
+//
+// Vector expression assignment from L1- to DRAM-resident sizes.
+//
+
+namespace {
+
+Vector<double> filled(size_t n, double v) {
+  Vector<double> x(n, uninitialized);
+  for (size_t i = 0; i < n; i++) x[i] = v + 1e-3 * double(i % 7);
+  return x;
+}
+
+// a = s * b
+void BM_VectorScale(benchmark::State& state) {
+  const size_t n = state.range(0);
+  Vector<double> a = filled(n, 0), b = filled(n, 1);
+  const double s = 3.0;
+  for (auto _ : state) {
+    a = s * b;
+    benchmark::ClobberMemory();
+  }
+  bench::report(state, 2.0 * sizeof(double) * n, double(n));
+}
+BENCHMARK(BM_VectorScale)->Apply(bench::cache_sizes);
+
+// a = b + s * c, the STREAM triad
+void BM_VectorTriad(benchmark::State& state) {
+  const size_t n = state.range(0);
+  Vector<double> a = filled(n, 0), b = filled(n, 1), c = filled(n, 2);
+  const double s = 3.0;
+  for (auto _ : state) {
+    a = b + s * c;
+    benchmark::ClobberMemory();
+  }
+  bench::report(state, 3.0 * sizeof(double) * n, 2.0 * n);
+}
+BENCHMARK(BM_VectorTriad)->Apply(bench::cache_sizes);
+
+// a = b + c * d, fused into one pass
+void BM_VectorFused(benchmark::State& state) {
+  const size_t n = state.range(0);
+  Vector<double> a = filled(n, 0), b = filled(n, 1), c = filled(n, 2),
+                 d = filled(n, 3);
+  for (auto _ : state) {
+    a = b + c * d;
+    benchmark::ClobberMemory();
+  }
+  bench::report(state, 4.0 * sizeof(double) * n, 2.0 * n);
+}
+BENCHMARK(BM_VectorFused)->Apply(bench::cache_sizes);
+
+// a = fma(b, c, d) + sqrt(abs(b)), compute-heavier
+void BM_VectorUnary(benchmark::State& state) {
+  const size_t n = state.range(0);
+  Vector<double> a = filled(n, 0), b = filled(n, 1), c = filled(n, 2),
+                 d = filled(n, 3);
+  for (auto _ : state) {
+    a = fma(b, c, d) + sqrt(abs(b));
+    benchmark::ClobberMemory();
+  }
+  bench::report(state, 4.0 * sizeof(double) * n, 5.0 * n);
+}
+BENCHMARK(BM_VectorUnary)->Apply(bench::cache_sizes);
+
+// the triad on the thread pool
+void BM_VectorTriadPar(benchmark::State& state) {
+  const size_t n = state.range(0);
+  Vector<double> a(n, uninitialized), b(n, uninitialized), c(n, uninitialized);
+  first_touch(par, a, 0.0);
+  first_touch(par, b, 1.0);
+  first_touch(par, c, 2.0);
+  const double s = 3.0;
+  for (auto _ : state) {
+    assign(par, a, b + s * c);
+    benchmark::ClobberMemory();
+  }
+  bench::report(state, 3.0 * sizeof(double) * n, 2.0 * n);
+}
+BENCHMARK(BM_VectorTriadPar)->Apply(bench::cache_sizes)->UseRealTime();
+
+}  // namespace
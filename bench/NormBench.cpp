@@ -0,0 +1,58 @@
+#include <benchmark/benchmark.h>
+
+#include <cmath>
+
+#include "bench/Baseline.h"
+#include "library/expression/Reduction.h"
+#include "library/vectormatrix/Vector.h"
+
+//
+// norm2 through MKL (cblas_dnrm2, scaled) against the native one-pass
+// reduction (unscaled), serial and on the thread pool.
+//
+
+namespace {
+
+Vector<double> filled(size_t n) {
+  Vector<double> x(n, uninitialized);
+  for (size_t i = 0; i < n; i++) x[i] = std::sin(double(i));
+  return x;
+}
+
+void BM_Norm2Blas(benchmark::State& state) {
+  const size_t n = state.range(0);
+  const Vector<double> x = filled(n);
+  for (auto _ : state) benchmark::DoNotOptimize(norm2(x));
+  bench::report(state, sizeof(double) * n, 2.0 * n);
+}
+BENCHMARK(BM_Norm2Blas)->Apply(bench::cache_sizes);
+
+void BM_Norm2Native(benchmark::State& state) {
+  const size_t n = state.range(0);
+  const Vector<double> x = filled(n);
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(std::sqrt(
+        reduction::reduce_range<reduction::SumSquares>(x, 0, x.size())));
+  }
+  bench::report(state, sizeof(double) * n, 2.0 * n);
+}
+BENCHMARK(BM_Norm2Native)->Apply(bench::cache_sizes);
+
+void BM_Norm2NativePar(benchmark::State& state) {
+  const size_t n = state.range(0);
+  const Vector<double> x = filled(n);
+  for (auto _ : state) benchmark::DoNotOptimize(norm2(par, x));
+  bench::report(state, sizeof(double) * n, 2.0 * n);
+}
+BENCHMARK(BM_Norm2NativePar)->Apply(bench::cache_sizes)->UseRealTime();
+
+// norm2(a - b): one pass over both operands, no temporary
+void BM_Norm2Expression(benchmark::State& state) {
+  const size_t n = state.range(0);
+  const Vector<double> a = filled(n), b = filled(n);
+  for (auto _ : state) benchmark::DoNotOptimize(norm2(a - b));
+  bench::report(state, 2.0 * sizeof(double) * n, 3.0 * n);
+}
+BENCHMARK(BM_Norm2Expression)->Apply(bench::cache_sizes);
+
+}  // namespace
@@ -0,0 +1,76 @@
+#include <benchmark/benchmark.h>
+
+#include <vector>
+
+#include "bench/Baseline.h"
+#include "library/vectormatrix/Vector.h"
+
+//
+// StaticVector kernels by N, over a batch of vectors so the work is not
+// constant folded.
+//
+
+namespace {
+
+constexpr size_t batch = 1024;
+
+template <size_t N>
+std::vector<StaticVector<N, double>> batch_of(double v) {
+  std::vector<StaticVector<N, double>> xs(batch);
+  for (size_t k = 0; k < batch; k++) {
+    for (size_t i = 0; i < N; i++) xs[k][i] = v + 1e-3 * double(k + i);
+  }
+  return xs;
+}
+
+// y = y + a * x
+template <size_t N>
+void BM_StaticAxpy(benchmark::State& state) {
+  auto xs = batch_of<N>(1), ys = batch_of<N>(2);
+  const double a = 0.5;
+  for (auto _ : state) {
+    for (size_t k = 0; k < batch; k++) ys[k] = ys[k] + a * xs[k];
+    benchmark::ClobberMemory();
+  }
+  bench::report(state, 3.0 * sizeof(double) * N * batch, 2.0 * N * batch);
+}
+
+template <size_t N>
+void BM_StaticDot(benchmark::State& state) {
+  auto xs = batch_of<N>(1), ys = batch_of<N>(2);
+  for (auto _ : state) {
+    double acc = 0;
+    for (size_t k = 0; k < batch; k++) acc += dot(xs[k], ys[k]);
+    benchmark::DoNotOptimize(acc);
+  }
+  bench::report(state, 2.0 * sizeof(double) * N * batch, 2.0 * N * batch);
+}
+
+template <size_t N>
+void BM_StaticNorm2(benchmark::State& state) {
+  auto xs = batch_of<N>(1);
+  for (auto _ : state) {
+    double acc = 0;
+    for (size_t k = 0; k < batch; k++) acc += norm2(xs[k]);
+    benchmark::DoNotOptimize(acc);
+  }
+  bench::report(state, 1.0 * sizeof(double) * N * batch, 2.0 * N * batch);
+}
+
+#define SWNUMERIC_STATIC_BENCH(name) \
+  BENCHMARK(name<2>);                \
+  BENCHMARK(name<3>);                \
+  BENCHMARK(name<4>);                \
+  BENCHMARK(name<6>);                \
+  BENCHMARK(name<8>);                \
+  BENCHMARK(name<16>);               \
+  BENCHMARK(name<64>);               \
+  BENCHMARK(name<256>)
+
+SWNUMERIC_STATIC_BENCH(BM_StaticAxpy);
+SWNUMERIC_STATIC_BENCH(BM_StaticDot);
+SWNUMERIC_STATIC_BENCH(BM_StaticNorm2);
+
+#undef SWNUMERIC_STATIC_BENCH
+
+}  // namespace
@@ -0,0 +1,23 @@
+# cmake -DNM=<nm> -DOBJECTS=<objects> -DSTAMP=<file> -P CheckKernels.cmake
+#
+# Fails if a Kernels.cpp object defines an external symbol other than its
+# kernel table. Anything else, e.g. an out-of-line std::fma built for
+# AVX-512, could be picked by the linker for baseline callers.
+
+foreach(obj IN LISTS OBJECTS)
+  execute_process(COMMAND ${NM} --defined-only -g ${obj}
+                  OUTPUT_VARIABLE symbols RESULT_VARIABLE failed)
+  if(failed)
+    message(FATAL_ERROR "${NM} failed on ${obj}")
+  endif()
+  string(REPLACE "\n" ";" symbols "${symbols}")
+  foreach(line IN LISTS symbols)
+    string(REGEX REPLACE ".* " "" name "${line}")
+    if(name STREQUAL "" OR name MATCHES "^_ZN8dispatch[0-9]+[a-z0-9]+_tableE$"
+       OR name STREQUAL "DW.ref.__gxx_personality_v0")
+      continue()
+    endif()
+    message(FATAL_ERROR "${obj} exports ${name}")
+  endforeach()
+endforeach()
+file(TOUCH ${STAMP})
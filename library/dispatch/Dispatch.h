@@ -0,0 +1,208 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdlib>
+#include <optional>
+#include <string_view>
+#include <type_traits>
+
+//
+// Run-time selection of the hot kernels by instruction set.
+//
+// The headers are compiled for the target the including code is built for
+// (the baseline; SSE2 on a generic x86-64 build). When the library is built
+// with SWNUMERIC_DISPATCH=1 (CMake option SWNUMERIC_DISPATCH, the default on
+// x86-64 with GCC or Clang), library/dispatch/Kernels.cpp is compiled again
+// for AVX2 and for AVX-512, and the best table the CPU supports is picked the
+// first time a kernel is needed:
+//
+//   elementwise assignment of x + y, x - y, x * y, x / y, a * x, a * x + y,
+//   a * x + b * y and fma(a, x, y) over contiguous float or double operands;
+//   sum, dot, norm1, norm2 and normInf of contiguous operands; batched
+//   gemm and cholesky_solve of 2x2 to 4x4 problems; the CSV quoting scan.
+//
+// Other expressions, and every kernel when the baseline is already the best
+// level, run the inline code as before. The table is resolved once and kept
+// in a function-local static, so a dispatched call costs an indirect call and
+// nothing else. Setting
+//
+//   SWNUMERIC_ISA=baseline|avx2|avx512
+//
+// caps the level, e.g. to benchmark the AVX2 kernels on an AVX-512 machine;
+// a level the CPU lacks falls back to the best one below it, and other values
+// are ignored. active() reports the level in use. Kernels at different levels
+// use packets of different widths, so reductions may round differently from
+// one level to the next, as they do between builds for different targets.
+//
+
+#ifndef SWNUMERIC_DISPATCH
+#define SWNUMERIC_DISPATCH 0
+#endif
+
+#if SWNUMERIC_DISPATCH && !(defined(__x86_64__) || defined(__i386__))
+#undef SWNUMERIC_DISPATCH
+#define SWNUMERIC_DISPATCH 0
+#endif
+
+namespace dispatch {
+
+enum class Isa { baseline, avx2, avx512 };
+
+// The target the headers were compiled for here.
+constexpr std::string_view baseline_name() noexcept {
+#if defined(__AVX512F__)
+  return "avx512";
+#elif defined(__AVX2__)
+  return "avx2";
+#elif defined(__AVX__)
+  return "avx";
+#elif defined(__SSE2__)
+  return "sse2";
+#elif defined(__ARM_NEON)
+  return "neon";
+#else
+  return "scalar";
+#endif
+}
+
+constexpr std::string_view name(Isa isa) noexcept {
+  switch (isa) {
+    case Isa::avx2:
+      return "avx2";
+    case Isa::avx512:
+      return "avx512";
+    default:
+      return baseline_name();
+  }
+}
+
+// The highest level the baseline already covers.
+constexpr Isa compiled_level() noexcept {
+#if defined(__AVX512F__) && defined(__AVX512BW__) && defined(__AVX512DQ__) && \
+    defined(__AVX512VL__)
+  return Isa::avx512;
+#elif defined(__AVX2__) && defined(__FMA__) && defined(__F16C__)
+  return Isa::avx2;
+#else
+  return Isa::baseline;
+#endif
+}
+
+// true if this CPU (and OS) runs code built for isa
+inline bool supported(Isa isa) noexcept {
+#if defined(__x86_64__) || defined(__i386__)
+  __builtin_cpu_init();
+  const bool avx2 = __builtin_cpu_supports("avx2") &&
+                    __builtin_cpu_supports("fma") &&
+                    __builtin_cpu_supports("f16c");
+  switch (isa) {
+    case Isa::avx2:
+      return avx2;
+    case Isa::avx512:
+      return avx2 && __builtin_cpu_supports("avx512f") &&
+             __builtin_cpu_supports("avx512bw") &&
+             __builtin_cpu_supports("avx512dq") &&
+             __builtin_cpu_supports("avx512vl");
+    default:
+      return true;
+  }
+#else
+  return isa == Isa::baseline;
+#endif
+}
+
+inline std::optional<Isa> parse(std::string_view s) noexcept {
+  if (s == "baseline") return Isa::baseline;
+  if (s == "avx2") return Isa::avx2;
+  if (s == "avx512") return Isa::avx512;
+  return std::nullopt;
+}
+
+// The best supported level, capped by SWNUMERIC_ISA when it is set.
+inline Isa select() noexcept {
+  Isa isa = Isa::avx512;
+  if (const char* env = std::getenv("SWNUMERIC_ISA")) {
+    if (const auto forced = parse(env)) isa = *forced;
+  }
+  while (isa != Isa::baseline && !supported(isa)) {
+    isa = static_cast<Isa>(static_cast<int>(isa) - 1);
+  }
+  return isa;
+}
+
+// Kernels over the elements [begin, end) of operands given by their data();
+// elementwise kernels write them to out[0, end - begin), like
+// evaluate_into(). A null entry runs the inline code.
+template <typename T>
+struct Kernels {
+  void (*add)(const T* x, const T* y, T* out, size_t begin, size_t end);
+  void (*sub)(const T* x, const T* y, T* out, size_t begin, size_t end);
+  void (*mul)(const T* x, const T* y, T* out, size_t begin, size_t end);
+  void (*div)(const T* x, const T* y, T* out, size_t begin, size_t end);
+  void (*scale)(T a, const T* x, T* out, size_t begin, size_t end);
+  void (*axpy)(T a, const T* x, const T* y, T* out, size_t begin,
+               size_t end);  // a * x + y
+  void (*axpby)(T a, const T* x, T b, const T* y, T* out, size_t begin,
+                size_t end);  // a * x + b * y
+  void (*fma)(T a, const T* x, const T* y, T* out, size_t begin,
+              size_t end);  // fma(a, x, y)
+
+  T (*sum)(const T* x, size_t begin, size_t end);
+  T (*dot)(const T* x, const T* y, size_t begin, size_t end);
+  T (*sum_abs)(const T* x, size_t begin, size_t end);
+  T (*sum_squares)(const T* x, size_t begin, size_t end);
+  T (*max_abs)(const T* x, size_t begin, size_t end);
+
+  // batched problems [begin, end) of N = 2, 3, 4 at index N - 2
+  void (*gemm[3])(T alpha, const T* A, const T* B, T beta, T* D,
+                  size_t begin, size_t end);
+  size_t (*cholesky_solve[3])(const T* A, const T* b, T* x, size_t begin,
+                              size_t end);
+};
+
+struct KernelTable {
+  Isa isa;
+  Kernels<float> f32;
+  Kernels<double> f64;
+  bool (*csv_needs_quoting)(const char* p, size_t n, char delimiter);
+};
+
+#if SWNUMERIC_DISPATCH
+// defined by the builds of Kernels.cpp
+extern const KernelTable avx2_table;
+extern const KernelTable avx512_table;
+#endif
+
+inline const KernelTable& resolve() noexcept {
+  static constexpr KernelTable baseline{};
+  const Isa isa = select();
+  if (isa <= compiled_level()) return baseline;
+#if SWNUMERIC_DISPATCH
+  if (isa == Isa::avx512) return avx512_table;
+  if (isa == Isa::avx2) return avx2_table;
+#endif
+  return baseline;
+}
+
+// The table in use, chosen on first use.
+inline const KernelTable& table() noexcept {
+  static const KernelTable& t = resolve();
+  return t;
+}
+
+inline Isa active() noexcept {
+  const Isa isa = table().isa;
+  return isa == Isa::baseline ? compiled_level() : isa;
+}
+
+template <typename T>
+const Kernels<T>& kernels() noexcept {
+  static_assert(std::is_same_v<T, float> || std::is_same_v<T, double>);
+  if constexpr (std::is_same_v<T, float>) {
+    return table().f32;
+  } else {
+    return table().f64;
+  }
+}
+
+}  // namespace dispatch
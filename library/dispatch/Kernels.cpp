@@ -0,0 +1,146 @@
+//
+// The dispatched kernels of Dispatch.h. library/dispatch/CMakeLists.txt
+// compiles this file once per level with that level's target flags and
+// SWNUMERIC_KERNEL_ISA set to its name (avx2, avx512); each build defines
+// dispatch::<isa>_table.
+//
+// Every kernel is the library's own inline code, instantiated on views of the
+// raw operands, so it computes exactly what the inline path would for that
+// target. This file defines SWNUMERIC_BEGIN and SWNUMERIC_END (see
+// Namespace.h) to open and close an unnamed namespace, so everything the
+// library headers declare, and everything instantiated from them here, has
+// internal linkage. The headers include their system headers outside that
+// namespace, so std helpers used on plain types (std::fma(float, float,
+// float), std::min<size_t>, string_view members) would still be emitted as
+// shared weak copies built for this level, which the linker may pick for
+// baseline callers. CMakeLists.txt therefore compiles this file optimized in
+// every configuration, where they are inlined, and CheckKernels.cmake fails
+// the build if the object exports anything but its table.
+//
+
+#define SWNUMERIC_BEGIN namespace {
+#define SWNUMERIC_END }
+
+#include "library/dispatch/Dispatch.h"
+
+// the copies below run the inline code; only the callers dispatch
+#undef SWNUMERIC_DISPATCH
+#define SWNUMERIC_DISPATCH 0
+
+#include "library/expression/Expression.h"
+#include "library/expression/Reduction.h"
+#include "library/fileio/CSVWriter.h"
+#include "library/vectormatrix/Batched.h"
+#include "library/vectormatrix/View.h"
+
+namespace {
+
+namespace kernel {
+
+template <typename T>
+VectorView<T> leaf(const T* p, size_t end) {
+  return {const_cast<T*>(p), end};
+}
+
+template <typename T>
+void add(const T* x, const T* y, T* out, size_t b, size_t e) {
+  evaluate_into(out, leaf(x, e) + leaf(y, e), b, e);
+}
+template <typename T>
+void sub(const T* x, const T* y, T* out, size_t b, size_t e) {
+  evaluate_into(out, leaf(x, e) - leaf(y, e), b, e);
+}
+template <typename T>
+void mul(const T* x, const T* y, T* out, size_t b, size_t e) {
+  evaluate_into(out, leaf(x, e) * leaf(y, e), b, e);
+}
+template <typename T>
+void quotient(const T* x, const T* y, T* out, size_t b, size_t e) {
+  evaluate_into(out, leaf(x, e) / leaf(y, e), b, e);
+}
+template <typename T>
+void scale(T a, const T* x, T* out, size_t b, size_t e) {
+  evaluate_into(out, a * leaf(x, e), b, e);
+}
+template <typename T>
+void axpy(T a, const T* x, const T* y, T* out, size_t b, size_t e) {
+  evaluate_into(out, a * leaf(x, e) + leaf(y, e), b, e);
+}
+template <typename T>
+void axpby(T a, const T* x, T c, const T* y, T* out, size_t b, size_t e) {
+  evaluate_into(out, a * leaf(x, e) + c * leaf(y, e), b, e);
+}
+template <typename T>
+void fused(T a, const T* x, const T* y, T* out, size_t b, size_t e) {
+  evaluate_into(out, fma(a, leaf(x, e), leaf(y, e)), b, e);
+}
+
+template <typename Op, typename T>
+T reduce(const T* x, size_t b, size_t e) {
+  return reduction::reduce_range<Op>(leaf(x, e), b, e);
+}
+template <typename T>
+T dot(const T* x, const T* y, size_t b, size_t e) {
+  return reduction::reduce_range<reduction::Sum>(leaf(x, e) * leaf(y, e), b,
+                                                 e);
+}
+
+template <size_t N, typename T>
+void gemm(T alpha, const T* A, const T* B, T beta, T* D, size_t b, size_t e) {
+  batched::detail::unswitch_zero(beta, [&](T beta0) {
+    for (size_t i = b; i < e; i++) {
+      static_gemm<N, N, N>(alpha, A + i * N * N, B + i * N * N, beta0,
+                           D + i * N * N);
+    }
+  });
+}
+
+template <size_t N, typename T>
+size_t cholesky_solve(const T* A, const T* b, T* x, size_t b0, size_t e) {
+  constexpr size_t W = batched::detail::lanes<T>;
+  size_t failed = 0;
+  for (size_t i = b0; i < e; i += W) {
+    failed += batched::detail::cholesky_tile<N>(A + i * N * N, b + i * N,
+                                                x + i * N, std::min(W, e - i));
+  }
+  return failed;
+}
+
+bool needs_quoting(const char* p, size_t n, char delimiter) {
+  return csv_needs_quoting({p, n}, delimiter);
+}
+
+template <typename T>
+constexpr dispatch::Kernels<T> table() {
+  using namespace reduction;
+  return {add<T>,
+          sub<T>,
+          mul<T>,
+          quotient<T>,
+          scale<T>,
+          axpy<T>,
+          axpby<T>,
+          fused<T>,
+          reduce<Sum, T>,
+          dot<T>,
+          reduce<SumAbs, T>,
+          reduce<SumSquares, T>,
+          reduce<MaxAbs, T>,
+          {gemm<2, T>, gemm<3, T>, gemm<4, T>},
+          {cholesky_solve<2, T>, cholesky_solve<3, T>, cholesky_solve<4, T>}};
+}
+
+}  // namespace kernel
+
+}  // namespace
+
+#define SWNUMERIC_TABLE_NAME(isa) SWNUMERIC_TABLE_NAME_(isa)
+#define SWNUMERIC_TABLE_NAME_(isa) isa##_table
+
+namespace dispatch {
+
+extern const KernelTable SWNUMERIC_TABLE_NAME(SWNUMERIC_KERNEL_ISA) = {
+    Isa::SWNUMERIC_KERNEL_ISA, kernel::table<float>(), kernel::table<double>(),
+    kernel::needs_quoting};
+
+}  // namespace dispatch
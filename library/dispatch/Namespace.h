@@ -0,0 +1,19 @@
+#pragma once
+
+//
+// SWNUMERIC_BEGIN and SWNUMERIC_END enclose the declarations of every library
+// header. They expand to nothing, so the library lives in the global
+// namespace; library/dispatch/Kernels.cpp defines them to open and close an
+// unnamed namespace before including the headers, which gives its per-target
+// instantiations internal linkage.
+//
+// Headers include their dependencies, system and library, before
+// SWNUMERIC_BEGIN: a system header included inside it would declare the
+// standard library in the wrong namespace. Dispatch.h is the one exception
+// and stays global, since the kernel tables are shared by every build.
+//
+
+#ifndef SWNUMERIC_BEGIN
+#define SWNUMERIC_BEGIN
+#define SWNUMERIC_END
+#endif
@@ -0,0 +1,567 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cassert>
+#include <cstddef>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
+#include "library/dispatch/Namespace.h"
+#include "library/expression/Expression.h"
+#include "library/instrument/Instrument.h"
+#include "library/memory/Workspace.h"
+#include "library/parallel/Parallel.h"
+
+SWNUMERIC_BEGIN
+
+//
+// Several assignments of one size in a single pass.
+//
+//   assign_all(std::tie(u, v), a * b + c, a * b - d);
+//
+// is u = a * b + c; v = a * b - d, with the loop split into tiles of about
+// 32 KiB of operands. Every output is evaluated over a tile before the next
+// tile starts, so an input that several sources read comes from memory once
+// and from L1 after that. A subexpression that occurs more than once across
+// the sources (a * b above) is evaluated once per tile into a workspace buffer
+// that they all read. Candidates are found by type and compared at run time
+// (same operands, same scalars), from the largest down. A buffered value is
+// rounded to its type as if assigned to a temporary, so where the compiler
+// contracts a * b + c into an fma the fused and separate results may differ
+// in the last bit.
+//
+// A destination may appear in its own source, elementwise, as in assign(),
+// but must not overlap another destination or be read by another source.
+// Destinations that are not contiguous, sources evaluated as a whole (BLAS
+// products) and small static sizes fall back to separate assignments in
+// order. assign_all(par, ...) splits the range like assign(par, ...) and
+// tiles each thread's part.
+//
+
+namespace fused {
+
+// operand and output bytes one tile spans
+inline constexpr size_t tile_bytes = size_t{1} << 15;
+
+template <typename... E>
+struct types {};
+
+// The operands of the expression nodes, for walking and rebuilding trees.
+// Leaves have none.
+template <typename E>
+struct node {
+  static constexpr bool interior = false;
+};
+
+template <typename L, typename R, typename Op, typename T>
+struct node<BinaryExpr<L, R, Op, T>> {
+  using E = BinaryExpr<L, R, Op, T>;
+  using children = types<L, R>;
+  static constexpr bool interior = true;
+
+  template <typename F>
+  static auto map(const E& e, F&& f) {
+    return BinaryExpr<std::remove_cvref_t<decltype(f(e.lhs))>,
+                      std::remove_cvref_t<decltype(f(e.rhs))>, Op, T>{
+        f(e.lhs), f(e.rhs)};
+  }
+  template <typename F>
+  static bool zip(const E& a, const E& b, F&& f) {
+    return f(a.lhs, b.lhs) && f(a.rhs, b.rhs);
+  }
+  template <typename F>
+  static void each(const E& e, F&& f) {
+    f(e.lhs);
+    f(e.rhs);
+  }
+};
+
+template <typename X, typename Op, typename T>
+struct node<UnaryExpr<X, Op, T>> {
+  using E = UnaryExpr<X, Op, T>;
+  using children = types<X>;
+  static constexpr bool interior = true;
+
+  template <typename F>
+  static auto map(const E& e, F&& f) {
+    return UnaryExpr<std::remove_cvref_t<decltype(f(e.e))>, Op, T>{f(e.e)};
+  }
+  template <typename F>
+  static bool zip(const E& a, const E& b, F&& f) {
+    return f(a.e, b.e);
+  }
+  template <typename F>
+  static void each(const E& e, F&& f) {
+    f(e.e);
+  }
+};
+
+template <typename A, typename B, typename C, typename T>
+struct node<FmaExpr<A, B, C, T>> {
+  using E = FmaExpr<A, B, C, T>;
+  using children = types<A, B, C>;
+  static constexpr bool interior = true;
+
+  template <typename F>
+  static auto map(const E& e, F&& f) {
+    return FmaExpr<std::remove_cvref_t<decltype(f(e.a))>,
+                   std::remove_cvref_t<decltype(f(e.b))>,
+                   std::remove_cvref_t<decltype(f(e.c))>, T>{f(e.a), f(e.b),
+                                                             f(e.c)};
+  }
+  template <typename F>
+  static bool zip(const E& x, const E& y, F&& f) {
+    return f(x.a, y.a) && f(x.b, y.b) && f(x.c, y.c);
+  }
+  template <typename F>
+  static void each(const E& e, F&& f) {
+    f(e.a);
+    f(e.b);
+    f(e.c);
+  }
+};
+
+template <typename X, typename T>
+struct node<CastExpr<X, T>> {
+  using E = CastExpr<X, T>;
+  using children = types<X>;
+  static constexpr bool interior = true;
+
+  template <typename F>
+  static auto map(const E& e, F&& f) {
+    return CastExpr<std::remove_cvref_t<decltype(f(e.e))>, T>{f(e.e)};
+  }
+  template <typename F>
+  static bool zip(const E& a, const E& b, F&& f) {
+    return f(a.e, b.e);
+  }
+  template <typename F>
+  static void each(const E& e, F&& f) {
+    f(e.e);
+  }
+};
+
+// occurrences of S in the tree E
+template <typename S, typename E>
+constexpr size_t count() {
+  size_t n = std::is_same_v<S, E>;
+  if constexpr (node<E>::interior) {
+    n += []<typename... C>(types<C...>) {
+      return (count<S, C>() + ... + 0);
+    }(typename node<E>::children{});
+  }
+  return n;
+}
+
+// S is a node computing in float or double that occurs more than once in the
+// sources Es
+template <typename S, typename... Es>
+inline constexpr bool shared_v = [] {
+  if constexpr (node<S>::interior) {
+    using T = typename S::value_type;
+    return (std::is_same_v<T, float> || std::is_same_v<T, double>) &&
+           (count<S, Es>() + ...) >= 2;
+  } else {
+    return false;
+  }
+}();
+
+// occurrences of shared subexpressions in E, nested ones included
+template <typename E, typename... Es>
+constexpr size_t occurrences() {
+  size_t n = shared_v<E, Es...>;
+  if constexpr (node<E>::interior) {
+    n += []<typename... C>(types<C...>) {
+      return (occurrences<C, Es...>() + ... + 0);
+    }(typename node<E>::children{});
+  }
+  return n;
+}
+
+// nodes in the tree E
+template <typename E>
+constexpr size_t weight() {
+  if constexpr (node<E>::interior) {
+    return 1 + []<typename... C>(types<C...>) {
+      return (weight<C>() + ... + 0);
+    }(typename node<E>::children{});
+  } else {
+    return 1;
+  }
+}
+
+// true if a and b compute the same values: equal scalars, the same storage
+template <typename E>
+bool same(const E& a, const E& b) {
+  if constexpr (node<E>::interior) {
+    return node<E>::zip(a, b, [](const auto& x, const auto& y) {
+      return same(x, y);
+    });
+  } else if constexpr (is_scalar_expr_v<E>) {
+    return a.value == b.value;
+  } else if constexpr (requires { a.data(); }) {
+    if (a.data() != b.data() || a.size() != b.size()) return false;
+    if constexpr (requires { a.stride(); }) {
+      if (a.stride() != b.stride()) return false;
+    }
+    if constexpr (requires { a.ld(); }) {
+      if (a.ld() != b.ld()) return false;
+    }
+    if constexpr (MatrixExpr<E>) {
+      return a.cols() == b.cols();
+    } else {
+      return true;
+    }
+  } else {
+    return false;  // other leaves are never merged
+  }
+}
+
+// Calls f(x) for every operand x of e with storage.
+template <typename E, typename F>
+void each_leaf(const E& e, F&& f) {
+  if constexpr (node<E>::interior) {
+    node<E>::each(e, [&](const auto& x) { each_leaf(x, f); });
+  } else if constexpr (requires { e.data(); }) {
+    f(e);
+  }
+}
+
+template <typename A, typename B>
+bool overlaps(const A& a, const B& b) noexcept {
+  const auto* pa = reinterpret_cast<const char*>(a.data());
+  const auto* pb = reinterpret_cast<const char*>(b.data());
+  const size_t na = storage_extent(a) * sizeof(typename A::value_type);
+  const size_t nb = storage_extent(b) * sizeof(typename B::value_type);
+  return pa < pb + nb && pb < pa + na;
+}
+
+// true if an operand of e shares storage with d
+template <typename E, typename D>
+bool reads(const E& e, const D& d) {
+  bool r = false;
+  each_leaf(e, [&](const auto& x) { r = r || fused::overlaps(x, d); });
+  return r;
+}
+
+// An occurrence of a shared subexpression: read from the buffer of the tile
+// starting at *origin once one is bound to it, computed from inner (with its
+// own shared subexpressions rewritten) otherwise.
+template <typename Inner>
+struct SharedExpr : Expr<SharedExpr<Inner>, typename Inner::value_type> {
+  using value_type = typename Inner::value_type;
+  using T = value_type;
+
+  Inner inner;
+  void* const* buf;
+  const size_t* origin;
+
+  SharedExpr(const Inner& e, void* const* b, const size_t* o)
+      : inner(e), buf(b), origin(o) {}
+
+  size_t size() const { return inner.size(); }
+
+  __always_inline T operator[](size_t i) const {
+    if (const T* b = static_cast<const T*>(*buf)) return b[i - *origin];
+    return inner[i];
+  }
+  __always_inline packet_t<T> packet(size_t i) const {
+    if (const T* b = static_cast<const T*>(*buf)) {
+      return ploadu(b + (i - *origin));
+    }
+    if constexpr (PacketExpr<Inner>) {
+      return inner.packet(i);
+    } else {
+      return pgenerate<T>([&](size_t k) { return inner[i + k]; });
+    }
+  }
+};
+
+template <typename E>
+inline constexpr bool is_shared_expr_v = false;
+template <typename Inner>
+inline constexpr bool is_shared_expr_v<SharedExpr<Inner>> = true;
+
+// The shared subexpressions of the sources Es. rewrite() replaces every
+// occurrence of a type that recurs with a SharedExpr; bind() then compares
+// the occurrences, largest first, and gives each group of equal ones a
+// buffer filled once per tile. Occurrences with no equal partner are computed
+// in place, and those inside a buffered occurrence other than the one that
+// fills the buffer are never evaluated, so they take no part.
+template <typename... Es>
+class Cache {
+ public:
+  static constexpr size_t capacity = (occurrences<Es, Es...>() + ... + 0);
+
+  Cache(Workspace& ws, size_t tile) : ws_(ws), tile_(tile) {}
+
+  Cache(const Cache&) = delete;
+  Cache& operator=(const Cache&) = delete;
+
+  // e with shared subexpressions as SharedExpr
+  template <typename E>
+  decltype(auto) rewrite(const E& e, size_t parent = npos) {
+    if constexpr (shared_v<E, Es...>) {
+      using T = typename E::value_type;
+      const size_t k = used_++;
+      Occurrence& o = occ_[k];
+      o.kind = &tag<E>;
+      o.node = &e;
+      o.equal = [](const void* a, const void* b) {
+        return same(*static_cast<const E*>(a), *static_cast<const E*>(b));
+      };
+      o.weight = weight<E>();
+      o.bytes = sizeof(T);
+      o.parent = parent;
+      auto inner = node<E>::map(
+          e, [&](const auto& x) -> decltype(auto) { return rewrite(x, k); });
+      using S = SharedExpr<decltype(inner)>;
+      o.fill = [](const void* s, void* out, size_t begin, size_t end) {
+        evaluate_into(static_cast<T*>(out), static_cast<const S*>(s)->inner,
+                      begin, end);
+      };
+      return S{inner, &o.buf, &origin_};
+    } else if constexpr (node<E>::interior) {
+      return node<E>::map(e, [&](const auto& x) -> decltype(auto) {
+        return rewrite(x, parent);
+      });
+    } else {
+      return (e);
+    }
+  }
+
+  // Groups the occurrences in the rewritten trees and allocates their
+  // buffers; the trees must stay in place while the cache is used.
+  template <typename... Trees>
+  void bind(const Trees&... trees) {
+    size_t next = 0;
+    (link(trees, next), ...);
+    assert(next == used_);
+
+    std::array<size_t, capacity> order;
+    for (size_t k = 0; k < used_; k++) order[k] = k;
+    std::stable_sort(order.begin(), order.begin() + used_,
+                     [&](size_t a, size_t b) {
+                       return occ_[a].weight > occ_[b].weight;
+                     });
+    for (size_t i = 0; i < used_; i++) {
+      Occurrence& o = occ_[order[i]];
+      if (o.state != State::undecided) continue;
+      if (!live(o)) {
+        o.state = State::dead;
+        continue;
+      }
+      o.state = State::computed;
+      for (size_t j = i + 1; j < used_; j++) {
+        Occurrence& x = occ_[order[j]];
+        if (x.state == State::undecided && x.kind == o.kind && live(x) &&
+            o.equal(o.node, x.node)) {
+          if (o.state != State::buffered) {
+            o.state = State::buffered;
+            o.buf = ws_.allocate(tile_ * o.bytes);
+            fills_[buffers_++] = order[i];
+          }
+          x.state = State::read;
+          x.buf = o.buf;
+        }
+      }
+    }
+    // inner buffers first
+    std::reverse(fills_.begin(), fills_.begin() + buffers_);
+  }
+
+  // Evaluates every buffer over [begin, end).
+  void fill(size_t begin, size_t end) {
+    origin_ = begin;
+    for (size_t k = 0; k < buffers_; k++) {
+      const Occurrence& o = occ_[fills_[k]];
+      o.fill(o.shared, o.buf, begin, end);
+    }
+  }
+
+  // buffers bound
+  size_t size() const noexcept { return buffers_; }
+
+ private:
+  static constexpr size_t npos = ~size_t{0};
+
+  enum class State { undecided, computed, buffered, read, dead };
+
+  struct Occurrence {
+    const void* kind;    // &tag<E>
+    const void* node;    // the subexpression in the source
+    const void* shared;  // its SharedExpr in the rewritten tree
+    bool (*equal)(const void*, const void*);
+    void (*fill)(const void*, void*, size_t, size_t);
+    size_t weight;
+    size_t bytes;   // element size
+    size_t parent;  // the enclosing occurrence, or npos
+    State state = State::undecided;
+    void* buf = nullptr;
+  };
+
+  template <typename E>
+  static constexpr char tag = 0;
+
+  Workspace& ws_;
+  size_t tile_;
+  size_t origin_ = 0;
+  size_t used_ = 0;
+  size_t buffers_ = 0;
+  std::array<Occurrence, capacity> occ_;
+  std::array<size_t, capacity> fills_;
+
+  // evaluated whenever the tree holding it is: not inside an occurrence that
+  // is never evaluated or that reads another's buffer
+  bool live(const Occurrence& o) const noexcept {
+    if (o.parent == npos) return true;
+    const State s = occ_[o.parent].state;
+    return s == State::computed || s == State::buffered;
+  }
+
+  // records the SharedExpr of each occurrence, in rewrite() order
+  template <typename E>
+  void link(const E& e, size_t& next) {
+    if constexpr (is_shared_expr_v<E>) {
+      occ_[next++].shared = &e;
+      link(e.inner, next);
+    } else if constexpr (node<E>::interior) {
+      node<E>::each(e, [&](const auto& x) { link(x, next); });
+    }
+  }
+};
+
+template <typename T, typename... Ts>
+struct narrowest {
+  using type = T;
+};
+template <typename T, typename U, typename... Ts>
+struct narrowest<T, U, Ts...>
+    : narrowest<std::conditional_t<(sizeof(U) < sizeof(T)), U, T>, Ts...> {};
+
+template <typename Dsts, size_t K>
+using dst_t = std::remove_cvref_t<std::tuple_element_t<K, Dsts>>;
+
+// the narrowest destination element type
+template <typename Dsts,
+          typename = std::make_index_sequence<std::tuple_size_v<Dsts>>>
+struct narrowest_dst;
+template <typename Dsts, size_t... K>
+struct narrowest_dst<Dsts, std::index_sequence<K...>>
+    : narrowest<typename dst_t<Dsts, K>::value_type...> {};
+
+// true unless the outputs have to be assigned separately
+template <typename Dsts, typename... Es, size_t... K>
+constexpr bool fusable(const Dsts& dsts, std::index_sequence<K...>,
+                       const Es&...) {
+  constexpr size_t N = std::max({common_ctime_size_v<dst_t<Dsts, K>, Es>...});
+  if constexpr ((AssignsTo<Es, dst_t<Dsts, K>> || ...) ||
+                (N > 0 && N <= fixed_unroll_limit)) {
+    return false;
+  } else {
+    return (is_contiguous(std::get<K>(dsts)) && ...);
+  }
+}
+
+// Sizes agree, destinations are disjoint and none is read by another source.
+template <typename Dsts, typename... Es, size_t... K>
+bool valid(const Dsts& dsts, std::index_sequence<K...>, const Es&... srcs) {
+  const size_t n = std::get<0>(dsts).size();
+  bool ok = ((std::get<K>(dsts).size() == n && srcs.size() == n) && ...);
+  auto each_dst = [&](auto&& f) { (f(std::get<K>(dsts), K), ...); };
+  each_dst([&](const auto& d, size_t i) {
+    each_dst([&](const auto& o, size_t j) {
+      ok = ok && (i == j || !fused::overlaps(d, o));
+    });
+    size_t j = 0;
+    ((ok = ok && (j++ == i || !reads(srcs, d))), ...);
+  });
+  return ok;
+}
+
+// dsts[k] = srcs[k] over [begin, end), tile by tile
+template <typename Dsts, typename... Es, size_t... K>
+void run(Dsts& dsts, size_t begin, size_t end, std::index_sequence<K...>,
+         const Es&... srcs) {
+  constexpr size_t width =
+      std::max({sizeof(typename dst_t<Dsts, K>::value_type)...});
+  constexpr size_t streams = ((streamed_operands_v<Es> + 1) + ...) +
+                             Cache<Es...>::capacity;
+  constexpr size_t tile =
+      std::max<size_t>(64, tile_bytes / (width * streams) / 64 * 64);
+
+  Workspace& ws = Workspace::local();
+  Workspace::Scope scope(ws);
+  Cache<Es...> cache(ws, tile);
+  std::tuple<decltype(cache.rewrite(srcs))...> trees{cache.rewrite(srcs)...};
+  cache.bind(std::get<K>(trees)...);
+  for (size_t b = begin; b < end;) {
+    const size_t e = std::min(end, (b / tile + 1) * tile);
+    cache.fill(b, e);
+    (evaluate_into(std::get<K>(dsts).data() + b, std::get<K>(trees), b, e),
+     ...);
+    b = e;
+  }
+}
+
+template <typename Dsts, typename... Es, size_t... K>
+void record(const Dsts& dsts, std::index_sequence<K...>, const Es&...) {
+  (instrument::count_assign<typename dst_t<Dsts, K>::value_type>(
+       std::get<K>(dsts).size(), streamed_operands_v<Es>),
+   ...);
+}
+
+}  // namespace fused
+
+// A tuple of references to destinations, as made by std::tie.
+template <typename D>
+concept Destinations = requires { std::tuple_size<std::remove_cvref_t<D>>{}; };
+
+// std::get<k>(dsts) = srcs[k] for every k, in one tiled pass
+template <typename Dsts, ExprLike... Es>
+  requires Destinations<Dsts> &&
+           (std::tuple_size_v<std::remove_cvref_t<Dsts>> == sizeof...(Es))
+void assign_all(Dsts&& dsts, const Es&... srcs) {
+  constexpr auto K = std::index_sequence_for<Es...>{};
+  if constexpr (sizeof...(Es) > 0) {
+    assert(fused::valid(dsts, K, srcs...));
+    if (!fused::fusable(dsts, K, srcs...)) {
+      [&]<size_t... I>(std::index_sequence<I...>) {
+        (assign(std::get<I>(dsts), srcs), ...);
+      }(K);
+      return;
+    }
+    fused::record(dsts, K, srcs...);
+    fused::run(dsts, 0, std::get<0>(dsts).size(), K, srcs...);
+  }
+}
+
+// assign_all, in parallel
+template <typename Dsts, ExprLike... Es>
+  requires Destinations<Dsts> &&
+           (std::tuple_size_v<std::remove_cvref_t<Dsts>> == sizeof...(Es))
+void assign_all(const ParallelPolicy& policy, Dsts&& dsts,
+                const Es&... srcs) {
+  constexpr auto K = std::index_sequence_for<Es...>{};
+  if constexpr (sizeof...(Es) > 0) {
+    assert(fused::valid(dsts, K, srcs...));
+    if (!fused::fusable(dsts, K, srcs...)) {
+      [&]<size_t... I>(std::index_sequence<I...>) {
+        (assign(policy, std::get<I>(dsts), srcs), ...);
+      }(K);
+      return;
+    }
+    // boundaries on cache lines of every destination
+    using T = typename fused::narrowest_dst<std::remove_cvref_t<Dsts>>::type;
+    const instrument::Region region("assign_all(par)");
+    fused::record(dsts, K, srcs...);
+    parallel_range<T>(policy, std::get<0>(dsts).size(),
+                      [&](size_t b, size_t e) {
+                        fused::run(dsts, b, e, K, srcs...);
+                      });
+  }
+}
+
+SWNUMERIC_END
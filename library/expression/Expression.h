@@ -1,4 +1,20 @@
+#pragma once
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <concepts>
 #include <cstddef>
+#include <type_traits>
+#include <utility>
+
+#include "library/dispatch/Dispatch.h"
+#include "library/dispatch/Namespace.h"
+#include "library/expression/Packet.h"
+#include "library/expression/Precision.h"
+#include "library/instrument/Instrument.h"
+
+SWNUMERIC_BEGIN
 
 template <typename Derived, typename T>
 struct Expr {
@@ -7,12 +23,403 @@ struct Expr {
   }
 };
 
+// Any sized node of the expression hierarchy: containers, views and nodes.
+template <typename E>
+concept ExprLike = requires(const E& e) {
+  typename E::value_type;
+  { e.size() } -> std::convertible_to<size_t>;
+} && std::is_base_of_v<Expr<E, typename E::value_type>, E>;
+
+// A sized expression with a row-major matrix shape.
+template <typename E>
+concept MatrixExpr = ExprLike<E> && requires(const E& e) {
+  { e.rows() } -> std::convertible_to<size_t>;
+  { e.cols() } -> std::convertible_to<size_t>;
+};
+
+// An expression that can be evaluated a packet at a time. Leaves provide
+// packet loads and nodes combine their operands' packets through Op::packet.
+template <typename E>
+concept PacketExpr = requires(const E& e, size_t i) {
+  { e.packet(i) } -> std::same_as<packet_t<typename E::value_type>>;
+};
+
+//
+// storage layout
+//
+// Leaves with data() store their elements contiguously unless they report
+// otherwise: strided vector views provide stride(), and row-major matrix views
+// with padded rows provide ld(), the distance between row starts.
+//
+
+// Row stride of a row-major matrix operand.
+template <MatrixExpr M>
+constexpr size_t leading_dim(const M& m) noexcept {
+  if constexpr (requires { m.ld(); }) {
+    return m.ld();
+  } else {
+    return m.cols();
+  }
+}
+
+// Element stride of a vector operand.
+template <ExprLike V>
+constexpr size_t stride_of(const V& v) noexcept {
+  if constexpr (requires { v.stride(); }) {
+    return v.stride();
+  } else {
+    return 1;
+  }
+}
+
+// true if element i is data()[i] for every i
+template <typename E>
+constexpr bool is_contiguous(const E& e) noexcept {
+  if constexpr (!requires { e.data(); }) {
+    return false;
+  } else if constexpr (requires { e.stride(); }) {
+    return e.stride() == 1 || e.size() <= 1;
+  } else if constexpr (requires { e.ld(); }) {
+    return e.ld() == e.cols() || e.rows() <= 1;
+  } else {
+    return true;
+  }
+}
+
+// Number of elements from data() to one past the last element.
+template <typename E>
+constexpr size_t storage_extent(const E& e) noexcept {
+  if (e.size() == 0) return 0;
+  if constexpr (requires { e.stride(); }) {
+    return (e.size() - 1) * e.stride() + 1;
+  } else if constexpr (requires { e.ld(); }) {
+    return (e.rows() - 1) * e.ld() + e.cols();
+  } else {
+    return e.size();
+  }
+}
+
+// Compile-time size of an expression, or 0 when it is only known at run time.
+// Statically sized containers declare ctime_size; nodes propagate it from
+// their operands.
+template <typename E>
+inline constexpr size_t ctime_size_v = 0;
+
+template <typename E>
+  requires requires { E::ctime_size; }
+inline constexpr size_t ctime_size_v<E> = E::ctime_size;
+
+// true unless two of the operands have different nonzero static sizes
+template <typename... E>
+inline constexpr bool ctime_sizes_agree_v = [] {
+  size_t n = 0;
+  for (size_t m : {size_t{0}, ctime_size_v<E>...}) {
+    if (m == 0) continue;
+    if (n != 0 && n != m) return false;
+    n = m;
+  }
+  return true;
+}();
+
+// the static size shared by the sized operands, or 0
+template <typename... E>
+inline constexpr size_t common_ctime_size_v =
+    std::max({size_t{0}, ctime_size_v<E>...});
+
+// How expression nodes hold their operands. Sub-expressions, scalars and
+// views are small and held by value, so a node never refers to a temporary
+// and a whole tree can be kept in an auto variable. Containers that own their
+// elements specialize this to be held by reference; they must outlive any
+// expression built on them.
+template <typename E>
+struct expr_storage {
+  using type = E;
+};
+
+template <typename E>
+using expr_storage_t = typename expr_storage<E>::type;
+
+// A scalar broadcast to every index. It has no size of its own.
+template <typename T>
+struct ScalarExpr : Expr<ScalarExpr<T>, T> {
+  using value_type = T;
+
+  T value;
+
+  constexpr explicit ScalarExpr(T v) : value(v) {}
+
+  constexpr T operator[](size_t) const { return value; }
+  packet_t<T> packet(size_t) const { return pset1(value); }
+};
+
+template <typename E>
+inline constexpr bool is_scalar_expr_v = false;
+
+template <typename T>
+inline constexpr bool is_scalar_expr_v<ScalarExpr<T>> = true;
+
 template <typename LHS, typename RHS, typename Op, typename T>
 struct BinaryExpr : Expr<BinaryExpr<LHS, RHS, Op, T>, T> {
-  const LHS& lhs;
-  const RHS& rhs;
+  static_assert(ctime_sizes_agree_v<LHS, RHS>,
+                "Operands of an expression have different static sizes.");
+
+  using value_type = T;
+  constexpr static size_t ctime_size = common_ctime_size_v<LHS, RHS>;
 
-  constexpr T operator[](size_t i) const { return Op::apply(lhs[i], rhs[i]); }
+  expr_storage_t<LHS> lhs;
+  expr_storage_t<RHS> rhs;
+
+  constexpr BinaryExpr(const LHS& l, const RHS& r) : lhs(l), rhs(r) {}
+
+  constexpr size_t size() const {
+    if constexpr (is_scalar_expr_v<LHS>) {
+      return rhs.size();
+    } else {
+      return lhs.size();
+    }
+  }
+  constexpr size_t rows() const
+    requires MatrixExpr<LHS> || MatrixExpr<RHS>
+  {
+    if constexpr (MatrixExpr<LHS>) {
+      return lhs.rows();
+    } else {
+      return rhs.rows();
+    }
+  }
+  constexpr size_t cols() const
+    requires MatrixExpr<LHS> || MatrixExpr<RHS>
+  {
+    if constexpr (MatrixExpr<LHS>) {
+      return lhs.cols();
+    } else {
+      return rhs.cols();
+    }
+  }
+
+  __always_inline constexpr T operator[](size_t i) const {
+    return Op::apply(lhs[i], rhs[i]);
+  }
+  __always_inline packet_t<T> packet(size_t i) const
+    requires PacketExpr<LHS> && PacketExpr<RHS>
+  {
+    return Op::packet(lhs.packet(i), rhs.packet(i));
+  }
+};
+
+template <typename E, typename Op, typename T>
+struct UnaryExpr : Expr<UnaryExpr<E, Op, T>, T> {
+  using value_type = T;
+  constexpr static size_t ctime_size = ctime_size_v<E>;
+
+  expr_storage_t<E> e;
+
+  constexpr explicit UnaryExpr(const E& x) : e(x) {}
+
+  constexpr size_t size() const { return e.size(); }
+  constexpr size_t rows() const
+    requires MatrixExpr<E>
+  {
+    return e.rows();
+  }
+  constexpr size_t cols() const
+    requires MatrixExpr<E>
+  {
+    return e.cols();
+  }
+
+  __always_inline constexpr T operator[](size_t i) const {
+    return Op::apply(e[i]);
+  }
+  // only for operations with a packet form
+  __always_inline packet_t<T> packet(size_t i) const
+    requires PacketExpr<E> && requires(packet_t<T> p) { Op::packet(p); }
+  {
+    return Op::packet(e.packet(i));
+  }
+};
+
+// a * b + c, with a single rounding where the target has FMA. Any one or two
+// of the operands may be ScalarExpr.
+template <typename A, typename B, typename C, typename T>
+struct FmaExpr : Expr<FmaExpr<A, B, C, T>, T> {
+  static_assert(ctime_sizes_agree_v<A, B, C>,
+                "Operands of an expression have different static sizes.");
+
+  using value_type = T;
+  constexpr static size_t ctime_size = common_ctime_size_v<A, B, C>;
+
+  expr_storage_t<A> a;
+  expr_storage_t<B> b;
+  expr_storage_t<C> c;
+
+  constexpr FmaExpr(const A& x, const B& y, const C& z) : a(x), b(y), c(z) {}
+
+  constexpr size_t size() const {
+    if constexpr (!is_scalar_expr_v<A>) {
+      return a.size();
+    } else if constexpr (!is_scalar_expr_v<B>) {
+      return b.size();
+    } else {
+      return c.size();
+    }
+  }
+  constexpr size_t rows() const
+    requires MatrixExpr<A> || MatrixExpr<B> || MatrixExpr<C>
+  {
+    if constexpr (MatrixExpr<A>) {
+      return a.rows();
+    } else if constexpr (MatrixExpr<B>) {
+      return b.rows();
+    } else {
+      return c.rows();
+    }
+  }
+  constexpr size_t cols() const
+    requires MatrixExpr<A> || MatrixExpr<B> || MatrixExpr<C>
+  {
+    if constexpr (MatrixExpr<A>) {
+      return a.cols();
+    } else if constexpr (MatrixExpr<B>) {
+      return b.cols();
+    } else {
+      return c.cols();
+    }
+  }
+
+  // the same operation as the packet path, so the result of an element does
+  // not depend on where a chunk starts
+  __always_inline constexpr T operator[](size_t i) const {
+    return pmadd(T(a[i]), T(b[i]), T(c[i]));
+  }
+  __always_inline packet_t<T> packet(size_t i) const
+    requires PacketExpr<A> && PacketExpr<B> && PacketExpr<C>
+  {
+    return pmadd(a.packet(i), b.packet(i), c.packet(i));
+  }
+};
+
+// e converted to T elementwise. Contiguous leaves convert a packet at a time
+// as they are loaded; other operands are converted a lane at a time, except
+// when the cast is the whole right-hand side of an assignment, which
+// evaluates the operand in packets of its own type and converts on store.
+template <typename E, typename T>
+struct CastExpr : Expr<CastExpr<E, T>, T> {
+  using value_type = T;
+  using source_type = typename E::value_type;
+  constexpr static size_t ctime_size = ctime_size_v<E>;
+
+  expr_storage_t<E> e;
+
+  constexpr explicit CastExpr(const E& x) : e(x) {}
+
+  constexpr size_t size() const { return e.size(); }
+  constexpr size_t rows() const
+    requires MatrixExpr<E>
+  {
+    return e.rows();
+  }
+  constexpr size_t cols() const
+    requires MatrixExpr<E>
+  {
+    return e.cols();
+  }
+
+  __always_inline constexpr T operator[](size_t i) const { return T(e[i]); }
+  __always_inline packet_t<T> packet(size_t i) const {
+    if constexpr (requires { e.data(); }) {
+      if (is_contiguous(e)) {
+        return PacketConvert<T, source_type>::load(e.data() + i);
+      }
+    }
+    return pgenerate<T>([&](size_t k) { return T(e[i + k]); });
+  }
+};
+
+template <typename E>
+inline constexpr bool is_cast_expr_v = false;
+
+template <typename E, typename T>
+inline constexpr bool is_cast_expr_v<CastExpr<E, T>> = true;
+
+// An operand of a node computing in T: itself, or converted to T.
+template <typename T, typename E>
+using operand_t =
+    std::conditional_t<std::is_same_v<typename E::value_type, T>, E,
+                       CastExpr<E, T>>;
+
+template <typename T, typename E>
+constexpr decltype(auto) operand(const E& e) {
+  if constexpr (std::is_same_v<typename E::value_type, T>) {
+    return (e);
+  } else {
+    return CastExpr<E, T>{e};
+  }
+}
+
+// e converted to T; the only way to narrow, e.g. x = cast<float>(y).
+template <Scalar T, ExprLike E>
+constexpr CastExpr<E, T> cast(const E& e) {
+  return CastExpr<E, T>{e};
+}
+
+//
+// broadcasting
+//
+// Vectors repeated along one dimension of a row-major matrix, for mixed-shape
+// expressions such as A - broadcast_rows(mean, A.rows()).
+//
+
+// R x v.size(); every row is v.
+template <typename V, typename T>
+struct RowBroadcast : Expr<RowBroadcast<V, T>, T> {
+  using value_type = T;
+
+  expr_storage_t<V> v;
+  size_t R;
+
+  constexpr RowBroadcast(const V& x, size_t rows) : v(x), R(rows) {}
+
+  constexpr size_t size() const { return R * cols(); }
+  constexpr size_t rows() const { return R; }
+  constexpr size_t cols() const { return v.size(); }
+
+  constexpr T operator[](size_t i) const { return v[i % cols()]; }
+  packet_t<T> packet(size_t i) const {
+    constexpr size_t W = packet_size<T>;
+    const size_t C = cols(), j = i % C;
+    if constexpr (requires { v.data(); }) {
+      if (j + W <= C && is_contiguous(v)) return ploadu(v.data() + j);
+    }
+    if constexpr (PacketExpr<V>) {
+      // i is packet aligned, so j is too when C is a multiple of W
+      if (C % W == 0) return v.packet(j);
+    }
+    return pgenerate<T>([&](size_t k) { return T(v[(i + k) % C]); });
+  }
+};
+
+// v.size() x C; every column is v.
+template <typename V, typename T>
+struct ColBroadcast : Expr<ColBroadcast<V, T>, T> {
+  using value_type = T;
+
+  expr_storage_t<V> v;
+  size_t C;
+
+  constexpr ColBroadcast(const V& x, size_t cols) : v(x), C(cols) {}
+
+  constexpr size_t size() const { return rows() * C; }
+  constexpr size_t rows() const { return v.size(); }
+  constexpr size_t cols() const { return C; }
+
+  constexpr T operator[](size_t i) const { return v[i / C]; }
+  packet_t<T> packet(size_t i) const {
+    constexpr size_t W = packet_size<T>;
+    const size_t r = i / C;
+    if ((i + W - 1) / C == r) return pset1(T(v[r]));
+    return pgenerate<T>([&](size_t k) { return T(v[(i + k) / C]); });
+  }
 };
 
 // Atomic operations
@@ -22,6 +429,10 @@ struct Add {
   constexpr static T apply(T a, T b) noexcept {
     return a + b;
   }
+  template <typename P>
+  static P packet(P a, P b) noexcept {
+    return padd(a, b);
+  }
 };
 
 struct Sub {
@@ -29,6 +440,10 @@ struct Sub {
   constexpr static T apply(T a, T b) noexcept {
     return a - b;
   }
+  template <typename P>
+  static P packet(P a, P b) noexcept {
+    return psub(a, b);
+  }
 };
 
 struct Mul {
@@ -36,6 +451,10 @@ struct Mul {
   constexpr static T apply(T a, T b) noexcept {
     return a * b;
   }
+  template <typename P>
+  static P packet(P a, P b) noexcept {
+    return pmul(a, b);
+  }
 };
 
 struct Div {
@@ -43,4 +462,507 @@ struct Div {
   constexpr static T apply(T a, T b) noexcept {
     return a / b;
   }
+  template <typename P>
+  static P packet(P a, P b) noexcept {
+    return pdiv(a, b);
+  }
+};
+
+struct Neg {
+  template <typename T>
+  constexpr static T apply(T a) noexcept {
+    return -a;
+  }
+  template <typename P>
+  static P packet(P a) noexcept {
+    return pneg(a);
+  }
+};
+
+struct Abs {
+  template <typename T>
+  constexpr static T apply(T a) noexcept {
+    return a < T{0} ? -a : a;
+  }
+  template <typename P>
+  static P packet(P a) noexcept {
+    return pabs(a);
+  }
+};
+
+struct Sqrt {
+  template <typename T>
+  static T apply(T a) noexcept {
+    return std::sqrt(a);
+  }
+  template <typename P>
+  static P packet(P a) noexcept {
+    return psqrt(a);
+  }
+};
+
+// Exp and Log have no packet form; expressions containing them are evaluated
+// a scalar at a time (and left to the compiler's vectorizer).
+struct Exp {
+  template <typename T>
+  static T apply(T a) noexcept {
+    return std::exp(a);
+  }
+};
+
+struct Log {
+  template <typename T>
+  static T apply(T a) noexcept {
+    return std::log(a);
+  }
+};
+
+//
+// operators
+//
+// Elementwise arithmetic between expressions of equal size, and between an
+// expression and a scalar of its value_type. Everything stays lazy until
+// assigned, so a whole formula is evaluated in one pass:
+//
+//   z = 2.0 * x + fma(a, y, -b) / sqrt(w);
+//
+
+#define SWNUMERIC_BINARY_OPERATOR(OP, NAME)                              \
+  template <ExprLike E1, ExprLike E2>                                    \
+  constexpr auto operator OP(const E1& a, const E2& b) {                 \
+    assert(a.size() == b.size());                                        \
+    using T = promote_t<typename E1::value_type, typename E2::value_type>; \
+    return BinaryExpr<operand_t<T, E1>, operand_t<T, E2>, NAME, T>{      \
+        operand<T>(a), operand<T>(b)};                                   \
+  }
+
+SWNUMERIC_BINARY_OPERATOR(+, Add)
+SWNUMERIC_BINARY_OPERATOR(-, Sub)
+SWNUMERIC_BINARY_OPERATOR(*, Mul)
+SWNUMERIC_BINARY_OPERATOR(/, Div)
+
+#undef SWNUMERIC_BINARY_OPERATOR
+
+#define SWNUMERIC_SCALAR_OPERATOR(OP, NAME)                               \
+  template <ExprLike E>                                                   \
+  constexpr auto operator OP(const E& a,                                  \
+                             compute_t<typename E::value_type> s) {       \
+    using T = compute_t<typename E::value_type>;                          \
+    return BinaryExpr<operand_t<T, E>, ScalarExpr<T>, NAME, T>{           \
+        operand<T>(a), ScalarExpr<T>{s}};                                 \
+  }                                                                       \
+  template <ExprLike E>                                                   \
+  constexpr auto operator OP(compute_t<typename E::value_type> s,         \
+                             const E& a) {                                \
+    using T = compute_t<typename E::value_type>;                          \
+    return BinaryExpr<ScalarExpr<T>, operand_t<T, E>, NAME, T>{           \
+        ScalarExpr<T>{s}, operand<T>(a)};                                 \
+  }
+
+SWNUMERIC_SCALAR_OPERATOR(+, Add)
+SWNUMERIC_SCALAR_OPERATOR(-, Sub)
+SWNUMERIC_SCALAR_OPERATOR(*, Mul)
+SWNUMERIC_SCALAR_OPERATOR(/, Div)
+
+#undef SWNUMERIC_SCALAR_OPERATOR
+
+template <ExprLike E>
+constexpr auto operator-(const E& a) {
+  using T = compute_t<typename E::value_type>;
+  return UnaryExpr<operand_t<T, E>, Neg, T>{operand<T>(a)};
+}
+
+template <ExprLike E>
+constexpr auto abs(const E& a) {
+  using T = compute_t<typename E::value_type>;
+  return UnaryExpr<operand_t<T, E>, Abs, T>{operand<T>(a)};
+}
+
+template <ExprLike E>
+constexpr auto sqrt(const E& a) {
+  using T = compute_t<typename E::value_type>;
+  return UnaryExpr<operand_t<T, E>, Sqrt, T>{operand<T>(a)};
+}
+
+template <ExprLike E>
+constexpr auto exp(const E& a) {
+  using T = compute_t<typename E::value_type>;
+  return UnaryExpr<operand_t<T, E>, Exp, T>{operand<T>(a)};
+}
+
+template <ExprLike E>
+constexpr auto log(const E& a) {
+  using T = compute_t<typename E::value_type>;
+  return UnaryExpr<operand_t<T, E>, Log, T>{operand<T>(a)};
+}
+
+// fma operands: expressions by reference (converted when their type is not
+// the node's), scalars broadcast as ScalarExpr
+template <typename T, typename X>
+constexpr decltype(auto) fma_operand(const X& x) {
+  if constexpr (ExprLike<X>) {
+    return operand<T>(x);
+  } else {
+    return ScalarExpr<T>{T(x)};
+  }
+}
+
+template <typename T, typename X>
+struct fma_operand_type {
+  using type = ScalarExpr<T>;
+};
+template <typename T, ExprLike X>
+struct fma_operand_type<T, X> {
+  using type = operand_t<T, X>;
 };
+
+template <typename T, typename X>
+using fma_operand_t = typename fma_operand_type<T, X>::type;
+
+// value type of the first expression operand
+template <typename A, typename B, typename C>
+using fma_first_t = typename std::conditional_t<
+    ExprLike<A>, A, std::conditional_t<ExprLike<B>, B, C>>::value_type;
+
+// value type of an operand; scalars take the first expression's
+template <typename X, typename Fallback>
+struct fma_value {
+  using type = Fallback;
+};
+template <ExprLike X, typename Fallback>
+struct fma_value<X, Fallback> {
+  using type = typename X::value_type;
+};
+
+template <typename A, typename B, typename C>
+using fma_value_t =
+    promote_t<typename fma_value<A, fma_first_t<A, B, C>>::type,
+              typename fma_value<B, fma_first_t<A, B, C>>::type,
+              typename fma_value<C, fma_first_t<A, B, C>>::type>;
+
+// a * b + c where at least one of a, b, c is an expression and the others
+// may be scalars. Rounded once where the target has FMA (see fused_madd),
+// otherwise a multiply and an add, for every element alike.
+template <typename A, typename B, typename C>
+  requires(ExprLike<A> || ExprLike<B> || ExprLike<C>)
+constexpr auto fma(const A& a, const B& b, const C& c) {
+  using T = fma_value_t<A, B, C>;
+  FmaExpr<fma_operand_t<T, A>, fma_operand_t<T, B>, fma_operand_t<T, C>, T>
+      e{fma_operand<T>(a), fma_operand<T>(b), fma_operand<T>(c)};
+  auto check = [&](const auto& x) {
+    if constexpr (ExprLike<std::decay_t<decltype(x)>>) {
+      assert(x.size() == e.size());
+    }
+  };
+  check(a);
+  check(b);
+  check(c);
+  return e;
+}
+
+template <ExprLike V>
+constexpr auto broadcast_rows(const V& v, size_t rows) {
+  return RowBroadcast<V, typename V::value_type>{v, rows};
+}
+
+template <ExprLike V>
+constexpr auto broadcast_cols(const V& v, size_t cols) {
+  return ColBroadcast<V, typename V::value_type>{v, cols};
+}
+
+// Number of leaves with storage in an expression tree, i.e. the operands an
+// elementwise evaluation streams from memory. Nodes other than the ones below
+// count as none; used by instrumentation to estimate bytes moved.
+template <typename E>
+inline constexpr size_t streamed_operands_v =
+    requires(const E& e) { e.data(); } ? 1 : 0;
+
+template <typename LHS, typename RHS, typename Op, typename T>
+inline constexpr size_t streamed_operands_v<BinaryExpr<LHS, RHS, Op, T>> =
+    streamed_operands_v<LHS> + streamed_operands_v<RHS>;
+
+template <typename E, typename Op, typename T>
+inline constexpr size_t streamed_operands_v<UnaryExpr<E, Op, T>> =
+    streamed_operands_v<E>;
+
+template <typename E, typename T>
+inline constexpr size_t streamed_operands_v<CastExpr<E, T>> =
+    streamed_operands_v<E>;
+
+template <typename A, typename B, typename C, typename T>
+inline constexpr size_t streamed_operands_v<FmaExpr<A, B, C, T>> =
+    streamed_operands_v<A> + streamed_operands_v<B> + streamed_operands_v<C>;
+
+#if SWNUMERIC_DISPATCH
+//
+// matching expressions to the dispatched kernels in Dispatch.h
+//
+namespace dispatch {
+
+// An operand the kernels can read through data(): its elements are data()[i]
+// when is_contiguous() holds.
+template <typename E, typename T>
+concept Leaf = std::is_same_v<typename E::value_type, T> &&
+               requires(const E& e) {
+                 { e.data() } -> std::convertible_to<const T*>;
+               };
+
+template <typename E>
+inline constexpr bool is_binary_v = false;
+template <typename L, typename R, typename Op, typename T>
+inline constexpr bool is_binary_v<BinaryExpr<L, R, Op, T>> = true;
+
+template <typename E>
+inline constexpr bool is_fma_v = false;
+template <typename A, typename B, typename C, typename T>
+inline constexpr bool is_fma_v<FmaExpr<A, B, C, T>> = true;
+
+template <typename E, typename Op>
+inline constexpr bool is_op_v = false;
+template <typename L, typename R, typename Op, typename T>
+inline constexpr bool is_op_v<BinaryExpr<L, R, Op, T>, Op> = true;
+
+// a * x or x * a for a leaf x
+template <typename E, typename T>
+inline constexpr bool is_scaled_v = [] {
+  if constexpr (is_op_v<E, Mul>) {
+    using L = std::remove_cvref_t<decltype(std::declval<E>().lhs)>;
+    using R = std::remove_cvref_t<decltype(std::declval<E>().rhs)>;
+    return (is_scalar_expr_v<L> && Leaf<R, T>) ||
+           (Leaf<L, T> && is_scalar_expr_v<R>);
+  } else {
+    return false;
+  }
+}();
+
+template <typename E>
+constexpr auto scale_of(const E& e) {
+  if constexpr (is_scalar_expr_v<std::remove_cvref_t<decltype(e.lhs)>>) {
+    return e.lhs.value;
+  } else {
+    return e.rhs.value;
+  }
+}
+template <typename E>
+constexpr const auto* data_of(const E& e) {
+  if constexpr (is_scalar_expr_v<std::remove_cvref_t<decltype(e.lhs)>>) {
+    return e.rhs.data();
+  } else {
+    return e.lhs.data();
+  }
+}
+template <typename E>
+constexpr bool contiguous_scaled(const E& e) {
+  if constexpr (is_scalar_expr_v<std::remove_cvref_t<decltype(e.lhs)>>) {
+    return is_contiguous(e.rhs);
+  } else {
+    return is_contiguous(e.lhs);
+  }
+}
+
+// Writes src[begin, end) to out[0, end - begin) with a dispatched kernel,
+// if there is one for the shape of src and its operands are contiguous.
+template <typename T, typename E>
+bool evaluate(T* out, const E& src, size_t begin, size_t end) {
+  if constexpr (std::is_same_v<T, float> || std::is_same_v<T, double>) {
+    const Kernels<T>& k = kernels<T>();
+    if constexpr (is_binary_v<E>) {
+      using L = std::remove_cvref_t<decltype(src.lhs)>;
+      using R = std::remove_cvref_t<decltype(src.rhs)>;
+      if constexpr (Leaf<L, T> && Leaf<R, T>) {
+        auto* f = is_op_v<E, Add>   ? k.add
+                  : is_op_v<E, Sub> ? k.sub
+                  : is_op_v<E, Mul> ? k.mul
+                                    : k.div;
+        if (f && is_contiguous(src.lhs) && is_contiguous(src.rhs)) {
+          f(src.lhs.data(), src.rhs.data(), out, begin, end);
+          return true;
+        }
+      } else if constexpr (is_scaled_v<E, T>) {
+        if (k.scale && contiguous_scaled(src)) {
+          k.scale(scale_of(src), data_of(src), out, begin, end);
+          return true;
+        }
+      } else if constexpr (is_op_v<E, Add> && is_scaled_v<L, T> &&
+                           is_scaled_v<R, T>) {
+        if (k.axpby && contiguous_scaled(src.lhs) &&
+            contiguous_scaled(src.rhs)) {
+          k.axpby(scale_of(src.lhs), data_of(src.lhs), scale_of(src.rhs),
+                  data_of(src.rhs), out, begin, end);
+          return true;
+        }
+      } else if constexpr (is_op_v<E, Add> && is_scaled_v<L, T> &&
+                           Leaf<R, T>) {
+        if (k.axpy && contiguous_scaled(src.lhs) && is_contiguous(src.rhs)) {
+          k.axpy(scale_of(src.lhs), data_of(src.lhs), src.rhs.data(), out,
+                 begin, end);
+          return true;
+        }
+      } else if constexpr (is_op_v<E, Add> && Leaf<L, T> &&
+                           is_scaled_v<R, T>) {
+        if (k.axpy && is_contiguous(src.lhs) && contiguous_scaled(src.rhs)) {
+          k.axpy(scale_of(src.rhs), data_of(src.rhs), src.lhs.data(), out,
+                 begin, end);
+          return true;
+        }
+      }
+    } else if constexpr (is_fma_v<E>) {
+      using A = std::remove_cvref_t<decltype(src.a)>;
+      using B = std::remove_cvref_t<decltype(src.b)>;
+      using C = std::remove_cvref_t<decltype(src.c)>;
+      if constexpr (is_scalar_expr_v<A> && Leaf<B, T> && Leaf<C, T>) {
+        if (k.fma && is_contiguous(src.b) && is_contiguous(src.c)) {
+          k.fma(src.a.value, src.b.data(), src.c.data(), out, begin, end);
+          return true;
+        }
+      } else if constexpr (Leaf<A, T> && is_scalar_expr_v<B> && Leaf<C, T>) {
+        if (k.fma && is_contiguous(src.a) && is_contiguous(src.c)) {
+          k.fma(src.b.value, src.a.data(), src.c.data(), out, begin, end);
+          return true;
+        }
+      }
+    }
+  }
+  return false;
+}
+
+}  // namespace dispatch
+#endif
+
+//
+// evaluation
+//
+
+// Writes src[begin, end) to out[0, end - begin). Packetizable expressions run
+// a scalar head up to the first packet boundary, full packets, then a scalar
+// tail; so packet loads always land on i % packet_size == 0.
+//
+// With SWNUMERIC_DISPATCH the common shapes over contiguous operands (see
+// Dispatch.h) go to the kernels chosen for the CPU at run time instead.
+//
+// A CastExpr whose operand has packets of its own is evaluated in those and
+// converted on store, so a narrowing or widening assignment of a compound
+// expression stays vectorized.
+template <typename ExprType, typename T>
+inline constexpr bool converts_on_store_v = [] {
+  if constexpr (is_cast_expr_v<ExprType>) {
+    using S = typename ExprType::source_type;
+    using E = std::remove_cvref_t<decltype(std::declval<ExprType>().e)>;
+    return std::is_same_v<typename ExprType::value_type, T> &&
+           PacketExpr<E> && packet_size<S> > 1;
+  } else {
+    return false;
+  }
+}();
+
+template <typename T, typename ExprType>
+constexpr void evaluate_into(T* out, const ExprType& src, size_t begin,
+                             size_t end) {
+  size_t i = begin;
+#if SWNUMERIC_DISPATCH
+  if (!std::is_constant_evaluated() &&
+      dispatch::evaluate(out, src, begin, end)) {
+    return;
+  }
+#endif
+  if constexpr (converts_on_store_v<ExprType, T>) {
+    if (!std::is_constant_evaluated()) {
+      using S = typename ExprType::source_type;
+      constexpr size_t W = packet_size<S>;
+      const size_t head = std::min(end, (begin + W - 1) / W * W);
+      const size_t body = head + (end - head) / W * W;
+      for (; i < head; i++) out[i - begin] = src[i];
+      for (; i < body; i += W) {
+        PacketConvert<T, S>::store(out + (i - begin), src.e.packet(i));
+      }
+    }
+  } else if constexpr (PacketExpr<ExprType> && packet_size<T> > 1 &&
+                       std::is_same_v<typename ExprType::value_type, T>) {
+    if (!std::is_constant_evaluated()) {
+      constexpr size_t W = packet_size<T>;
+      const size_t head = std::min(end, (begin + W - 1) / W * W);
+      const size_t body = head + (end - head) / W * W;
+      for (; i < head; i++) out[i - begin] = src[i];
+      for (; i < body; i += W) pstoreu(out + (i - begin), src.packet(i));
+    }
+  }
+  for (; i < end; i++) out[i - begin] = src[i];
+}
+
+// Writes src[begin, end) to dst[begin, end).
+template <typename T, typename ExprType>
+constexpr void evaluate(T* dst, const ExprType& src, size_t begin,
+                        size_t end) {
+  evaluate_into(dst + begin, src, begin, end);
+}
+
+// Statically sized evaluation of up to this many elements is fully unrolled.
+inline constexpr size_t fixed_unroll_limit = 64;
+
+// evaluate(dst, src, 0, N) with the packet loop and tail unrolled.
+template <size_t N, typename T, typename ExprType>
+__always_inline constexpr void evaluate_fixed(T* dst, const ExprType& src) {
+  constexpr bool packets = PacketExpr<ExprType> && packet_size<T> > 1 &&
+                           std::is_same_v<typename ExprType::value_type, T>;
+  constexpr size_t W = packet_size<T>;
+  constexpr size_t body = packets ? N / W * W : 0;
+  if (std::is_constant_evaluated()) {
+    for (size_t i = 0; i < N; i++) dst[i] = src[i];
+    return;
+  }
+  if constexpr (body > 0) {
+    [&]<size_t... P>(std::index_sequence<P...>) {
+      (pstoreu(dst + P * W, src.packet(P * W)), ...);
+    }(std::make_index_sequence<body / W>{});
+  }
+  [&]<size_t... I>(std::index_sequence<I...>) {
+    ((dst[body + I] = src[body + I]), ...);
+  }(std::make_index_sequence<N - body>{});
+}
+
+// Expressions that are evaluated as a whole rather than elementwise (e.g.
+// products dispatched to BLAS) provide assign_to(dst).
+template <typename ExprType, typename Dst>
+concept AssignsTo = requires(const ExprType& e, Dst& dst) { e.assign_to(dst); };
+
+// Destinations that are not one contiguous run: padded matrix views are
+// written a row at a time, strided vector views an element at a time.
+template <typename Dst, typename ExprType>
+constexpr void assign_strided(Dst& dst, const ExprType& src) {
+  if constexpr (requires { dst.ld(); }) {
+    const size_t C = dst.cols();
+    for (size_t r = 0; r < dst.rows(); r++) {
+      evaluate_into(dst.data() + r * dst.ld(), src, r * C, r * C + C);
+    }
+  } else {
+    for (size_t i = 0; i < dst.size(); i++) dst[i] = src[i];
+  }
+}
+
+// dst = src for a destination with data() and size(). When either side has a
+// static size, sizes are checked at compile time and small ones are unrolled.
+template <typename Dst, typename ExprType>
+constexpr void assign(Dst& dst, const ExprType& src) {
+  static_assert(ctime_sizes_agree_v<Dst, ExprType>,
+                "Assignment between different static sizes.");
+  assert(dst.size() == src.size());
+  constexpr size_t N = common_ctime_size_v<Dst, ExprType>;
+  if constexpr (AssignsTo<ExprType, Dst>) {
+    src.assign_to(dst);
+  } else {
+    if (!std::is_constant_evaluated()) {
+      instrument::count_assign<typename Dst::value_type>(
+          dst.size(), streamed_operands_v<ExprType>);
+    }
+    if (!is_contiguous(dst)) {
+      assign_strided(dst, src);
+    } else if constexpr (N > 0 && N <= fixed_unroll_limit) {
+      assert(dst.size() == N);
+      evaluate_fixed<N>(dst.data(), src);
+    } else {
+      evaluate(dst.data(), src, 0, dst.size());
+    }
+  }
+}
+
+SWNUMERIC_END
@@ -0,0 +1,466 @@
+#pragma once
+
+#include <cmath>
+#include <cstddef>
+#include <type_traits>
+
+#if defined(__AVX512F__) || defined(__AVX__) || defined(__SSE2__)
+#include <immintrin.h>
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
+#include "library/dispatch/Namespace.h"
+
+SWNUMERIC_BEGIN
+
+//
+// Packet traits: the widest native SIMD register for each scalar type. A
+// scalar is its own single-lane packet, so packet code stays valid on targets
+// without SIMD support.
+//
+
+template <typename T>
+struct PacketTraits {
+  using type = T;
+  static constexpr size_t size = 1;
+};
+
+template <typename T>
+using packet_t = typename PacketTraits<T>::type;
+
+template <typename T>
+inline constexpr size_t packet_size = PacketTraits<T>::size;
+
+// scalar fallbacks
+
+template <typename T>
+inline T pload(const T* p) noexcept {
+  return *p;
+}
+
+template <typename T>
+inline T ploadu(const T* p) noexcept {
+  return *p;
+}
+
+template <typename T>
+inline void pstore(T* p, T a) noexcept {
+  *p = a;
+}
+
+template <typename T>
+inline void pstoreu(T* p, T a) noexcept {
+  *p = a;
+}
+
+template <typename T>
+inline T pset1(T a) noexcept {
+  return a;
+}
+
+template <typename T>
+inline T padd(T a, T b) noexcept {
+  return a + b;
+}
+
+template <typename T>
+inline T psub(T a, T b) noexcept {
+  return a - b;
+}
+
+template <typename T>
+inline T pmul(T a, T b) noexcept {
+  return a * b;
+}
+
+template <typename T>
+inline T pdiv(T a, T b) noexcept {
+  return a / b;
+}
+
+template <typename T>
+inline T pabs(T a) noexcept {
+  return a < T{0} ? -a : a;
+}
+
+template <typename T>
+inline T pmin(T a, T b) noexcept {
+  return b < a ? b : a;
+}
+
+template <typename T>
+inline T pmax(T a, T b) noexcept {
+  return a < b ? b : a;
+}
+
+template <typename T>
+inline T pneg(T a) noexcept {
+  return -a;
+}
+
+template <typename T>
+inline T psqrt(T a) noexcept {
+  return std::sqrt(a);
+}
+
+// true where the packet pmadd() below rounds once, like std::fma
+inline constexpr bool fused_madd =
+#if defined(__FMA__) || defined(__AVX512F__) || \
+    (defined(__ARM_NEON) && defined(__aarch64__))
+    true;
+#else
+    false;
+#endif
+
+// a * b + c, rounded once where the packet versions are, so scalar heads and
+// tails match the packet body
+template <typename T>
+inline T pmadd(T a, T b, T c) noexcept {
+  if constexpr (fused_madd && std::is_floating_point_v<T>) {
+    return std::fma(a, b, c);
+  } else {
+    return a * b + c;
+  }
+}
+
+#if defined(__AVX512F__)
+
+template <>
+struct PacketTraits<double> {
+  using type = __m512d;
+  static constexpr size_t size = 8;
+};
+
+template <>
+struct PacketTraits<float> {
+  using type = __m512;
+  static constexpr size_t size = 16;
+};
+
+inline __m512d pload(const double* p) noexcept { return _mm512_load_pd(p); }
+inline __m512d ploadu(const double* p) noexcept { return _mm512_loadu_pd(p); }
+inline void pstore(double* p, __m512d a) noexcept { _mm512_store_pd(p, a); }
+inline void pstoreu(double* p, __m512d a) noexcept { _mm512_storeu_pd(p, a); }
+inline __m512d pset1(double a) noexcept { return _mm512_set1_pd(a); }
+inline __m512d padd(__m512d a, __m512d b) noexcept {
+  return _mm512_add_pd(a, b);
+}
+inline __m512d psub(__m512d a, __m512d b) noexcept {
+  return _mm512_sub_pd(a, b);
+}
+inline __m512d pmul(__m512d a, __m512d b) noexcept {
+  return _mm512_mul_pd(a, b);
+}
+inline __m512d pdiv(__m512d a, __m512d b) noexcept {
+  return _mm512_div_pd(a, b);
+}
+inline __m512d pabs(__m512d a) noexcept { return _mm512_abs_pd(a); }
+// pmin, pmax and psqrt use the zero-masked forms, which are the same
+// instruction; the unmasked intrinsics trip -Wmaybe-uninitialized in some GCC
+// releases.
+inline __m512d pmin(__m512d a, __m512d b) noexcept {
+  return _mm512_maskz_min_pd(__mmask8(-1), a, b);
+}
+inline __m512d pmax(__m512d a, __m512d b) noexcept {
+  return _mm512_maskz_max_pd(__mmask8(-1), a, b);
+}
+inline __m512d pneg(__m512d a) noexcept {
+  return _mm512_sub_pd(_mm512_set1_pd(-0.0), a);
+}
+inline __m512d psqrt(__m512d a) noexcept {
+  return _mm512_maskz_sqrt_pd(__mmask8(-1), a);
+}
+inline __m512d pmadd(__m512d a, __m512d b, __m512d c) noexcept {
+  return _mm512_fmadd_pd(a, b, c);
+}
+
+inline __m512 pload(const float* p) noexcept { return _mm512_load_ps(p); }
+inline __m512 ploadu(const float* p) noexcept { return _mm512_loadu_ps(p); }
+inline void pstore(float* p, __m512 a) noexcept { _mm512_store_ps(p, a); }
+inline void pstoreu(float* p, __m512 a) noexcept { _mm512_storeu_ps(p, a); }
+inline __m512 pset1(float a) noexcept { return _mm512_set1_ps(a); }
+inline __m512 padd(__m512 a, __m512 b) noexcept { return _mm512_add_ps(a, b); }
+inline __m512 psub(__m512 a, __m512 b) noexcept { return _mm512_sub_ps(a, b); }
+inline __m512 pmul(__m512 a, __m512 b) noexcept { return _mm512_mul_ps(a, b); }
+inline __m512 pdiv(__m512 a, __m512 b) noexcept { return _mm512_div_ps(a, b); }
+inline __m512 pabs(__m512 a) noexcept { return _mm512_abs_ps(a); }
+inline __m512 pmin(__m512 a, __m512 b) noexcept {
+  return _mm512_maskz_min_ps(__mmask16(-1), a, b);
+}
+inline __m512 pmax(__m512 a, __m512 b) noexcept {
+  return _mm512_maskz_max_ps(__mmask16(-1), a, b);
+}
+inline __m512 pneg(__m512 a) noexcept {
+  return _mm512_sub_ps(_mm512_set1_ps(-0.0f), a);
+}
+inline __m512 psqrt(__m512 a) noexcept {
+  return _mm512_maskz_sqrt_ps(__mmask16(-1), a);
+}
+inline __m512 pmadd(__m512 a, __m512 b, __m512 c) noexcept {
+  return _mm512_fmadd_ps(a, b, c);
+}
+
+#elif defined(__AVX__)
+
+template <>
+struct PacketTraits<double> {
+  using type = __m256d;
+  static constexpr size_t size = 4;
+};
+
+template <>
+struct PacketTraits<float> {
+  using type = __m256;
+  static constexpr size_t size = 8;
+};
+
+inline __m256d pload(const double* p) noexcept { return _mm256_load_pd(p); }
+inline __m256d ploadu(const double* p) noexcept { return _mm256_loadu_pd(p); }
+inline void pstore(double* p, __m256d a) noexcept { _mm256_store_pd(p, a); }
+inline void pstoreu(double* p, __m256d a) noexcept { _mm256_storeu_pd(p, a); }
+inline __m256d pset1(double a) noexcept { return _mm256_set1_pd(a); }
+inline __m256d padd(__m256d a, __m256d b) noexcept {
+  return _mm256_add_pd(a, b);
+}
+inline __m256d psub(__m256d a, __m256d b) noexcept {
+  return _mm256_sub_pd(a, b);
+}
+inline __m256d pmul(__m256d a, __m256d b) noexcept {
+  return _mm256_mul_pd(a, b);
+}
+inline __m256d pdiv(__m256d a, __m256d b) noexcept {
+  return _mm256_div_pd(a, b);
+}
+inline __m256d pabs(__m256d a) noexcept {
+  return _mm256_andnot_pd(_mm256_set1_pd(-0.0), a);
+}
+inline __m256d pmin(__m256d a, __m256d b) noexcept {
+  return _mm256_min_pd(a, b);
+}
+inline __m256d pmax(__m256d a, __m256d b) noexcept {
+  return _mm256_max_pd(a, b);
+}
+inline __m256d pneg(__m256d a) noexcept {
+  return _mm256_xor_pd(a, _mm256_set1_pd(-0.0));
+}
+inline __m256d psqrt(__m256d a) noexcept { return _mm256_sqrt_pd(a); }
+inline __m256d pmadd(__m256d a, __m256d b, __m256d c) noexcept {
+#ifdef __FMA__
+  return _mm256_fmadd_pd(a, b, c);
+#else
+  return _mm256_add_pd(_mm256_mul_pd(a, b), c);
+#endif
+}
+
+inline __m256 pload(const float* p) noexcept { return _mm256_load_ps(p); }
+inline __m256 ploadu(const float* p) noexcept { return _mm256_loadu_ps(p); }
+inline void pstore(float* p, __m256 a) noexcept { _mm256_store_ps(p, a); }
+inline void pstoreu(float* p, __m256 a) noexcept { _mm256_storeu_ps(p, a); }
+inline __m256 pset1(float a) noexcept { return _mm256_set1_ps(a); }
+inline __m256 padd(__m256 a, __m256 b) noexcept { return _mm256_add_ps(a, b); }
+inline __m256 psub(__m256 a, __m256 b) noexcept { return _mm256_sub_ps(a, b); }
+inline __m256 pmul(__m256 a, __m256 b) noexcept { return _mm256_mul_ps(a, b); }
+inline __m256 pdiv(__m256 a, __m256 b) noexcept { return _mm256_div_ps(a, b); }
+inline __m256 pabs(__m256 a) noexcept {
+  return _mm256_andnot_ps(_mm256_set1_ps(-0.0f), a);
+}
+inline __m256 pmin(__m256 a, __m256 b) noexcept { return _mm256_min_ps(a, b); }
+inline __m256 pmax(__m256 a, __m256 b) noexcept { return _mm256_max_ps(a, b); }
+inline __m256 pneg(__m256 a) noexcept {
+  return _mm256_xor_ps(a, _mm256_set1_ps(-0.0f));
+}
+inline __m256 psqrt(__m256 a) noexcept { return _mm256_sqrt_ps(a); }
+inline __m256 pmadd(__m256 a, __m256 b, __m256 c) noexcept {
+#ifdef __FMA__
+  return _mm256_fmadd_ps(a, b, c);
+#else
+  return _mm256_add_ps(_mm256_mul_ps(a, b), c);
+#endif
+}
+
+#elif defined(__SSE2__)
+
+template <>
+struct PacketTraits<double> {
+  using type = __m128d;
+  static constexpr size_t size = 2;
+};
+
+template <>
+struct PacketTraits<float> {
+  using type = __m128;
+  static constexpr size_t size = 4;
+};
+
+inline __m128d pload(const double* p) noexcept { return _mm_load_pd(p); }
+inline __m128d ploadu(const double* p) noexcept { return _mm_loadu_pd(p); }
+inline void pstore(double* p, __m128d a) noexcept { _mm_store_pd(p, a); }
+inline void pstoreu(double* p, __m128d a) noexcept { _mm_storeu_pd(p, a); }
+inline __m128d pset1(double a) noexcept { return _mm_set1_pd(a); }
+inline __m128d padd(__m128d a, __m128d b) noexcept { return _mm_add_pd(a, b); }
+inline __m128d psub(__m128d a, __m128d b) noexcept { return _mm_sub_pd(a, b); }
+inline __m128d pmul(__m128d a, __m128d b) noexcept { return _mm_mul_pd(a, b); }
+inline __m128d pdiv(__m128d a, __m128d b) noexcept { return _mm_div_pd(a, b); }
+inline __m128d pabs(__m128d a) noexcept {
+  return _mm_andnot_pd(_mm_set1_pd(-0.0), a);
+}
+inline __m128d pmin(__m128d a, __m128d b) noexcept { return _mm_min_pd(a, b); }
+inline __m128d pmax(__m128d a, __m128d b) noexcept { return _mm_max_pd(a, b); }
+inline __m128d pneg(__m128d a) noexcept {
+  return _mm_xor_pd(a, _mm_set1_pd(-0.0));
+}
+inline __m128d psqrt(__m128d a) noexcept { return _mm_sqrt_pd(a); }
+inline __m128d pmadd(__m128d a, __m128d b, __m128d c) noexcept {
+#ifdef __FMA__
+  return _mm_fmadd_pd(a, b, c);
+#else
+  return _mm_add_pd(_mm_mul_pd(a, b), c);
+#endif
+}
+
+inline __m128 pload(const float* p) noexcept { return _mm_load_ps(p); }
+inline __m128 ploadu(const float* p) noexcept { return _mm_loadu_ps(p); }
+inline void pstore(float* p, __m128 a) noexcept { _mm_store_ps(p, a); }
+inline void pstoreu(float* p, __m128 a) noexcept { _mm_storeu_ps(p, a); }
+inline __m128 pset1(float a) noexcept { return _mm_set1_ps(a); }
+inline __m128 padd(__m128 a, __m128 b) noexcept { return _mm_add_ps(a, b); }
+inline __m128 psub(__m128 a, __m128 b) noexcept { return _mm_sub_ps(a, b); }
+inline __m128 pmul(__m128 a, __m128 b) noexcept { return _mm_mul_ps(a, b); }
+inline __m128 pdiv(__m128 a, __m128 b) noexcept { return _mm_div_ps(a, b); }
+inline __m128 pabs(__m128 a) noexcept {
+  return _mm_andnot_ps(_mm_set1_ps(-0.0f), a);
+}
+inline __m128 pmin(__m128 a, __m128 b) noexcept { return _mm_min_ps(a, b); }
+inline __m128 pmax(__m128 a, __m128 b) noexcept { return _mm_max_ps(a, b); }
+inline __m128 pneg(__m128 a) noexcept {
+  return _mm_xor_ps(a, _mm_set1_ps(-0.0f));
+}
+inline __m128 psqrt(__m128 a) noexcept { return _mm_sqrt_ps(a); }
+inline __m128 pmadd(__m128 a, __m128 b, __m128 c) noexcept {
+#ifdef __FMA__
+  return _mm_fmadd_ps(a, b, c);
+#else
+  return _mm_add_ps(_mm_mul_ps(a, b), c);
+#endif
+}
+
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+
+template <>
+struct PacketTraits<double> {
+  using type = float64x2_t;
+  static constexpr size_t size = 2;
+};
+
+template <>
+struct PacketTraits<float> {
+  using type = float32x4_t;
+  static constexpr size_t size = 4;
+};
+
+inline float64x2_t pload(const double* p) noexcept { return vld1q_f64(p); }
+inline float64x2_t ploadu(const double* p) noexcept { return vld1q_f64(p); }
+inline void pstore(double* p, float64x2_t a) noexcept { vst1q_f64(p, a); }
+inline void pstoreu(double* p, float64x2_t a) noexcept { vst1q_f64(p, a); }
+inline float64x2_t pset1(double a) noexcept { return vdupq_n_f64(a); }
+inline float64x2_t padd(float64x2_t a, float64x2_t b) noexcept {
+  return vaddq_f64(a, b);
+}
+inline float64x2_t psub(float64x2_t a, float64x2_t b) noexcept {
+  return vsubq_f64(a, b);
+}
+inline float64x2_t pmul(float64x2_t a, float64x2_t b) noexcept {
+  return vmulq_f64(a, b);
+}
+inline float64x2_t pdiv(float64x2_t a, float64x2_t b) noexcept {
+  return vdivq_f64(a, b);
+}
+inline float64x2_t pabs(float64x2_t a) noexcept { return vabsq_f64(a); }
+inline float64x2_t pmin(float64x2_t a, float64x2_t b) noexcept {
+  return vminq_f64(a, b);
+}
+inline float64x2_t pmax(float64x2_t a, float64x2_t b) noexcept {
+  return vmaxq_f64(a, b);
+}
+inline float64x2_t pneg(float64x2_t a) noexcept { return vnegq_f64(a); }
+inline float64x2_t psqrt(float64x2_t a) noexcept { return vsqrtq_f64(a); }
+inline float64x2_t pmadd(float64x2_t a, float64x2_t b,
+                         float64x2_t c) noexcept {
+  return vfmaq_f64(c, a, b);
+}
+
+inline float32x4_t pload(const float* p) noexcept { return vld1q_f32(p); }
+inline float32x4_t ploadu(const float* p) noexcept { return vld1q_f32(p); }
+inline void pstore(float* p, float32x4_t a) noexcept { vst1q_f32(p, a); }
+inline void pstoreu(float* p, float32x4_t a) noexcept { vst1q_f32(p, a); }
+inline float32x4_t pset1(float a) noexcept { return vdupq_n_f32(a); }
+inline float32x4_t padd(float32x4_t a, float32x4_t b) noexcept {
+  return vaddq_f32(a, b);
+}
+inline float32x4_t psub(float32x4_t a, float32x4_t b) noexcept {
+  return vsubq_f32(a, b);
+}
+inline float32x4_t pmul(float32x4_t a, float32x4_t b) noexcept {
+  return vmulq_f32(a, b);
+}
+inline float32x4_t pdiv(float32x4_t a, float32x4_t b) noexcept {
+  return vdivq_f32(a, b);
+}
+inline float32x4_t pabs(float32x4_t a) noexcept { return vabsq_f32(a); }
+inline float32x4_t pmin(float32x4_t a, float32x4_t b) noexcept {
+  return vminq_f32(a, b);
+}
+inline float32x4_t pmax(float32x4_t a, float32x4_t b) noexcept {
+  return vmaxq_f32(a, b);
+}
+inline float32x4_t pneg(float32x4_t a) noexcept { return vnegq_f32(a); }
+inline float32x4_t psqrt(float32x4_t a) noexcept { return vsqrtq_f32(a); }
+inline float32x4_t pmadd(float32x4_t a, float32x4_t b,
+                         float32x4_t c) noexcept {
+  return vfmaq_f32(c, a, b);
+}
+
+#endif
+
+//
+// horizontal reductions of a packet of T to a single T. These run once per
+// reduction, so they spill to memory rather than specializing per ISA.
+//
+
+template <typename T>
+inline T predux_add(packet_t<T> p) noexcept {
+  alignas(64) T lanes[packet_size<T>];
+  pstoreu(lanes, p);
+  T acc = lanes[0];
+  for (size_t i = 1; i < packet_size<T>; i++) acc += lanes[i];
+  return acc;
+}
+
+template <typename T>
+inline T predux_min(packet_t<T> p) noexcept {
+  alignas(64) T lanes[packet_size<T>];
+  pstoreu(lanes, p);
+  T acc = lanes[0];
+  for (size_t i = 1; i < packet_size<T>; i++) acc = pmin(acc, lanes[i]);
+  return acc;
+}
+
+template <typename T>
+inline T predux_max(packet_t<T> p) noexcept {
+  alignas(64) T lanes[packet_size<T>];
+  pstoreu(lanes, p);
+  T acc = lanes[0];
+  for (size_t i = 1; i < packet_size<T>; i++) acc = pmax(acc, lanes[i]);
+  return acc;
+}
+
+// Packet whose lane k is f(k), for operands without contiguous storage.
+template <typename T, typename F>
+inline packet_t<T> pgenerate(F&& f) noexcept {
+  alignas(64) T lanes[packet_size<T>];
+  for (size_t k = 0; k < packet_size<T>; k++) lanes[k] = f(k);
+  return ploadu(lanes);
+}
+
+SWNUMERIC_END
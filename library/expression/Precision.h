@@ -0,0 +1,298 @@
+#pragma once
+
+#include <bit>
+#include <concepts>
+#include <cstddef>
+#include <cstdint>
+#include <type_traits>
+
+#include "library/dispatch/Namespace.h"
+#include "library/expression/Packet.h"
+
+SWNUMERIC_BEGIN
+
+//
+// Scalar types for mixed-precision storage.
+//
+// bfloat16 and float16 (_Float16, where the compiler has it) are storage
+// types: containers may hold them to halve the bytes streamed, but arithmetic
+// on them runs in compute_t<T> = float. Expressions promote their operands to
+// promote_t of the operand types, so
+//
+//   Vector<bfloat16> h(n);  Vector<float> x(n);  Vector<double> y(n);
+//   x = x + 2.0f * h;       // bfloat16 widened to float as it is loaded
+//   y = y + x;              // float widened to double
+//   x = cast<float>(y);     // narrowing is explicit
+//
+// PacketConvert<To, From> holds the SIMD conversion kernels behind this:
+// load() reads packet_size<To> values of From into a packet of To, store()
+// writes the packet_size<From> lanes of a packet of From as To. Pairs without
+// a native kernel convert a lane at a time.
+//
+
+// Brain floating point: the top 16 bits of a float. Conversion from float
+// rounds to nearest even and keeps NaNs quiet.
+struct bfloat16 {
+  uint16_t bits;
+
+  bfloat16() = default;
+  constexpr explicit bfloat16(float f) noexcept : bits(round(f)) {}
+
+  constexpr operator float() const noexcept {
+    return std::bit_cast<float>(uint32_t{bits} << 16);
+  }
+
+  static constexpr bfloat16 from_bits(uint16_t b) noexcept {
+    bfloat16 h;
+    h.bits = b;
+    return h;
+  }
+
+ private:
+  static constexpr uint16_t round(float f) noexcept {
+    const uint32_t u = std::bit_cast<uint32_t>(f);
+    if ((u & 0x7fffffffu) > 0x7f800000u) return uint16_t((u >> 16) | 0x40u);
+    return uint16_t((u + 0x7fffu + ((u >> 16) & 1u)) >> 16);
+  }
+};
+
+static_assert(sizeof(bfloat16) == 2 && std::is_trivial_v<bfloat16>);
+
+#if defined(__FLT16_MAX__)
+#define SWNUMERIC_FLOAT16 1
+using float16 = _Float16;
+#else
+#define SWNUMERIC_FLOAT16 0
+#endif
+
+template <typename T>
+inline constexpr bool is_storage_scalar_v = std::is_same_v<T, bfloat16>;
+#if SWNUMERIC_FLOAT16
+template <>
+inline constexpr bool is_storage_scalar_v<float16> = true;
+#endif
+
+// Element types of the containers: a floating point type or a storage type.
+template <typename T>
+concept Scalar = std::floating_point<T> || is_storage_scalar_v<T>;
+
+// The type arithmetic on T runs in.
+template <typename T>
+struct compute_type {
+  using type = T;
+};
+template <typename T>
+  requires is_storage_scalar_v<T>
+struct compute_type<T> {
+  using type = float;
+};
+
+template <typename T>
+using compute_t = typename compute_type<T>::type;
+
+// The value type of an expression combining operands of types T...
+template <typename... T>
+using promote_t = std::common_type_t<compute_t<T>...>;
+
+//
+// conversion kernels
+//
+
+// a lane at a time
+template <typename To, typename From>
+struct ScalarConvert {
+  static packet_t<To> load(const From* p) noexcept {
+    return pgenerate<To>([&](size_t k) { return To(p[k]); });
+  }
+  static void store(To* p, packet_t<From> a) noexcept {
+    alignas(64) From lanes[packet_size<From>];
+    pstoreu(lanes, a);
+    for (size_t k = 0; k < packet_size<From>; k++) p[k] = To(lanes[k]);
+  }
+};
+
+template <typename To, typename From>
+struct PacketConvert : ScalarConvert<To, From> {};
+
+template <typename T>
+struct PacketConvert<T, T> {
+  static packet_t<T> load(const T* p) noexcept { return ploadu(p); }
+  static void store(T* p, packet_t<T> a) noexcept { pstoreu(p, a); }
+};
+
+#if defined(__AVX512F__)
+
+template <>
+struct PacketConvert<double, float> {
+  static __m512d load(const float* p) noexcept {
+    return _mm512_cvtps_pd(_mm256_loadu_ps(p));
+  }
+  static void store(double* p, __m512 a) noexcept {
+    const __m256 hi =
+        _mm256_castpd_ps(_mm512_extractf64x4_pd(_mm512_castps_pd(a), 1));
+    _mm512_storeu_pd(p, _mm512_cvtps_pd(_mm512_castps512_ps256(a)));
+    _mm512_storeu_pd(p + 8, _mm512_cvtps_pd(hi));
+  }
+};
+
+template <>
+struct PacketConvert<float, double> {
+  static __m512 load(const double* p) noexcept {
+    const __m256 lo = _mm512_cvtpd_ps(_mm512_loadu_pd(p));
+    const __m256 hi = _mm512_cvtpd_ps(_mm512_loadu_pd(p + 8));
+    return _mm512_castpd_ps(
+        _mm512_insertf64x4(_mm512_castpd256_pd512(_mm256_castps_pd(lo)),
+                           _mm256_castps_pd(hi), 1));
+  }
+  static void store(float* p, __m512d a) noexcept {
+    _mm256_storeu_ps(p, _mm512_cvtpd_ps(a));
+  }
+};
+
+template <>
+struct PacketConvert<float, bfloat16> : ScalarConvert<float, bfloat16> {
+  static __m512 load(const bfloat16* p) noexcept {
+    const __m256i h = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+    return _mm512_castsi512_ps(
+        _mm512_slli_epi32(_mm512_cvtepu16_epi32(h), 16));
+  }
+};
+
+template <>
+struct PacketConvert<bfloat16, float> : ScalarConvert<bfloat16, float> {
+  static void store(bfloat16* p, __m512 a) noexcept {
+    const __m512i u = _mm512_castps_si512(a);
+    const __m512i odd = _mm512_and_si512(_mm512_srli_epi32(u, 16),
+                                         _mm512_set1_epi32(1));
+    const __m512i bias = _mm512_add_epi32(_mm512_set1_epi32(0x7fff), odd);
+    __m512i r = _mm512_srli_epi32(_mm512_add_epi32(u, bias), 16);
+    const __m512i qnan =
+        _mm512_or_si512(_mm512_srli_epi32(u, 16), _mm512_set1_epi32(0x40));
+    r = _mm512_mask_blend_epi32(_mm512_cmp_ps_mask(a, a, _CMP_UNORD_Q), r,
+                                qnan);
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(p),
+                        _mm512_cvtepi32_epi16(r));
+  }
+};
+
+#if SWNUMERIC_FLOAT16
+template <>
+struct PacketConvert<float, float16> : ScalarConvert<float, float16> {
+  static __m512 load(const float16* p) noexcept {
+    return _mm512_cvtph_ps(
+        _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p)));
+  }
+};
+
+template <>
+struct PacketConvert<float16, float> : ScalarConvert<float16, float> {
+  static void store(float16* p, __m512 a) noexcept {
+    _mm256_storeu_si256(
+        reinterpret_cast<__m256i*>(p),
+        _mm512_cvtps_ph(a, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC));
+  }
+};
+#endif
+
+#elif defined(__AVX__)
+
+template <>
+struct PacketConvert<double, float> {
+  static __m256d load(const float* p) noexcept {
+    return _mm256_cvtps_pd(_mm_loadu_ps(p));
+  }
+  static void store(double* p, __m256 a) noexcept {
+    _mm256_storeu_pd(p, _mm256_cvtps_pd(_mm256_castps256_ps128(a)));
+    _mm256_storeu_pd(p + 4, _mm256_cvtps_pd(_mm256_extractf128_ps(a, 1)));
+  }
+};
+
+template <>
+struct PacketConvert<float, double> {
+  static __m256 load(const double* p) noexcept {
+    return _mm256_set_m128(_mm256_cvtpd_ps(_mm256_loadu_pd(p + 4)),
+                           _mm256_cvtpd_ps(_mm256_loadu_pd(p)));
+  }
+  static void store(float* p, __m256d a) noexcept {
+    _mm_storeu_ps(p, _mm256_cvtpd_ps(a));
+  }
+};
+
+#if defined(__AVX2__)
+template <>
+struct PacketConvert<float, bfloat16> : ScalarConvert<float, bfloat16> {
+  static __m256 load(const bfloat16* p) noexcept {
+    const __m128i h = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+    return _mm256_castsi256_ps(
+        _mm256_slli_epi32(_mm256_cvtepu16_epi32(h), 16));
+  }
+};
+
+template <>
+struct PacketConvert<bfloat16, float> : ScalarConvert<bfloat16, float> {
+  static void store(bfloat16* p, __m256 a) noexcept {
+    const __m256i u = _mm256_castps_si256(a);
+    const __m256i odd = _mm256_and_si256(_mm256_srli_epi32(u, 16),
+                                         _mm256_set1_epi32(1));
+    const __m256i bias = _mm256_add_epi32(_mm256_set1_epi32(0x7fff), odd);
+    __m256i r = _mm256_srli_epi32(_mm256_add_epi32(u, bias), 16);
+    const __m256i qnan =
+        _mm256_or_si256(_mm256_srli_epi32(u, 16), _mm256_set1_epi32(0x40));
+    r = _mm256_blendv_epi8(
+        r, qnan, _mm256_castps_si256(_mm256_cmp_ps(a, a, _CMP_UNORD_Q)));
+    // pack to 16 bits within each 128-bit lane, then join the lanes
+    const __m256i packed =
+        _mm256_permute4x64_epi64(_mm256_packus_epi32(r, r), 0x08);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(p),
+                     _mm256_castsi256_si128(packed));
+  }
+};
+#endif
+
+#if SWNUMERIC_FLOAT16 && defined(__F16C__)
+template <>
+struct PacketConvert<float, float16> : ScalarConvert<float, float16> {
+  static __m256 load(const float16* p) noexcept {
+    return _mm256_cvtph_ps(
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(p)));
+  }
+};
+
+template <>
+struct PacketConvert<float16, float> : ScalarConvert<float16, float> {
+  static void store(float16* p, __m256 a) noexcept {
+    _mm_storeu_si128(
+        reinterpret_cast<__m128i*>(p),
+        _mm256_cvtps_ph(a, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC));
+  }
+};
+#endif
+
+#elif defined(__SSE2__)
+
+template <>
+struct PacketConvert<double, float> {
+  static __m128d load(const float* p) noexcept {
+    return _mm_cvtps_pd(_mm_castsi128_ps(
+        _mm_loadl_epi64(reinterpret_cast<const __m128i*>(p))));
+  }
+  static void store(double* p, __m128 a) noexcept {
+    _mm_storeu_pd(p, _mm_cvtps_pd(a));
+    _mm_storeu_pd(p + 2, _mm_cvtps_pd(_mm_movehl_ps(a, a)));
+  }
+};
+
+template <>
+struct PacketConvert<float, double> {
+  static __m128 load(const double* p) noexcept {
+    return _mm_movelh_ps(_mm_cvtpd_ps(_mm_loadu_pd(p)),
+                         _mm_cvtpd_ps(_mm_loadu_pd(p + 2)));
+  }
+  static void store(float* p, __m128d a) noexcept {
+    _mm_storel_pi(reinterpret_cast<__m64*>(p), _mm_cvtpd_ps(a));
+  }
+};
+
+#endif
+
+SWNUMERIC_END
@@ -0,0 +1,504 @@
+#pragma once
+
+#include <array>
+#include <cassert>
+#include <cmath>
+#include <cstddef>
+#include <limits>
+#include <optional>
+#include <type_traits>
+
+#include "library/dispatch/Namespace.h"
+#include "library/expression/Expression.h"
+#include "library/memory/Workspace.h"
+#include "library/parallel/Parallel.h"
+
+SWNUMERIC_BEGIN
+
+//
+// Reductions over expressions, evaluated in a single streaming pass with no
+// temporaries: norm2(a - b) reads a and b once.
+//
+// The packet path keeps four independent accumulators to hide add latency.
+// The par overloads reduce fixed-size blocks into per-block partials and then
+// combine them pairwise. The blocks depend only on the size, so the result is
+// the same for any thread count. kahan_sum adds compensated summation within
+// each block (it relies on strict IEEE semantics; do not build with
+// -ffast-math).
+//
+// fused_sum reduces several expressions in one pass, for iterative methods
+// that need a few dot products per step but want only one synchronization:
+//
+//   auto [rz, rr] = fused_sum(par, r * z, r * r);
+//
+// sum, dot, norm1 and norm2 take an optional accumulator type, sum<double>(x),
+// for float data summed in double. Expressions over the storage types
+// (bfloat16, float16) already compute in float; a bare container of one
+// needs the accumulator type, sum<float>(h).
+//
+// With SWNUMERIC_DISPATCH, sums, dots and norms of contiguous float and double
+// operands run the kernels chosen for the CPU at run time (Dispatch.h).
+//
+// norm2 is an unscaled sqrt(sum x^2); use the BLAS overloads on Vector and
+// VectorView when the data may overflow or underflow when squared.
+//
+
+namespace reduction {
+
+struct Sum {
+  template <typename T>
+  static constexpr T identity() noexcept {
+    return T{0};
+  }
+  template <typename T>
+  static T apply(T acc, T x) noexcept {
+    return acc + x;
+  }
+  template <typename P>
+  static P papply(P acc, P x) noexcept {
+    return padd(acc, x);
+  }
+  template <typename T>
+  static T merge(T a, T b) noexcept {
+    return a + b;
+  }
+  template <typename P>
+  static P pmerge(P a, P b) noexcept {
+    return padd(a, b);
+  }
+  template <typename T>
+  static T hreduce(packet_t<T> p) noexcept {
+    return predux_add<T>(p);
+  }
+};
+
+struct SumAbs : Sum {
+  template <typename T>
+  static T apply(T acc, T x) noexcept {
+    return acc + pabs(x);
+  }
+  template <typename P>
+  static P papply(P acc, P x) noexcept {
+    return padd(acc, pabs(x));
+  }
+};
+
+struct SumSquares : Sum {
+  template <typename T>
+  static T apply(T acc, T x) noexcept {
+    return acc + x * x;
+  }
+  template <typename P>
+  static P papply(P acc, P x) noexcept {
+    return pmadd(x, x, acc);
+  }
+};
+
+struct Min {
+  template <typename T>
+  static constexpr T identity() noexcept {
+    return std::numeric_limits<T>::infinity();
+  }
+  template <typename T>
+  static T apply(T acc, T x) noexcept {
+    return pmin(acc, x);
+  }
+  template <typename P>
+  static P papply(P acc, P x) noexcept {
+    return pmin(acc, x);
+  }
+  template <typename T>
+  static T merge(T a, T b) noexcept {
+    return pmin(a, b);
+  }
+  template <typename P>
+  static P pmerge(P a, P b) noexcept {
+    return pmin(a, b);
+  }
+  template <typename T>
+  static T hreduce(packet_t<T> p) noexcept {
+    return predux_min<T>(p);
+  }
+};
+
+struct Max {
+  template <typename T>
+  static constexpr T identity() noexcept {
+    return -std::numeric_limits<T>::infinity();
+  }
+  template <typename T>
+  static T apply(T acc, T x) noexcept {
+    return pmax(acc, x);
+  }
+  template <typename P>
+  static P papply(P acc, P x) noexcept {
+    return pmax(acc, x);
+  }
+  template <typename T>
+  static T merge(T a, T b) noexcept {
+    return pmax(a, b);
+  }
+  template <typename P>
+  static P pmerge(P a, P b) noexcept {
+    return pmax(a, b);
+  }
+  template <typename T>
+  static T hreduce(packet_t<T> p) noexcept {
+    return predux_max<T>(p);
+  }
+};
+
+struct MaxAbs : Max {
+  template <typename T>
+  static constexpr T identity() noexcept {
+    return T{0};
+  }
+  template <typename T>
+  static T apply(T acc, T x) noexcept {
+    return pmax(acc, pabs(x));
+  }
+  template <typename P>
+  static P papply(P acc, P x) noexcept {
+    return pmax(acc, pabs(x));
+  }
+};
+
+// Elements per block in the deterministic parallel reductions.
+inline constexpr size_t block = size_t{1} << 12;
+
+#if SWNUMERIC_DISPATCH
+// reduce_range by a dispatched kernel, if there is one for Op and the shape
+// of e and its operands are contiguous
+template <typename Op, ExprLike E, typename T = typename E::value_type>
+std::optional<T> dispatched(const E& e, size_t begin, size_t end) {
+  if constexpr (std::is_same_v<T, float> || std::is_same_v<T, double>) {
+    const dispatch::Kernels<T>& k = dispatch::kernels<T>();
+    if constexpr (dispatch::Leaf<E, T>) {
+      T (*f)(const T*, size_t, size_t) = nullptr;
+      if constexpr (std::is_same_v<Op, Sum>) {
+        f = k.sum;
+      } else if constexpr (std::is_same_v<Op, SumAbs>) {
+        f = k.sum_abs;
+      } else if constexpr (std::is_same_v<Op, SumSquares>) {
+        f = k.sum_squares;
+      } else if constexpr (std::is_same_v<Op, MaxAbs>) {
+        f = k.max_abs;
+      }
+      if (f && is_contiguous(e)) return f(e.data(), begin, end);
+    } else if constexpr (std::is_same_v<Op, Sum> &&
+                         dispatch::is_op_v<E, Mul>) {
+      using L = std::remove_cvref_t<decltype(e.lhs)>;
+      using R = std::remove_cvref_t<decltype(e.rhs)>;
+      if constexpr (dispatch::Leaf<L, T> && dispatch::Leaf<R, T>) {
+        if (k.dot && is_contiguous(e.lhs) && is_contiguous(e.rhs)) {
+          return k.dot(e.lhs.data(), e.rhs.data(), begin, end);
+        }
+      }
+    }
+  }
+  return std::nullopt;
+}
+#endif
+
+// Reduces e[begin, end) with Op.
+template <typename Op, ExprLike E>
+typename E::value_type reduce_range(const E& e, size_t begin, size_t end) {
+  using T = typename E::value_type;
+#if SWNUMERIC_DISPATCH
+  if (const std::optional<T> r = dispatched<Op>(e, begin, end)) return *r;
+#endif
+  T acc = Op::template identity<T>();
+  size_t i = begin;
+  if constexpr (PacketExpr<E> && packet_size<T> > 1) {
+    constexpr size_t W = packet_size<T>;
+    const size_t head = std::min(end, (begin + W - 1) / W * W);
+    for (; i < head; i++) acc = Op::apply(acc, T(e[i]));
+
+    using P = packet_t<T>;
+    P a0 = pset1(Op::template identity<T>()), a1 = a0, a2 = a0, a3 = a0;
+    const size_t body4 = i + (end - i) / (4 * W) * (4 * W);
+    for (; i < body4; i += 4 * W) {
+      a0 = Op::papply(a0, e.packet(i));
+      a1 = Op::papply(a1, e.packet(i + W));
+      a2 = Op::papply(a2, e.packet(i + 2 * W));
+      a3 = Op::papply(a3, e.packet(i + 3 * W));
+    }
+    const size_t body = i + (end - i) / W * W;
+    for (; i < body; i += W) a0 = Op::papply(a0, e.packet(i));
+    a0 = Op::pmerge(Op::pmerge(a0, a1), Op::pmerge(a2, a3));
+    acc = Op::merge(acc, Op::template hreduce<T>(a0));
+  }
+  for (; i < end; i++) acc = Op::apply(acc, T(e[i]));
+  return acc;
+}
+
+// Compensated sum of e[begin, end), with one compensation term per lane.
+template <ExprLike E>
+typename E::value_type kahan_range(const E& e, size_t begin, size_t end) {
+  using T = typename E::value_type;
+  T sum{}, comp{};
+  auto add = [&](T x) {
+    const T y = x - comp;
+    const T t = sum + y;
+    comp = (t - sum) - y;
+    sum = t;
+  };
+  size_t i = begin;
+  if constexpr (PacketExpr<E> && packet_size<T> > 1) {
+    constexpr size_t W = packet_size<T>;
+    const size_t head = std::min(end, (begin + W - 1) / W * W);
+    for (; i < head; i++) add(e[i]);
+
+    using P = packet_t<T>;
+    P psum = pset1(T{0}), pcomp = psum;
+    const size_t body = i + (end - i) / W * W;
+    for (; i < body; i += W) {
+      const P y = psub(e.packet(i), pcomp);
+      const P t = padd(psum, y);
+      pcomp = psub(psub(t, psum), y);
+      psum = t;
+    }
+    alignas(64) T lanes[W], lane_comp[W];
+    pstore(lanes, psum);
+    pstore(lane_comp, pcomp);
+    for (size_t k = 0; k < W; k++) {
+      add(lanes[k]);
+      add(-lane_comp[k]);
+    }
+  }
+  for (; i < end; i++) add(e[i]);
+  return sum;
+}
+
+template <typename Op, typename T>
+T pairwise(const T* x, size_t begin, size_t end) {
+  if (end - begin == 1) return x[begin];
+  const size_t mid = begin + (end - begin) / 2;
+  return Op::merge(pairwise<Op>(x, begin, mid), pairwise<Op>(x, mid, end));
+}
+
+// Block-wise reduction with a fixed pairwise combine; `range` reduces one
+// block.
+template <typename Op, ExprLike E, typename Range>
+typename E::value_type reduce_blocks(const ParallelPolicy& policy, const E& e,
+                                     Range&& range) {
+  using T = typename E::value_type;
+  const size_t n = e.size();
+  if (n <= block) return range(e, 0, n);
+
+  const size_t nblocks = (n + block - 1) / block;
+  Workspace& ws = Workspace::local();
+  Workspace::Scope scope(ws);
+  T* partial = ws.allocate<T>(nblocks);
+  auto run = [&](size_t b, size_t end) {
+    for (size_t k = b; k < end; k++) {
+      partial[k] = range(e, k * block, std::min(n, (k + 1) * block));
+    }
+  };
+  if (n < policy.threshold) {
+    run(0, nblocks);
+  } else {
+    const size_t grain = std::max<size_t>(1, policy.grain / block);
+    policy.executor().parallel_for(0, nblocks, grain, 1, run);
+  }
+  return pairwise<Op>(partial, 0, nblocks);
+}
+
+template <typename Op, ExprLike E>
+typename E::value_type reduce(const ParallelPolicy& policy, const E& e) {
+  return reduce_blocks<Op>(policy, e, [](const E& x, size_t b, size_t end) {
+    return reduce_range<Op>(x, b, end);
+  });
+}
+
+}  // namespace reduction
+
+//
+// serial
+//
+
+template <ExprLike E>
+typename E::value_type sum(const E& e) {
+  return reduction::reduce_range<reduction::Sum>(e, 0, e.size());
+}
+
+template <ExprLike E>
+typename E::value_type kahan_sum(const E& e) {
+  return reduction::kahan_range(e, 0, e.size());
+}
+
+template <ExprLike E1, ExprLike E2>
+auto dot(const E1& a, const E2& b) {
+  assert(a.size() == b.size());
+  return sum(a * b);
+}
+
+template <ExprLike E>
+typename E::value_type norm1(const E& e) {
+  return reduction::reduce_range<reduction::SumAbs>(e, 0, e.size());
+}
+
+template <ExprLike E>
+typename E::value_type norm2(const E& e) {
+  return std::sqrt(
+      reduction::reduce_range<reduction::SumSquares>(e, 0, e.size()));
+}
+
+template <ExprLike E>
+typename E::value_type normInf(const E& e) {
+  return reduction::reduce_range<reduction::MaxAbs>(e, 0, e.size());
+}
+
+template <ExprLike E>
+typename E::value_type min(const E& e) {
+  return reduction::reduce_range<reduction::Min>(e, 0, e.size());
+}
+
+template <ExprLike E>
+typename E::value_type max(const E& e) {
+  return reduction::reduce_range<reduction::Max>(e, 0, e.size());
+}
+
+//
+// parallel, deterministic
+//
+
+template <ExprLike E>
+typename E::value_type sum(const ParallelPolicy& policy, const E& e) {
+  return reduction::reduce<reduction::Sum>(policy, e);
+}
+
+template <ExprLike E>
+typename E::value_type kahan_sum(const ParallelPolicy& policy, const E& e) {
+  return reduction::reduce_blocks<reduction::Sum>(
+      policy, e, [](const E& x, size_t b, size_t end) {
+        return reduction::kahan_range(x, b, end);
+      });
+}
+
+template <ExprLike E1, ExprLike E2>
+auto dot(const ParallelPolicy& policy, const E1& a, const E2& b) {
+  assert(a.size() == b.size());
+  return sum(policy, a * b);
+}
+
+template <ExprLike E>
+typename E::value_type norm1(const ParallelPolicy& policy, const E& e) {
+  return reduction::reduce<reduction::SumAbs>(policy, e);
+}
+
+template <ExprLike E>
+typename E::value_type norm2(const ParallelPolicy& policy, const E& e) {
+  return std::sqrt(reduction::reduce<reduction::SumSquares>(policy, e));
+}
+
+template <ExprLike E>
+typename E::value_type normInf(const ParallelPolicy& policy, const E& e) {
+  return reduction::reduce<reduction::MaxAbs>(policy, e);
+}
+
+template <ExprLike E>
+typename E::value_type min(const ParallelPolicy& policy, const E& e) {
+  return reduction::reduce<reduction::Min>(policy, e);
+}
+
+template <ExprLike E>
+typename E::value_type max(const ParallelPolicy& policy, const E& e) {
+  return reduction::reduce<reduction::Max>(policy, e);
+}
+
+//
+// with an accumulator type: each element is converted to Acc as it is loaded
+// and the reduction runs in Acc, so dot<double>(x, y) on float vectors reads
+// floats and accumulates in double
+//
+
+template <Scalar Acc, ExprLike E>
+Acc sum(const E& e) {
+  return sum(cast<Acc>(e));
+}
+
+template <Scalar Acc, ExprLike E1, ExprLike E2>
+Acc dot(const E1& a, const E2& b) {
+  assert(a.size() == b.size());
+  return sum(cast<Acc>(a) * cast<Acc>(b));
+}
+
+template <Scalar Acc, ExprLike E>
+Acc norm1(const E& e) {
+  return norm1(cast<Acc>(e));
+}
+
+template <Scalar Acc, ExprLike E>
+Acc norm2(const E& e) {
+  return norm2(cast<Acc>(e));
+}
+
+template <Scalar Acc, ExprLike E>
+Acc sum(const ParallelPolicy& policy, const E& e) {
+  return sum(policy, cast<Acc>(e));
+}
+
+template <Scalar Acc, ExprLike E1, ExprLike E2>
+Acc dot(const ParallelPolicy& policy, const E1& a, const E2& b) {
+  assert(a.size() == b.size());
+  return sum(policy, cast<Acc>(a) * cast<Acc>(b));
+}
+
+template <Scalar Acc, ExprLike E>
+Acc norm1(const ParallelPolicy& policy, const E& e) {
+  return norm1(policy, cast<Acc>(e));
+}
+
+template <Scalar Acc, ExprLike E>
+Acc norm2(const ParallelPolicy& policy, const E& e) {
+  return norm2(policy, cast<Acc>(e));
+}
+
+// The sums of several expressions of one size, with one pass over each block
+// for all of them and a single parallel region. Each sum uses the same blocks
+// and combine as sum(policy, e), so the results match it exactly.
+template <ExprLike E, ExprLike... Es>
+std::array<typename E::value_type, 1 + sizeof...(Es)> fused_sum(
+    const ParallelPolicy& policy, const E& e, const Es&... es) {
+  using T = typename E::value_type;
+  constexpr size_t K = 1 + sizeof...(Es);
+  const size_t n = e.size();
+  assert(((es.size() == n) && ...));
+  // the K sums of [b, end) into out[0], out[step], ...
+  auto range = [&](size_t b, size_t end, T* out, size_t step) {
+    size_t k = 0;
+    out[step * k++] = reduction::reduce_range<reduction::Sum>(e, b, end);
+    ((out[step * k++] = reduction::reduce_range<reduction::Sum>(es, b, end)),
+     ...);
+  };
+
+  std::array<T, K> result{};
+  if (n <= reduction::block) {
+    range(0, n, result.data(), 1);
+    return result;
+  }
+  const size_t nblocks = (n + reduction::block - 1) / reduction::block;
+  Workspace& ws = Workspace::local();
+  Workspace::Scope scope(ws);
+  T* partial = ws.allocate<T>(K * nblocks);  // K runs of nblocks partials
+  auto run = [&](size_t b, size_t end) {
+    for (size_t k = b; k < end; k++) {
+      range(k * reduction::block, std::min(n, (k + 1) * reduction::block),
+            partial + k, nblocks);
+    }
+  };
+  if (n < policy.threshold) {
+    run(0, nblocks);
+  } else {
+    const size_t grain = std::max<size_t>(1, policy.grain / reduction::block);
+    policy.executor().parallel_for(0, nblocks, grain, 1, run);
+  }
+  for (size_t k = 0; k < K; k++) {
+    result[k] = reduction::pairwise<reduction::Sum>(partial + k * nblocks, 0,
+                                                    nblocks);
+  }
+  return result;
+}
+
+SWNUMERIC_END
@@ -0,0 +1,304 @@
+#pragma once
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cassert>
+#include <charconv>
+#include <concepts>
+#include <cstddef>
+#include <filesystem>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "library/dispatch/Namespace.h"
+#include "library/parallel/ThreadPool.h"
+#include "library/vectormatrix/Matrix.h"
+#include "library/vectormatrix/Vector.h"
+#include "library/vectormatrix/View.h"
+
+SWNUMERIC_BEGIN
+
+//
+// Parallel reader for numeric CSV tables, the counterpart of CSVWriter. The
+// file is mapped and cut into byte chunks that are scanned concurrently.
+//
+// A newline only ends a row outside quotes, and whether a chunk starts inside
+// quotes depends on everything before it. The first pass therefore counts,
+// per chunk, its quotes and its newlines at even and at odd quote parity
+// (i.e. for both possible starting states); a prefix sum of quote counts then
+// fixes each chunk's starting state, its row count and the first row index it
+// owns. The second pass parses each chunk's rows with std::from_chars
+// directly into the destination. Quoted fields, with "" for an embedded
+// quote, are accepted as CSVWriter writes them.
+//
+// Every row must have the same number of fields. A final row without a
+// trailing newline is accepted; empty rows are not.
+//
+
+template <std::floating_point T>
+class CSVReader {
+ public:
+  explicit CSVReader(const std::filesystem::path& path, char delimiter = ',',
+                     bool header = false,
+                     ThreadPool& pool = ThreadPool::global())
+      : path_(path.string()), delimiter_(delimiter), pool_(pool) {
+    map(path);
+    scan(header);
+  }
+
+  CSVReader(const CSVReader&) = delete;
+  CSVReader& operator=(const CSVReader&) = delete;
+
+  ~CSVReader() {
+    if (base_) ::munmap(base_, bytes_);
+  }
+
+  size_t rows() const noexcept { return rows_; }
+  size_t cols() const noexcept { return cols_; }
+  const std::vector<std::string>& header() const noexcept { return header_; }
+
+  // Fills a preallocated rows() x cols() matrix, or a block of a larger one.
+  void read(MatrixView<T> M) const {
+    assert(M.rows() == rows_ && M.cols() == cols_);
+    std::vector<T*> col(cols_);
+    for (size_t c = 0; c < cols_; c++) col[c] = M.data() + c;
+    parse(col.data(), M.ld());
+  }
+
+  Matrix<T> read_matrix() const {
+    Matrix<T> M(rows_, cols_, uninitialized);
+    read(M);
+    return M;
+  }
+
+  // Fills one preallocated vector of rows() elements per column.
+  template <typename... Alloc>
+  void read_columns(Vector<T, Alloc>&... v) const {
+    assert(sizeof...(Alloc) == cols_);
+    assert(((v.size() == rows_) && ...));
+    T* col[] = {v.data()...};
+    parse(col, 1);
+  }
+
+  std::vector<Vector<T>> read_columns() const {
+    std::vector<Vector<T>> v;
+    v.reserve(cols_);
+    std::vector<T*> col(cols_);
+    for (size_t c = 0; c < cols_; c++) {
+      col[c] = v.emplace_back(rows_, uninitialized).data();
+    }
+    parse(col.data(), 1);
+    return v;
+  }
+
+ private:
+  struct Chunk {
+    size_t begin, end;
+    size_t quotes = 0;
+    // newlines at even / odd quote parity relative to the chunk start
+    size_t newlines[2] = {0, 0};
+    size_t last[2] = {npos, npos};
+    // resolved after the prefix pass
+    bool odd = false;
+    size_t row = 0;
+    size_t start = 0;
+  };
+
+  static constexpr size_t npos = static_cast<size_t>(-1);
+  static constexpr size_t min_chunk = size_t{1} << 20;
+
+  std::string path_;
+  char delimiter_;
+  ThreadPool& pool_;
+  char* base_ = nullptr;
+  size_t bytes_ = 0;
+  size_t data_begin_ = 0;
+  size_t rows_ = 0;
+  size_t cols_ = 0;
+  std::vector<std::string> header_;
+  std::vector<Chunk> chunks_;
+
+  void map(const std::filesystem::path& path) {
+    const int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) throw std::runtime_error("Failed to open file: " + path_);
+    struct stat st;
+    if (::fstat(fd, &st) != 0) {
+      ::close(fd);
+      throw std::runtime_error("Failed to stat file: " + path_);
+    }
+    bytes_ = static_cast<size_t>(st.st_size);
+    if (bytes_ > 0) {
+      void* p = ::mmap(nullptr, bytes_, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (p == MAP_FAILED) {
+        ::close(fd);
+        throw std::runtime_error("Failed to map file: " + path_);
+      }
+      base_ = static_cast<char*>(p);
+      ::madvise(base_, bytes_, MADV_SEQUENTIAL);
+    }
+    ::close(fd);
+  }
+
+  [[noreturn]] void fail(const std::string& what, size_t row) const {
+    throw std::runtime_error(path_ + ": " + what + " in data row " +
+                             std::to_string(row));
+  }
+
+  // end of the row starting at p (the terminating newline, or bytes_)
+  size_t row_end(size_t p) const noexcept {
+    bool quoted = false;
+    for (; p < bytes_; p++) {
+      if (base_[p] == '"') quoted = !quoted;
+      if (base_[p] == '\n' && !quoted) return p;
+    }
+    return bytes_;
+  }
+
+  // Splits [p, end) into fields, calling f(field, quoted) for each.
+  template <typename F>
+  void for_each_field(size_t p, size_t end, F&& f) const {
+    if (end > p && base_[end - 1] == '\r') end--;
+    for (;;) {
+      size_t q = p;
+      bool quoted = false;
+      if (q < end && base_[q] == '"') {
+        quoted = true;
+        for (q++; q < end; q++) {
+          if (base_[q] == '"') {
+            if (q + 1 < end && base_[q + 1] == '"') {
+              q++;
+            } else {
+              break;
+            }
+          }
+        }
+        q = std::min(end, q + 1);
+      }
+      while (q < end && base_[q] != delimiter_) q++;
+      f(std::string_view(base_ + p, q - p), quoted);
+      if (q >= end) return;
+      p = q + 1;
+    }
+  }
+
+  static std::string unquote(std::string_view field) {
+    std::string s;
+    const size_t close = field.rfind('"');
+    for (size_t i = 1; i < close; i++) {
+      s += field[i];
+      if (field[i] == '"') i++;
+    }
+    return s;
+  }
+
+  void scan(bool header) {
+    if (bytes_ == 0) return;
+
+    // header and column count from the first rows
+    size_t p = 0;
+    if (header) {
+      const size_t e = row_end(0);
+      for_each_field(0, e, [&](std::string_view f, bool quoted) {
+        header_.emplace_back(quoted ? unquote(f) : std::string(f));
+      });
+      p = data_begin_ = std::min(bytes_, e + 1);
+    }
+    if (p < bytes_) {
+      for_each_field(p, row_end(p), [&](std::string_view, bool) { cols_++; });
+    }
+
+    // pass 1: quote and newline counts per chunk
+    const size_t n = bytes_ - data_begin_;
+    const size_t nchunks = std::clamp<size_t>(n / min_chunk, 1,
+                                              4 * pool_.size());
+    chunks_.resize(nchunks);
+    for (size_t c = 0; c < nchunks; c++) {
+      chunks_[c].begin = data_begin_ + n / nchunks * c;
+      chunks_[c].end =
+          c + 1 == nchunks ? bytes_ : data_begin_ + n / nchunks * (c + 1);
+    }
+    pool_.parallel_for(0, nchunks, 1, 1, [&](size_t b, size_t e) {
+      for (size_t c = b; c < e; c++) count(chunks_[c]);
+    });
+
+    // prefix: starting parity, owned rows and where the first one starts
+    size_t quotes = 0, last_end = npos;
+    for (Chunk& ch : chunks_) {
+      ch.odd = quotes % 2;
+      const int h = ch.odd;
+      ch.row = rows_;
+      ch.start = last_end == npos ? data_begin_ : last_end + 1;
+      rows_ += ch.newlines[h];
+      if (ch.last[h] != npos) last_end = ch.last[h];
+      quotes += ch.quotes;
+    }
+    // final row without a newline
+    const size_t tail = last_end == npos ? data_begin_ : last_end + 1;
+    bool tail_row = false;
+    for (size_t i = tail; i < bytes_ && !tail_row; i++) {
+      tail_row = base_[i] != '\r' && base_[i] != '\n';
+    }
+    if (tail_row) rows_++;
+  }
+
+  void count(Chunk& ch) const noexcept {
+    size_t quotes = 0;
+    for (size_t i = ch.begin; i < ch.end; i++) {
+      const char c = base_[i];
+      if (c == '"') {
+        quotes++;
+      } else if (c == '\n') {
+        const int h = quotes % 2;
+        ch.last[h] = i;
+        ch.newlines[h]++;
+      }
+    }
+    ch.quotes = quotes;
+  }
+
+  // pass 2: every chunk parses the rows ending in it (the last one also the
+  // unterminated tail). Element (r, c) goes to col[c][r * row_stride].
+  void parse(T* const* col, size_t row_stride) const {
+    if (rows_ == 0) return;
+    pool_.parallel_for(0, chunks_.size(), 1, 1, [&](size_t b, size_t e) {
+      for (size_t c = b; c < e; c++) {
+        const Chunk& ch = chunks_[c];
+        const bool last = c + 1 == chunks_.size();
+        const size_t n = last ? rows_ - ch.row : ch.newlines[ch.odd];
+        parse_rows(ch.start, ch.row, n, col, row_stride);
+      }
+    });
+  }
+
+  void parse_rows(size_t p, size_t row, size_t n, T* const* col,
+                  size_t row_stride) const {
+    std::string tmp;
+    for (size_t r = row; r < row + n; r++) {
+      const size_t e = row_end(p);
+      if (e == p || (e == p + 1 && base_[p] == '\r')) fail("empty row", r);
+      size_t c = 0;
+      for_each_field(p, e, [&](std::string_view f, bool quoted) {
+        if (c >= cols_) fail("too many fields", r);
+        if (quoted) {
+          tmp = unquote(f);
+          f = tmp;
+        }
+        T v;
+        const auto res = std::from_chars(f.data(), f.data() + f.size(), v);
+        if (res.ec != std::errc{} || res.ptr != f.data() + f.size()) {
+          fail("invalid number '" + std::string(f) + "'", r);
+        }
+        col[c++][r * row_stride] = v;
+      });
+      if (c != cols_) fail("too few fields", r);
+      p = e + 1;
+    }
+  }
+};
+
+SWNUMERIC_END
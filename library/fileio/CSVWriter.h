@@ -1,16 +1,42 @@
 #pragma once
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cassert>
+#include <cerrno>
+#include <charconv>
 #include <concepts>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <exception>
 #include <filesystem>
-#include <fstream>
-#include <iomanip>
 #include <limits>
+#include <mutex>
 #include <sstream>
 #include <stdexcept>
 #include <string>
 #include <string_view>
+#include <system_error>
+#include <thread>
 #include <type_traits>
+#include <utility>
 #include <vector>
 
+#include "library/dispatch/Dispatch.h"
+#include "library/dispatch/Namespace.h"
+#include "library/expression/Expression.h"
+#include "library/instrument/Instrument.h"
+
+#if defined(__SSE2__)
+#include <immintrin.h>
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
+SWNUMERIC_BEGIN
+
 template <typename T>
 concept Streamable = requires(T t, std::ostream& os) {
   { os << t } -> std::convertible_to<std::ostream&>;
@@ -21,60 +47,239 @@ struct FloatFormat {
   bool fixed = true;
 };
 
+// blocking: flush() writes on the calling thread.
+// async: flush() hands the buffer to a background writer thread.
+enum class WriteMode { blocking, async };
+
+// true if field contains the delimiter, a quote, CR or LF; scans 16 to 64
+// bytes at a time where SIMD is available, through the dispatched kernel for
+// fields long enough to use it
+inline bool csv_needs_quoting(std::string_view field, char delimiter) noexcept {
+  const char* p = field.data();
+  const size_t n = field.size();
+  size_t i = 0;
+#if SWNUMERIC_DISPATCH
+  if (n >= 32) {
+    if (auto* kernel = dispatch::table().csv_needs_quoting) {
+      return kernel(p, n, delimiter);
+    }
+  }
+#endif
+#if defined(__AVX512BW__)
+  {
+    const __m512i d = _mm512_set1_epi8(delimiter), q = _mm512_set1_epi8('"'),
+                  lf = _mm512_set1_epi8('\n'), cr = _mm512_set1_epi8('\r');
+    for (; i + 64 <= n; i += 64) {
+      const __m512i v = _mm512_loadu_si512(p + i);
+      if (_mm512_cmpeq_epi8_mask(v, d) | _mm512_cmpeq_epi8_mask(v, q) |
+          _mm512_cmpeq_epi8_mask(v, lf) | _mm512_cmpeq_epi8_mask(v, cr)) {
+        return true;
+      }
+    }
+  }
+#elif defined(__AVX2__)
+  {
+    const __m256i d = _mm256_set1_epi8(delimiter), q = _mm256_set1_epi8('"'),
+                  lf = _mm256_set1_epi8('\n'), cr = _mm256_set1_epi8('\r');
+    for (; i + 32 <= n; i += 32) {
+      const __m256i v =
+          _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p + i));
+      const __m256i a =
+          _mm256_or_si256(_mm256_cmpeq_epi8(v, d), _mm256_cmpeq_epi8(v, q));
+      const __m256i b =
+          _mm256_or_si256(_mm256_cmpeq_epi8(v, lf), _mm256_cmpeq_epi8(v, cr));
+      if (_mm256_movemask_epi8(_mm256_or_si256(a, b))) return true;
+    }
+  }
+#endif
+#if defined(__SSE2__)
+  const __m128i d = _mm_set1_epi8(delimiter), q = _mm_set1_epi8('"'),
+                lf = _mm_set1_epi8('\n'), cr = _mm_set1_epi8('\r');
+  for (; i + 16 <= n; i += 16) {
+    const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + i));
+    const __m128i a = _mm_or_si128(_mm_cmpeq_epi8(v, d), _mm_cmpeq_epi8(v, q));
+    const __m128i b =
+        _mm_or_si128(_mm_cmpeq_epi8(v, lf), _mm_cmpeq_epi8(v, cr));
+    if (_mm_movemask_epi8(_mm_or_si128(a, b))) return true;
+  }
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+  const uint8x16_t d = vdupq_n_u8(delimiter), q = vdupq_n_u8('"'),
+                   lf = vdupq_n_u8('\n'), cr = vdupq_n_u8('\r');
+  for (; i + 16 <= n; i += 16) {
+    const uint8x16_t v = vld1q_u8(reinterpret_cast<const uint8_t*>(p + i));
+    const uint8x16_t hit = vorrq_u8(vorrq_u8(vceqq_u8(v, d), vceqq_u8(v, q)),
+                                    vorrq_u8(vceqq_u8(v, lf), vceqq_u8(v, cr)));
+    if (vmaxvq_u8(hit)) return true;
+  }
+#endif
+  for (; i < n; i++) {
+    const char c = p[i];
+    if (c == delimiter || c == '"' || c == '\n' || c == '\r') return true;
+  }
+  return false;
+}
+
+//
+// Rows are formatted straight into one contiguous byte buffer: numbers with
+// std::to_chars, strings with a vectorized quoting scan. Once the buffer
+// holds buffer_rows rows it is handed to the kernel with a single write(), so
+// after the buffer has reached its working size writing a row of numbers does
+// not allocate.
+//
+// In WriteMode::async a background thread owns the write() calls. flush()
+// queues the filled buffer and continues with a recycled one, blocking only
+// while queue_depth buffers are already waiting (one by default, i.e. double
+// buffering). sync() waits for everything queued to be written and fsync()ed.
+// Formatting stays on the producer, where it is a copy into the buffer; the
+// destructor waits for queued writes but does not fsync(). Errors from the
+// writer thread are rethrown by the next flush() or sync().
+//
+
 class CSVWriter {
  public:
   explicit CSVWriter(const std::filesystem::path& path, char delimiter = ',',
                      size_t buffer_rows = 1000,
-                     FloatFormat float_fmt = FloatFormat{})
+                     FloatFormat float_fmt = FloatFormat{},
+                     WriteMode mode = WriteMode::blocking,
+                     size_t queue_depth = 1)
       : delimiter_(delimiter),
         buffer_rows_(buffer_rows),
         float_format_(float_fmt),
-        file_(path, std::ios::binary) {
-    if (!file_) {
+        fd_(::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+                   0644)),
+        queue_depth_(std::max<size_t>(queue_depth, 1)) {
+    if (fd_ < 0) {
       throw std::runtime_error("Failed to open file: " + path.string());
     }
-    buffer_.reserve(buffer_rows);
+    // numbers only need a quoting scan if the delimiter can appear in them
+    numeric_quoting_ =
+        std::string_view("0123456789+-.eEinfatINFAT").find(delimiter) !=
+        std::string_view::npos;
+    buffer_.reserve(64 * 1024);
+    if (mode == WriteMode::async) {
+      writer_ = std::thread([this] { writer_loop(); });
+    }
   }
 
+  CSVWriter(const CSVWriter&) = delete;
+  CSVWriter& operator=(const CSVWriter&) = delete;
+
   void write_header(const std::vector<std::string>& headers) {
     write_row(headers);
   }
 
   template <Streamable T>
   void write_row(const std::vector<T>& row) {
-    buffer_.emplace_back();
-    buffer_.back().reserve(row.size());
-    for (const auto& field : row) {
-      buffer_.back().push_back(to_string(field));
-    }
-
-    if (buffer_.size() >= buffer_rows_) {
-      flush();
+    for (size_t i = 0; i < row.size(); ++i) {
+      if (i > 0) buffer_.push_back(delimiter_);
+      append(row[i]);
     }
+    end_row();
   }
 
   template <Streamable... Args>
   void write_row(const Args&... args) {
-    buffer_.emplace_back();
-    buffer_.back().reserve(sizeof...(Args));
-    (buffer_.back().push_back(to_string(args)), ...);
-
-    if (buffer_.size() >= buffer_rows_) {
-      flush();
-    }
+    size_t i = 0;
+    ((i++ > 0 ? buffer_.push_back(delimiter_) : void(), append(args)), ...);
+    end_row();
   }
 
   template <Streamable T>
   void write_row(std::initializer_list<T> row) {
-    write_row(std::vector<T>(row));
+    size_t i = 0;
+    for (const auto& field : row) {
+      if (i++ > 0) buffer_.push_back(delimiter_);
+      append(field);
+    }
+    end_row();
   }
 
+  //
+  // bulk writes: values are formatted straight from the source, with no
+  // per-row containers, so any expression is written in one pass
+  //
+
+  // One CSV row per matrix row, for matrices, views and matrix-shaped
+  // expressions such as A - broadcast_rows(mean, A.rows()).
+  template <MatrixExpr M>
+  void write_matrix(const M& m) {
+    const size_t R = m.rows(), C = m.cols();
+    for (size_t i = 0; i < R; i++) {
+      for (size_t j = 0; j < C; j++) {
+        if (j > 0) buffer_.push_back(delimiter_);
+        append(value_at(m, i * C + j));
+      }
+      end_row();
+    }
+  }
+
+  // Row i holds element i of each column; all columns must have equal size.
+  template <ExprLike... Cols>
+    requires(sizeof...(Cols) > 0)
+  void write_columns(const Cols&... cols) {
+    const size_t n = (cols.size(), ...);
+    assert(((cols.size() == n) && ...));
+    for (size_t i = 0; i < n; i++) {
+      size_t k = 0;
+      ((k++ > 0 ? buffer_.push_back(delimiter_) : void(),
+        append(value_at(cols, i))),
+       ...);
+      end_row();
+    }
+  }
+
+  // A vector or vector expression as a single row.
+  template <ExprLike E>
+  void write_row(const E& e) {
+    for (size_t i = 0; i < e.size(); i++) {
+      if (i > 0) buffer_.push_back(delimiter_);
+      append(value_at(e, i));
+    }
+    end_row();
+  }
+
+  // Blocking mode: writes the buffer. Async mode: queues it for the writer
+  // thread, waiting only for room in the queue.
   void flush() {
-    for (const auto& row : buffer_) {
-      write_row_to_file(row);
+    const instrument::Region region("CSVWriter::flush");
+    const instrument::Timer timer(instrument::Counter::csv_flush_ns);
+    instrument::add(instrument::Counter::csv_flushes, 1);
+    instrument::add(instrument::Counter::csv_rows, rows_);
+    instrument::add(instrument::Counter::csv_bytes, buffer_.size());
+    rows_ = 0;
+    if (!writer_.joinable()) {
+      write_all(buffer_.data(), buffer_.size());
+      buffer_.clear();
+      return;
+    }
+    std::unique_lock<std::mutex> lk(mutex_);
+    rethrow_error();
+    if (buffer_.empty()) return;
+    space_.wait(lk, [this] { return queue_.size() < queue_depth_; });
+    queue_.push_back(std::move(buffer_));
+    if (!spare_.empty()) {
+      buffer_ = std::move(spare_.back());
+      spare_.pop_back();
+    } else {
+      buffer_ = std::string();
+      buffer_.reserve(queue_.back().capacity());
+    }
+    lk.unlock();
+    ready_.notify_one();
+  }
+
+  // Flushes, waits for all queued data to be written, then fsync()s.
+  void sync() {
+    flush();
+    if (writer_.joinable()) {
+      std::unique_lock<std::mutex> lk(mutex_);
+      space_.wait(lk, [this] { return queue_.empty() && !writing_; });
+      rethrow_error();
+    }
+    if (::fsync(fd_) != 0) {
+      throw std::system_error(errno, std::generic_category(),
+                              "CSVWriter fsync failed");
     }
-    buffer_.clear();
-    file_.flush();
   }
 
   ~CSVWriter() {
@@ -82,74 +287,167 @@ class CSVWriter {
       flush();
     } catch (...) {
     }
+    if (writer_.joinable()) {
+      {
+        std::lock_guard<std::mutex> lk(mutex_);
+        stop_ = true;
+      }
+      ready_.notify_one();
+      writer_.join();
+    }
+    ::close(fd_);
   }
 
  private:
   char delimiter_ = ',';
   size_t buffer_rows_;
   FloatFormat float_format_;
-  std::ofstream file_;
-  std::vector<std::vector<std::string>> buffer_;
+  int fd_;
+  bool numeric_quoting_ = false;
+  size_t rows_ = 0;
+  std::string buffer_;
+
+  // async mode; queue_, spare_, writing_, stop_ and error_ are guarded by
+  // mutex_
+  size_t queue_depth_;
+  std::thread writer_;
+  std::mutex mutex_;
+  std::condition_variable ready_;
+  std::condition_variable space_;
+  std::deque<std::string> queue_;
+  std::vector<std::string> spare_;
+  bool writing_ = false;
+  bool stop_ = false;
+  std::exception_ptr error_;
+
+  void rethrow_error() {
+    if (error_) std::rethrow_exception(std::exchange(error_, nullptr));
+  }
+
+  // Drains the queue until stopped; buffers are recycled through spare_.
+  void writer_loop() {
+    std::unique_lock<std::mutex> lk(mutex_);
+    for (;;) {
+      ready_.wait(lk, [this] { return stop_ || !queue_.empty(); });
+      if (queue_.empty()) return;
+      std::string buf = std::move(queue_.front());
+      queue_.pop_front();
+      writing_ = true;
+      lk.unlock();
+      space_.notify_all();
+
+      std::exception_ptr err;
+      try {
+        write_all(buf.data(), buf.size());
+      } catch (...) {
+        err = std::current_exception();
+      }
+      buf.clear();
+
+      lk.lock();
+      if (err && !error_) error_ = err;
+      spare_.push_back(std::move(buf));
+      writing_ = false;
+      space_.notify_all();
+    }
+  }
+
+  // element i, read from storage when the source has it
+  template <ExprLike E>
+  static typename E::value_type value_at(const E& e, size_t i) {
+    if constexpr (requires { e.data(); }) {
+      if (is_contiguous(e)) return e.data()[i];
+    }
+    return e[i];
+  }
+
+  void end_row() {
+    buffer_.push_back('\n');
+    if (++rows_ >= buffer_rows_) {
+      flush();
+    }
+  }
 
   template <Streamable T>
-  std::string to_string(const T& value) const {
-    if constexpr (std::is_same_v<T, std::string>) {
-      return value;
-    } else if constexpr (std::is_same_v<T, const char*> ||
-                         std::is_same_v<T, char*>) {
-      return std::string(value);
-    } else if constexpr (std::is_same_v<T, std::string_view>) {
-      return std::string(value);
+  void append(const T& value) {
+    if constexpr (std::is_convertible_v<const T&, std::string_view>) {
+      append_field(std::string_view(value));
     } else if constexpr (std::is_same_v<T, bool>) {
-      return value ? "true" : "false";
+      buffer_.append(value ? "true" : "false");
+    } else if constexpr (std::is_same_v<T, char> ||
+                         std::is_same_v<T, signed char> ||
+                         std::is_same_v<T, unsigned char>) {
+      // as the stream writes them, so int8_t and uint8_t stay characters
+      const char c = static_cast<char>(value);
+      append_field(std::string_view(&c, 1));
+    } else if constexpr (std::is_integral_v<T>) {
+      char tmp[std::numeric_limits<T>::digits10 + 3];
+      const auto r = std::to_chars(tmp, tmp + sizeof(tmp), value);
+      append_number(std::string_view(tmp, r.ptr - tmp));
     } else if constexpr (std::is_floating_point_v<T>) {
-      std::ostringstream oss;
-      if (float_format_.fixed) {
-        oss << std::fixed;
-      }
-      oss << std::setprecision(float_format_.precision) << value;
-      return oss.str();
+      append_float(value);
     } else {
       std::ostringstream oss;
       oss << value;
-      return oss.str();
+      append_field(oss.str());
     }
   }
 
-  void write_row_to_file(const std::vector<std::string>& row) {
-    for (size_t i = 0; i < row.size(); ++i) {
-      if (i > 0) {
-        file_ << delimiter_;
-      }
-      write_field(row[i]);
+  template <typename T>
+  void append_float(T value) {
+    const auto fmt = float_format_.fixed ? std::chars_format::fixed
+                                         : std::chars_format::general;
+    char tmp[128];
+    const auto r = std::to_chars(tmp, tmp + sizeof(tmp), value, fmt,
+                                 float_format_.precision);
+    if (r.ec == std::errc{}) {
+      append_number(std::string_view(tmp, r.ptr - tmp));
+      return;
     }
-    file_ << '\n';
+    // fixed notation of a large magnitude, or a very high precision
+    std::string big(std::numeric_limits<T>::max_exponent10 +
+                        float_format_.precision + 8,
+                    '\0');
+    const auto rb = std::to_chars(big.data(), big.data() + big.size(), value,
+                                  fmt, float_format_.precision);
+    append_number(std::string_view(big.data(), rb.ptr - big.data()));
   }
 
-  void write_field(const std::string& field) {
-    bool needs_quotes = needs_quoting(field);
-
-    if (needs_quotes) {
-      file_ << '"';
-      for (char c : field) {
-        if (c == '"') {
-          file_ << "\"\"";
-        } else {
-          file_ << c;
-        }
-      }
-      file_ << '"';
+  void append_number(std::string_view s) {
+    if (numeric_quoting_) {
+      append_field(s);
     } else {
-      file_ << field;
+      buffer_.append(s);
     }
   }
 
-  bool needs_quoting(const std::string& field) const {
-    for (char c : field) {
-      if (c == delimiter_ || c == '"' || c == '\n' || c == '\r') {
-        return true;
+  void append_field(std::string_view field) {
+    if (!csv_needs_quoting(field, delimiter_)) {
+      buffer_.append(field);
+      return;
+    }
+    buffer_.push_back('"');
+    for (size_t q; (q = field.find('"')) != std::string_view::npos;) {
+      buffer_.append(field.substr(0, q + 1));
+      buffer_.push_back('"');
+      field.remove_prefix(q + 1);
+    }
+    buffer_.append(field);
+    buffer_.push_back('"');
+  }
+
+  void write_all(const char* p, size_t n) {
+    while (n > 0) {
+      const ssize_t w = ::write(fd_, p, n);
+      if (w < 0) {
+        if (errno == EINTR) continue;
+        throw std::system_error(errno, std::generic_category(),
+                                "CSVWriter write failed");
       }
+      p += w;
+      n -= static_cast<size_t>(w);
     }
-    return false;
   }
 };
+
+SWNUMERIC_END
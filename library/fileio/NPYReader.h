@@ -0,0 +1,252 @@
+#pragma once
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "library/dispatch/Namespace.h"
+#include "library/fileio/NPYWriter.h"
+#include "library/vectormatrix/View.h"
+
+SWNUMERIC_BEGIN
+
+//
+// Zero-copy input for .npy files. MappedArray<T> maps the whole file and
+// exposes the elements as VectorView/MatrixView, which go straight into
+// expressions, reductions and BLAS calls. Opening costs one header parse;
+// pages are faulted in on first touch, steered by madvise() hints.
+//
+// The mapping is private and copy-on-write: views may be written to, but the
+// changes never reach the file. MAP_NORESERVE keeps very large mappings from
+// being charged against commit limits until pages are actually modified.
+//
+
+enum class Access {
+  normal,      // default kernel readahead
+  sequential,  // aggressive readahead, pages dropped after use
+  random,      // no readahead
+};
+
+namespace npy {
+
+struct Header {
+  std::string descr;
+  bool fortran_order = false;
+  std::vector<size_t> shape;
+  size_t data_offset = 0;
+};
+
+inline std::runtime_error format_error(const std::string& what) {
+  return std::runtime_error("Invalid .npy file: " + what);
+}
+
+// value of 'key' in the header dict, up to the next top-level ',' or '}'
+inline std::string_view dict_value(std::string_view dict,
+                                   std::string_view key) {
+  const std::string quoted = "'" + std::string(key) + "'";
+  size_t p = dict.find(quoted);
+  if (p == std::string_view::npos) throw format_error("missing " + quoted);
+  p = dict.find(':', p + quoted.size());
+  if (p == std::string_view::npos) throw format_error("malformed dict");
+  dict.remove_prefix(p + 1);
+  while (!dict.empty() && dict.front() == ' ') dict.remove_prefix(1);
+  if (dict.empty()) throw format_error("malformed dict");
+  const size_t end =
+      dict.front() == '(' ? dict.find(')') + 1 : dict.find_first_of(",}");
+  if (end == std::string_view::npos || end == 0) {
+    throw format_error("malformed dict");
+  }
+  return dict.substr(0, end);
+}
+
+inline Header parse_header(const char* p, size_t n) {
+  if (n < 10 || std::memcmp(p, "\x93NUMPY", 6) != 0) {
+    throw format_error("bad magic");
+  }
+  const auto byte = [&](size_t i) { return static_cast<uint8_t>(p[i]); };
+  size_t len, prefix;
+  if (byte(6) == 1) {
+    len = byte(8) | size_t{byte(9)} << 8;
+    prefix = 10;
+  } else if ((byte(6) == 2 || byte(6) == 3) && n >= 12) {
+    len = byte(8) | size_t{byte(9)} << 8 | size_t{byte(10)} << 16 |
+          size_t{byte(11)} << 24;
+    prefix = 12;
+  } else {
+    throw format_error("unsupported version");
+  }
+  if (prefix + len > n) throw format_error("truncated header");
+
+  const std::string_view dict(p + prefix, len);
+  Header h;
+  h.data_offset = prefix + len;
+
+  std::string_view descr = dict_value(dict, "descr");
+  if (descr.size() < 2 || descr.front() != '\'' || descr.back() != '\'') {
+    throw format_error("descr");
+  }
+  h.descr = descr.substr(1, descr.size() - 2);
+  h.fortran_order = dict_value(dict, "fortran_order") == "True";
+
+  std::string_view shape = dict_value(dict, "shape");
+  shape = shape.substr(1, shape.size() - 2);
+  while (!shape.empty()) {
+    size_t v = 0;
+    bool digits = false;
+    while (!shape.empty() && shape.front() >= '0' && shape.front() <= '9') {
+      const size_t digit = shape.front() - '0';
+      if (v > (SIZE_MAX - digit) / 10) throw format_error("shape");
+      v = v * 10 + digit;
+      digits = true;
+      shape.remove_prefix(1);
+    }
+    if (digits) h.shape.push_back(v);
+    if (!shape.empty()) {
+      if (shape.front() != ',' && shape.front() != ' ') {
+        throw format_error("shape");
+      }
+      shape.remove_prefix(1);
+    }
+  }
+  return h;
+}
+
+// product of the dimensions; throws if it does not fit in size_t
+inline size_t element_count(const std::vector<size_t>& shape) {
+  size_t n = 1;
+  for (size_t d : shape) {
+    if (d == 0) return 0;
+  }
+  for (size_t d : shape) {
+    if (n > SIZE_MAX / d) throw format_error("shape too large");
+    n *= d;
+  }
+  return n;
+}
+
+inline int madvise_flag(Access a) {
+  switch (a) {
+    case Access::sequential:
+      return MADV_SEQUENTIAL;
+    case Access::random:
+      return MADV_RANDOM;
+    default:
+      return MADV_NORMAL;
+  }
+}
+
+}  // namespace npy
+
+template <std::floating_point T>
+class MappedArray {
+ public:
+  explicit MappedArray(const std::filesystem::path& path,
+                       Access access = Access::normal) {
+    const int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+      throw std::runtime_error("Failed to open file: " + path.string());
+    }
+    struct stat st;
+    if (::fstat(fd, &st) != 0 || st.st_size == 0) {
+      ::close(fd);
+      throw npy::format_error(path.string() + " is empty");
+    }
+    bytes_ = static_cast<size_t>(st.st_size);
+    base_ = ::mmap(nullptr, bytes_, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_NORESERVE, fd, 0);
+    ::close(fd);
+    if (base_ == MAP_FAILED) {
+      base_ = nullptr;
+      throw std::runtime_error("Failed to map file: " + path.string());
+    }
+
+    try {
+      header_ = npy::parse_header(static_cast<const char*>(base_), bytes_);
+      if (header_.descr != npy::descr<T>()) {
+        throw npy::format_error("dtype " + header_.descr + ", expected " +
+                                npy::descr<T>());
+      }
+      if (header_.fortran_order && header_.shape.size() > 1) {
+        throw npy::format_error("column-major data is not supported");
+      }
+      size_ = npy::element_count(header_.shape);
+      if (header_.data_offset > bytes_ ||
+          size_ > (bytes_ - header_.data_offset) / sizeof(T)) {
+        throw npy::format_error("file shorter than its shape");
+      }
+    } catch (...) {
+      ::munmap(base_, bytes_);
+      throw;
+    }
+    advise(access);
+  }
+
+  MappedArray(const MappedArray&) = delete;
+  MappedArray& operator=(const MappedArray&) = delete;
+  MappedArray(MappedArray&& other) noexcept
+      : base_(std::exchange(other.base_, nullptr)),
+        bytes_(other.bytes_),
+        size_(other.size_),
+        header_(std::move(other.header_)) {}
+
+  ~MappedArray() {
+    if (base_) ::munmap(base_, bytes_);
+  }
+
+  const std::vector<size_t>& shape() const noexcept { return header_.shape; }
+  size_t size() const noexcept { return size_; }
+  T* data() const noexcept {
+    return reinterpret_cast<T*>(static_cast<char*>(base_) +
+                                header_.data_offset);
+  }
+
+  // all elements, flattened
+  VectorView<T> vector() const noexcept { return {data(), size()}; }
+
+  // The leading dimension as rows and the rest flattened as columns, so a
+  // run of NPYWriter frames reads as one matrix with a frame per row.
+  MatrixView<T> matrix() const noexcept {
+    const size_t R = shape().empty() ? 1 : shape()[0];
+    return {data(), R, R == 0 ? 0 : size() / R};
+  }
+
+  // frame k of a (frames, ...) file
+  VectorView<T> frame(size_t k) const noexcept {
+    assert(!shape().empty() && k < shape()[0]);
+    const size_t n = size() / shape()[0];
+    return {data() + k * n, n};
+  }
+
+  // Applies an access hint to the whole mapping.
+  void advise(Access access) const noexcept {
+    ::madvise(base_, bytes_, npy::madvise_flag(access));
+  }
+
+  // Starts reading elements [begin, begin + n) in the background.
+  void prefetch(size_t begin, size_t n) const noexcept {
+    const uintptr_t page = static_cast<uintptr_t>(::sysconf(_SC_PAGESIZE));
+    const uintptr_t lo = reinterpret_cast<uintptr_t>(data() + begin);
+    const uintptr_t hi = reinterpret_cast<uintptr_t>(data() + begin + n);
+    const uintptr_t start = lo / page * page;
+    ::madvise(reinterpret_cast<void*>(start), hi - start, MADV_WILLNEED);
+  }
+
+ private:
+  void* base_ = nullptr;
+  size_t bytes_ = 0;
+  size_t size_ = 0;
+  npy::Header header_;
+};
+
+SWNUMERIC_END
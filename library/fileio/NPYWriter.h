@@ -0,0 +1,322 @@
+#pragma once
+#include <fcntl.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include <bit>
+#include <concepts>
+#include <cassert>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <initializer_list>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <type_traits>
+#include <vector>
+
+#include "library/dispatch/Namespace.h"
+#include "library/expression/Expression.h"
+#include "library/memory/AlignedAllocator.h"
+
+SWNUMERIC_BEGIN
+
+//
+// Binary output in the NumPy .npy format (version 1.0): a short text header
+// describing dtype, shape and order, followed by the raw row-major elements.
+// Arrays are written from data() with no formatting and load directly with
+// numpy.load() or numpy.memmap().
+//
+// npy_write(path, x) writes one Vector, Matrix or view.
+//
+// NPYWriter<T> writes a time series of equally shaped frames to one file of
+// shape (frames, frame_shape...). The header is padded so the frame count can
+// always be rewritten in place; flush() does so, leaving a valid file after
+// every call. With direct = true the header is padded to direct_alignment
+// and frames whose address and size are multiples of it (e.g. from
+// HugePageAllocator) bypass the page cache with O_DIRECT.
+//
+
+namespace npy {
+
+inline constexpr size_t direct_alignment = 4096;
+
+template <typename T>
+std::string descr() {
+  static_assert(std::is_arithmetic_v<T>, "npy supports arithmetic types.");
+  if constexpr (std::is_same_v<T, bool>) {
+    return "|b1";
+  } else {
+    char order = std::endian::native == std::endian::little ? '<' : '>';
+    if (sizeof(T) == 1) order = '|';
+    char kind = std::is_signed_v<T> ? 'i' : 'u';
+    if (std::is_floating_point_v<T>) kind = 'f';
+    return std::string{order, kind} + std::to_string(sizeof(T));
+  }
+}
+
+// Magic, version, header length and the dict, padded with spaces to a multiple
+// of `align` bytes (at least `min_size`).
+template <typename T>
+std::string header(const std::vector<size_t>& shape, size_t align = 64,
+                   size_t min_size = 0) {
+  std::string dict = "{'descr': '" + descr<T>() +
+                     "', 'fortran_order': False, 'shape': (";
+  for (size_t i = 0; i < shape.size(); i++) {
+    if (i > 0) dict += ", ";
+    dict += std::to_string(shape[i]);
+  }
+  if (shape.size() == 1) dict += ",";
+  dict += "), }";
+
+  constexpr size_t prefix = 10;
+  size_t total = prefix + dict.size() + 1;
+  total = std::max(total, min_size);
+  total = (total + align - 1) / align * align;
+  dict.resize(total - prefix - 1, ' ');
+  dict += '\n';
+
+  const size_t len = dict.size();
+  assert(len <= 0xffff);
+  std::string h = "\x93NUMPY";
+  h += char(1);
+  h += char(0);
+  h += char(len & 0xff);
+  h += char(len >> 8);
+  return h + dict;
+}
+
+template <typename E>
+std::vector<size_t> shape_of(const E& x) {
+  if constexpr (MatrixExpr<E>) {
+    return {x.rows(), x.cols()};
+  } else {
+    return {x.size()};
+  }
+}
+
+// leaves storing T elements: Vector, Matrix, StaticVector, views
+template <typename V, typename T>
+concept StorageOf = requires(const V& v) {
+  { v.data() } -> std::convertible_to<const T*>;
+  { v.size() } -> std::convertible_to<size_t>;
+};
+
+[[noreturn]] inline void throw_errno(const char* what) {
+  throw std::system_error(errno, std::generic_category(), what);
+}
+
+// Writes all of iov at offset, retrying short writes and EINTR.
+inline void pwritev_all(int fd, iovec* iov, int n, off_t offset) {
+  while (n > 0) {
+    const ssize_t w = ::pwritev(fd, iov, n, offset);
+    if (w < 0) {
+      if (errno == EINTR) continue;
+      throw_errno("npy write failed");
+    }
+    offset += w;
+    for (size_t left = static_cast<size_t>(w); n > 0 && left > 0;) {
+      if (left < iov->iov_len) {
+        iov->iov_base = static_cast<char*>(iov->iov_base) + left;
+        iov->iov_len -= left;
+        left = 0;
+      } else {
+        left -= iov->iov_len;
+        iov++;
+        n--;
+      }
+    }
+    while (n > 0 && iov->iov_len == 0) {
+      iov++;
+      n--;
+    }
+  }
+}
+
+inline int open_for_write(const std::filesystem::path& path) {
+  const int fd =
+      ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (fd < 0) {
+    throw std::runtime_error("Failed to open file: " + path.string());
+  }
+  return fd;
+}
+
+}  // namespace npy
+
+// Writes a vector, matrix or view as a single .npy array, header and data in
+// one writev. Strided and padded views are gathered into a buffer first.
+template <typename V>
+  requires ExprLike<V> && requires(const V& v) { v.data(); }
+void npy_write(const std::filesystem::path& path, const V& x) {
+  using T = typename V::value_type;
+  std::vector<T, AlignedAllocator<T>> gathered;
+  const T* data = x.data();
+  if (!is_contiguous(x)) {
+    gathered.resize(x.size());
+    evaluate(gathered.data(), x, 0, x.size());
+    data = gathered.data();
+  }
+  const std::string h = npy::header<T>(npy::shape_of(x));
+  const int fd = npy::open_for_write(path);
+  iovec iov[2] = {{const_cast<char*>(h.data()), h.size()},
+                  {const_cast<T*>(data), x.size() * sizeof(T)}};
+  try {
+    npy::pwritev_all(fd, iov, 2, 0);
+  } catch (...) {
+    ::close(fd);
+    throw;
+  }
+  ::close(fd);
+}
+
+template <typename T>
+class NPYWriter {
+ public:
+  NPYWriter(const std::filesystem::path& path, std::vector<size_t> frame_shape,
+            bool direct = false)
+      : frame_shape_(std::move(frame_shape)),
+        fd_(npy::open_for_write(path)),
+        direct_(direct) {
+    frame_size_ = 1;
+    for (size_t d : frame_shape_) frame_size_ *= d;
+    // room for any frame count, so rewriting it never moves the data
+    std::vector<size_t> widest = file_shape();
+    widest[0] = SIZE_MAX;
+    const size_t align = direct_ ? npy::direct_alignment : 64;
+    header_size_ = npy::header<T>(widest, align).size();
+    offset_ = header_size_;
+    write_header();
+  }
+  NPYWriter(const std::filesystem::path& path,
+            std::initializer_list<size_t> frame_shape, bool direct = false)
+      : NPYWriter(path, std::vector<size_t>(frame_shape), direct) {}
+
+  NPYWriter(const NPYWriter&) = delete;
+  NPYWriter& operator=(const NPYWriter&) = delete;
+
+  ~NPYWriter() {
+    try {
+      flush();
+    } catch (...) {
+    }
+    ::close(fd_);
+  }
+
+  size_t frames() const noexcept { return frames_; }
+  size_t frame_size() const noexcept { return frame_size_; }
+
+  void append(const T* frame) {
+    iovec iov{const_cast<T*>(frame), frame_size_ * sizeof(T)};
+    write_frame(&iov, 1);
+  }
+
+  // One frame gathered from parts whose sizes add up to frame_size(), e.g.
+  // the state vectors of a system; a single pwritev. Strided parts are
+  // copied into the staging buffer instead.
+  template <npy::StorageOf<T>... Parts>
+    requires(sizeof...(Parts) > 0)
+  void append(const Parts&... parts) {
+    assert((parts.size() + ...) == frame_size_);
+    if (!(is_contiguous(parts) && ...)) {
+      staging_.resize(frame_size_);
+      size_t offset = 0;
+      ((evaluate_into(staging_.data() + offset, parts, 0, parts.size()),
+        offset += parts.size()),
+       ...);
+      append(staging_.data());
+      return;
+    }
+    iovec iov[] = {{const_cast<T*>(static_cast<const T*>(parts.data())),
+                    parts.size() * sizeof(T)}...};
+    write_frame(iov, sizeof...(Parts));
+  }
+
+  // A lazy expression is evaluated into a reused staging buffer first.
+  template <ExprLike E>
+    requires(!requires(const E& e) { e.data(); })
+  void append(const E& e) {
+    assert(e.size() == frame_size_);
+    staging_.resize(frame_size_);
+    evaluate(staging_.data(), e, 0, frame_size_);
+    append(staging_.data());
+  }
+
+  // Rewrites the header with the current frame count.
+  void flush() { write_header(); }
+
+  // flush() and wait for the data to reach the device.
+  void sync() {
+    flush();
+    if (::fsync(fd_) != 0) npy::throw_errno("npy fsync failed");
+  }
+
+ private:
+  std::vector<size_t> frame_shape_;
+  size_t frame_size_ = 0;
+  int fd_;
+  bool direct_;
+  bool direct_on_ = false;
+  size_t header_size_ = 0;
+  size_t frames_ = 0;
+  off_t offset_ = 0;
+  std::vector<T, AlignedAllocator<T>> staging_;
+
+  std::vector<size_t> file_shape() const {
+    std::vector<size_t> shape{frames_};
+    shape.insert(shape.end(), frame_shape_.begin(), frame_shape_.end());
+    return shape;
+  }
+
+  void write_header() {
+    const size_t align = direct_ ? npy::direct_alignment : 64;
+    std::string h = npy::header<T>(file_shape(), align, header_size_);
+    assert(h.size() == header_size_);
+    set_direct(false);
+    iovec iov{h.data(), h.size()};
+    npy::pwritev_all(fd_, &iov, 1, 0);
+  }
+
+  void write_frame(iovec* iov, int n) {
+    set_direct(direct_ && aligned(iov, n));
+    npy::pwritev_all(fd_, iov, n, offset_);
+    offset_ += static_cast<off_t>(frame_size_ * sizeof(T));
+    frames_++;
+  }
+
+  bool aligned(const iovec* iov, int n) const noexcept {
+    constexpr size_t a = npy::direct_alignment;
+    if (offset_ % a != 0) return false;
+    for (int i = 0; i < n; i++) {
+      if (reinterpret_cast<uintptr_t>(iov[i].iov_base) % a != 0 ||
+          iov[i].iov_len % a != 0) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  // Toggles O_DIRECT on the descriptor; filesystems that refuse it fall back
+  // to buffered writes for the rest of the file.
+  void set_direct(bool on) {
+#ifdef O_DIRECT
+    if (on == direct_on_) return;
+    const int flags = ::fcntl(fd_, F_GETFL);
+    if (flags < 0 ||
+        ::fcntl(fd_, F_SETFL, on ? flags | O_DIRECT : flags & ~O_DIRECT) < 0) {
+      if (on) {
+        direct_ = false;
+        return;
+      }
+      npy::throw_errno("npy fcntl failed");
+    }
+    direct_on_ = on;
+#else
+    (void)on;
+#endif
+  }
+};
+
+SWNUMERIC_END
@@ -0,0 +1,261 @@
+#pragma once
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cassert>
+#include <cerrno>
+#include <concepts>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "library/dispatch/Namespace.h"
+#include "library/fileio/SeriesWriter.h"
+#include "library/vectormatrix/Vector.h"
+
+SWNUMERIC_BEGIN
+
+//
+// Random access to the steps of a SeriesWriter file. Opening reads the
+// header and the chunk index; read(step, x) then reads the one chunk holding
+// the step and decodes it up to that step. The chunk and the decoder state
+// are kept, so reading steps in increasing order decodes each one once.
+//
+// A file whose writer stopped before writing the index is opened by walking
+// the chunk headers instead, and holds the chunks completed until then.
+//
+
+template <std::floating_point T>
+class SeriesReader {
+ public:
+  explicit SeriesReader(const std::filesystem::path& path) {
+    fd_ = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd_ < 0) {
+      throw std::runtime_error("Failed to open file: " + path.string());
+    }
+    try {
+      struct stat st;
+      if (::fstat(fd_, &st) != 0) npy::throw_errno("series stat failed");
+      bytes_ = static_cast<size_t>(st.st_size);
+      read_header();
+      if (!read_index()) scan_chunks();
+    } catch (...) {
+      ::close(fd_);
+      throw;
+    }
+  }
+
+  SeriesReader(const SeriesReader&) = delete;
+  SeriesReader& operator=(const SeriesReader&) = delete;
+
+  ~SeriesReader() { ::close(fd_); }
+
+  size_t steps() const noexcept { return steps_; }
+  size_t chunks() const noexcept { return index_.size(); }
+  size_t chunk_steps() const noexcept { return chunk_steps_; }
+  size_t frame_size() const noexcept { return frame_size_; }
+  const std::vector<size_t>& frame_shape() const noexcept {
+    return frame_shape_;
+  }
+
+  // Writes step to out[0, frame_size()).
+  void read(size_t step, T* out) {
+    seek(step);
+    if (frame_size_ != 0) {
+      std::memcpy(out, state_.prev.data(), frame_size_ * sizeof(T));
+    }
+  }
+
+  // Into a contiguous vector, matrix or view of frame_size() elements.
+  template <typename V>
+    requires requires(V& v) {
+      { v.data() } -> std::convertible_to<T*>;
+    }
+  void read(size_t step, V& out) {
+    assert(out.size() == frame_size_ && is_contiguous(out));
+    read(step, static_cast<T*>(out.data()));
+  }
+
+  Vector<T> read(size_t step) {
+    Vector<T> x(frame_size_, uninitialized);
+    read(step, x.data());
+    return x;
+  }
+
+ private:
+  struct Chunk {
+    uint64_t offset;
+    uint64_t first;
+    uint64_t steps;
+    uint64_t bytes;
+  };
+
+  int fd_ = -1;
+  size_t bytes_ = 0;
+  size_t data_offset_ = 0;
+  size_t chunk_steps_ = 0;
+  std::vector<size_t> frame_shape_;
+  size_t frame_size_ = 0;
+  size_t steps_ = 0;
+  std::vector<Chunk> index_;
+
+  // the chunk being decoded and the steps of it decoded so far
+  size_t chunk_ = SIZE_MAX;
+  size_t decoded_ = 0;
+  std::vector<uint64_t> words_;
+  series::BitReader bits_;
+  series::State<T> state_;
+
+  void pread_all(void* p, size_t n, size_t offset) const {
+    auto* c = static_cast<char*>(p);
+    while (n > 0) {
+      const ssize_t r = ::pread(fd_, c, n, static_cast<off_t>(offset));
+      if (r < 0) {
+        if (errno == EINTR) continue;
+        npy::throw_errno("series read failed");
+      }
+      if (r == 0) throw series::format_error("unexpected end of file");
+      c += r;
+      n -= static_cast<size_t>(r);
+      offset += static_cast<size_t>(r);
+    }
+  }
+
+  std::string read_bytes(size_t offset, size_t n) const {
+    if (offset > bytes_ || n > bytes_ - offset) {
+      throw series::format_error("unexpected end of file");
+    }
+    std::string s(n, '\0');
+    pread_all(s.data(), n, offset);
+    return s;
+  }
+
+  void read_header() {
+    using series::get;
+    constexpr size_t fixed = series::magic.size() + 12;
+    std::string h = read_bytes(0, fixed);
+    if (h.compare(0, series::magic.size(), series::magic) != 0) {
+      throw series::format_error("bad magic");
+    }
+    const char* p = h.data() + series::magic.size();
+    if (get<uint32_t>(p) != series::version) {
+      throw series::format_error("unsupported version");
+    }
+    chunk_steps_ = get<uint32_t>(p + 4);
+    const size_t len = get<uint32_t>(p + 8);
+    const std::string descr = read_bytes(fixed, len);
+    if (descr != npy::descr<T>()) {
+      throw series::format_error("dtype " + descr + ", expected " +
+                                 npy::descr<T>());
+    }
+    size_t at = fixed + len;
+    const size_t ndim = get<uint32_t>(read_bytes(at, 4).data());
+    at += 4;
+    const std::string dims = read_bytes(at, ndim * 8);
+    frame_size_ = 1;
+    for (size_t d = 0; d < ndim; d++) {
+      frame_shape_.push_back(get<uint64_t>(dims.data() + d * 8));
+      frame_size_ *= frame_shape_.back();
+    }
+    data_offset_ = at + ndim * 8;
+  }
+
+  // Chunk header at offset; steps == 0 if the chunk was never completed.
+  Chunk read_chunk_header(size_t offset, size_t first) const {
+    using series::get;
+    const std::string h = read_bytes(offset, series::chunk_header_size);
+    if (get<uint32_t>(h.data()) != series::chunk_magic) {
+      throw series::format_error("bad chunk header");
+    }
+    Chunk c{offset, first, get<uint32_t>(h.data() + 4),
+            get<uint64_t>(h.data() + 8)};
+    if (c.bytes % 8 != 0 ||
+        c.bytes > bytes_ - offset - series::chunk_header_size) {
+      throw series::format_error("chunk past the end of the file");
+    }
+    return c;
+  }
+
+  // false if the file ends without a consistent index
+  bool read_index() {
+    using series::get;
+    if (bytes_ < data_offset_ + series::trailer_size) return false;
+    const std::string t =
+        read_bytes(bytes_ - series::trailer_size, series::trailer_size);
+    if (t.compare(24, 8, series::index_magic) != 0) return false;
+    const uint64_t n = get<uint64_t>(t.data());
+    const uint64_t steps = get<uint64_t>(t.data() + 8);
+    const uint64_t at = get<uint64_t>(t.data() + 16);
+    if (at < data_offset_ || n > (bytes_ - at) / 16 ||
+        at + n * 16 + series::trailer_size != bytes_) {
+      return false;
+    }
+    const std::string entries = read_bytes(at, n * 16);
+    for (size_t k = 0; k < n; k++) {
+      const uint64_t offset = get<uint64_t>(entries.data() + k * 16);
+      const uint64_t first = get<uint64_t>(entries.data() + k * 16 + 8);
+      if (offset >= at || first != (k == 0 ? 0 : index_.back().first +
+                                                      index_.back().steps)) {
+        throw series::format_error("inconsistent index");
+      }
+      index_.push_back(read_chunk_header(offset, first));
+    }
+    steps_ = index_.empty() ? 0 : index_.back().first + index_.back().steps;
+    if (steps_ != steps) throw series::format_error("inconsistent index");
+    return true;
+  }
+
+  // Collects the completed chunks from the start of the data.
+  void scan_chunks() {
+    size_t offset = data_offset_;
+    while (offset + series::chunk_header_size <= bytes_) {
+      Chunk c;
+      try {
+        c = read_chunk_header(offset, steps_);
+      } catch (const std::runtime_error&) {
+        break;
+      }
+      if (c.steps == 0) break;
+      index_.push_back(c);
+      steps_ += c.steps;
+      offset += series::chunk_header_size + c.bytes;
+    }
+  }
+
+  // Decodes up to step, leaving its values in state_.prev.
+  void seek(size_t step) {
+    if (step >= steps_) throw std::out_of_range("series step out of range");
+    const auto it = std::upper_bound(
+        index_.begin(), index_.end(), step,
+        [](size_t s, const Chunk& c) { return s < c.first; });
+    const size_t k = static_cast<size_t>(it - index_.begin()) - 1;
+    const Chunk& c = index_[k];
+    const size_t target = step - c.first + 1;
+    if (k != chunk_) {
+      words_.resize(c.bytes / 8);
+      pread_all(words_.data(), c.bytes, c.offset + series::chunk_header_size);
+      chunk_ = k;
+      decoded_ = 0;
+    }
+    if (decoded_ > target) decoded_ = 0;  // behind: start the chunk again
+    if (decoded_ == 0) {
+      bits_ = series::BitReader(words_.data(), words_.size());
+      state_.reset(frame_size_);
+    }
+    try {
+      for (; decoded_ < target; decoded_++) state_.decode(bits_);
+    } catch (...) {
+      chunk_ = SIZE_MAX;
+      throw;
+    }
+  }
+};
+
+SWNUMERIC_END
@@ -0,0 +1,535 @@
+#pragma once
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <bit>
+#include <cassert>
+#include <cerrno>
+#include <concepts>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <exception>
+#include <filesystem>
+#include <initializer_list>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "library/dispatch/Namespace.h"
+#include "library/expression/Expression.h"
+#include "library/fileio/NPYWriter.h"
+#include "library/instrument/Instrument.h"
+#include "library/memory/AlignedAllocator.h"
+
+SWNUMERIC_BEGIN
+
+//
+// Compressed time series of equally shaped float or double frames, e.g. the
+// state vector of a simulation after every step:
+//
+//   SeriesWriter<double> out("state.sws", {x.size()});
+//   for (size_t step = 0; step < steps; step++) {
+//     advance(x);
+//     out.append(x);
+//   }
+//
+// and SeriesReader<double>("state.sws").read(step, x) to load one back.
+//
+// Each element is encoded against its value in the previous step as in
+// Gorilla (Pelkonen et al., VLDB 2015): the XOR of the two bit patterns is
+// written as a single 0 bit when nothing changed, and otherwise as its
+// meaningful bits, reusing the previous leading/trailing zero window when the
+// new bits fit inside it. Values that change slowly or not at all shrink the
+// most; the encoding is lossless, so noise in the low mantissa bits is kept
+// and costs its full width.
+//
+// Steps are grouped into chunks of chunk_steps, each encoded independently,
+// and an index of the chunks at the end of the file lets a reader seek to
+// any step and decode at most chunk_steps frames to reach it.
+//
+// append() copies (or evaluates) the frame into a block of steps on the
+// calling thread; full blocks are handed to a background thread that
+// encodes and writes them, blocking the producer only while queue_depth
+// blocks are already waiting. flush() hands over a partial block. sync()
+// waits for everything queued, closes the current chunk, writes the index
+// and fsync()s, leaving a complete file; the destructor does the same
+// without the fsync(). If the program stops before that, the reader
+// recovers the chunks completed so far from their headers. Errors from the
+// encoder thread are rethrown by the next append(), flush() or sync().
+//
+// File layout, in native byte order:
+//
+//   "SWSERIES" u32 version u32 chunk_steps u32 len dtype[len] (.npy descr)
+//   u32 ndim u64 shape[ndim]
+//   per chunk: u32 "SWSC" u32 steps u64 bytes, then the bit stream as bytes
+//     / 8 u64 words, most significant bit first
+//   per chunk: u64 offset u64 first step
+//   u64 chunks u64 steps u64 index offset "SWSINDEX"
+//
+
+namespace series {
+
+inline constexpr std::string_view magic = "SWSERIES";
+inline constexpr std::string_view index_magic = "SWSINDEX";
+inline constexpr uint32_t chunk_magic = 0x43535753;  // "SWSC"
+inline constexpr uint32_t version = 1;
+inline constexpr size_t chunk_header_size = 16;
+inline constexpr size_t trailer_size = 32;
+
+// Raw-frame bytes per block handed to the encoder thread.
+inline constexpr size_t block_bytes = size_t{1} << 20;
+
+template <typename U>
+void put(std::string& s, U v) {
+  s.append(reinterpret_cast<const char*>(&v), sizeof(U));
+}
+
+template <typename U>
+U get(const char* p) noexcept {
+  U v;
+  std::memcpy(&v, p, sizeof(U));
+  return v;
+}
+
+inline std::runtime_error format_error(const std::string& what) {
+  return std::runtime_error("Invalid series file: " + what);
+}
+
+// bit pattern of a T
+template <typename T>
+using bits_t = std::conditional_t<sizeof(T) == 8, uint64_t, uint32_t>;
+
+// Appends bit fields most significant bit first; full words go to words.
+class BitWriter {
+ public:
+  std::vector<uint64_t> words;
+
+  // the low n bits of v, 1 <= n <= 64, v < 2^n
+  void put(uint64_t v, unsigned n) noexcept {
+    const unsigned room = 64 - fill_;
+    if (n < room) {
+      acc_ |= v << (room - n);
+      fill_ += n;
+      return;
+    }
+    words.push_back(acc_ | v >> (n - room));
+    fill_ = n - room;
+    acc_ = fill_ > 0 ? v << (64 - fill_) : 0;
+  }
+
+  // Pads the last word with zero bits.
+  void finish() {
+    if (fill_ > 0) words.push_back(acc_);
+    acc_ = 0;
+    fill_ = 0;
+  }
+
+ private:
+  uint64_t acc_ = 0;
+  unsigned fill_ = 0;
+};
+
+class BitReader {
+ public:
+  BitReader() = default;
+  BitReader(const uint64_t* words, size_t n) noexcept
+      : next_(words), end_(words + n) {}
+
+  // n bits, 1 <= n <= 64
+  uint64_t get(unsigned n) {
+    if (n <= left_) {
+      const uint64_t v = acc_ >> (64 - n);
+      acc_ = n < 64 ? acc_ << n : 0;
+      left_ -= n;
+      return v;
+    }
+    if (next_ == end_) throw format_error("truncated chunk");
+    const unsigned need = n - left_;
+    const uint64_t high = left_ > 0 ? acc_ >> (64 - left_) : 0;
+    const uint64_t w = *next_++;
+    acc_ = need < 64 ? w << need : 0;
+    left_ = 64 - need;
+    return need < 64 ? high << need | w >> (64 - need) : w;
+  }
+
+ private:
+  const uint64_t* next_ = nullptr;
+  const uint64_t* end_ = nullptr;
+  uint64_t acc_ = 0;
+  unsigned left_ = 0;
+};
+
+// Per-element encoding state: the previous value and its zero window.
+// lead == no_window until the element first changes in a chunk.
+template <typename T>
+struct State {
+  using U = bits_t<T>;
+  static constexpr unsigned width = sizeof(U) * 8;
+  static constexpr unsigned lead_bits = 5;
+  static constexpr unsigned length_bits = width == 64 ? 6 : 5;
+  static constexpr uint8_t no_window = 0xff;
+
+  std::vector<U> prev;
+  std::vector<uint8_t> lead, trail;
+
+  void reset(size_t n) {
+    prev.assign(n, 0);
+    lead.assign(n, no_window);
+    trail.assign(n, 0);
+  }
+
+  void encode(const T* frame, BitWriter& out) {
+    const size_t n = prev.size();
+    for (size_t i = 0; i < n; i++) {
+      const U cur = std::bit_cast<U>(frame[i]);
+      const U x = cur ^ prev[i];
+      prev[i] = cur;
+      if (x == 0) {
+        out.put(0, 1);
+        continue;
+      }
+      const unsigned lz =
+          std::min<unsigned>(std::countl_zero(x), (1u << lead_bits) - 1);
+      const unsigned tz = std::countr_zero(x);
+      if (lz >= lead[i] && tz >= trail[i]) {
+        out.put(0b10, 2);
+        out.put(x >> trail[i], width - lead[i] - trail[i]);
+      } else {
+        const unsigned m = width - lz - tz;
+        out.put(0b11u << (lead_bits + length_bits) | lz << length_bits |
+                    (m - 1),
+                2 + lead_bits + length_bits);
+        out.put(x >> tz, m);
+        lead[i] = static_cast<uint8_t>(lz);
+        trail[i] = static_cast<uint8_t>(tz);
+      }
+    }
+  }
+
+  // Advances prev to the next step.
+  void decode(BitReader& in) {
+    const size_t n = prev.size();
+    for (size_t i = 0; i < n; i++) {
+      if (in.get(1) == 0) continue;
+      if (in.get(1) == 0) {
+        if (lead[i] == no_window) throw format_error("corrupt chunk");
+        const unsigned m = width - lead[i] - trail[i];
+        prev[i] ^= static_cast<U>(in.get(m) << trail[i]);
+        continue;
+      }
+      const auto h = static_cast<unsigned>(in.get(lead_bits + length_bits));
+      const unsigned lz = h >> length_bits;
+      const unsigned m = (h & ((1u << length_bits) - 1)) + 1;
+      if (lz + m > width) throw format_error("corrupt chunk");
+      const unsigned tz = width - lz - m;
+      prev[i] ^= static_cast<U>(in.get(m) << tz);
+      lead[i] = static_cast<uint8_t>(lz);
+      trail[i] = static_cast<uint8_t>(tz);
+    }
+  }
+};
+
+}  // namespace series
+
+template <std::floating_point T>
+class SeriesWriter {
+  static_assert(std::is_same_v<T, float> || std::is_same_v<T, double>,
+                "series files hold float or double frames");
+
+ public:
+  SeriesWriter(const std::filesystem::path& path,
+               std::vector<size_t> frame_shape, size_t chunk_steps = 64,
+               size_t queue_depth = 1)
+      : frame_shape_(std::move(frame_shape)),
+        chunk_steps_(std::max<size_t>(chunk_steps, 1)),
+        queue_depth_(std::max<size_t>(queue_depth, 1)),
+        fd_(npy::open_for_write(path)) {
+    assert(chunk_steps_ <= UINT32_MAX);
+    frame_size_ = 1;
+    for (size_t d : frame_shape_) frame_size_ *= d;
+    const size_t frame_bytes = std::max<size_t>(frame_size_ * sizeof(T), 1);
+    block_steps_ = std::clamp<size_t>(series::block_bytes / frame_bytes, 1,
+                                      chunk_steps_);
+    block_.values.resize(block_steps_ * frame_size_);
+    state_.reset(frame_size_);
+    try {
+      write_header();
+    } catch (...) {
+      ::close(fd_);
+      throw;
+    }
+    encoder_ = std::thread([this] { encoder_loop(); });
+  }
+  SeriesWriter(const std::filesystem::path& path,
+               std::initializer_list<size_t> frame_shape,
+               size_t chunk_steps = 64, size_t queue_depth = 1)
+      : SeriesWriter(path, std::vector<size_t>(frame_shape), chunk_steps,
+                     queue_depth) {}
+
+  SeriesWriter(const SeriesWriter&) = delete;
+  SeriesWriter& operator=(const SeriesWriter&) = delete;
+
+  ~SeriesWriter() {
+    try {
+      hand_off(true);
+    } catch (...) {
+    }
+    {
+      std::lock_guard<std::mutex> lk(mutex_);
+      stop_ = true;
+    }
+    ready_.notify_one();
+    encoder_.join();
+    try {
+      // a chunk left open means the encoder failed; keep what it completed
+      if (chunk_fill_ == 0) write_index();
+    } catch (...) {
+    }
+    ::close(fd_);
+  }
+
+  size_t steps() const noexcept { return steps_; }
+  size_t frame_size() const noexcept { return frame_size_; }
+  const std::vector<size_t>& frame_shape() const noexcept {
+    return frame_shape_;
+  }
+
+  void append(const T* frame) {
+    if (frame_size_ != 0) {
+      std::memcpy(next_frame(), frame, frame_size_ * sizeof(T));
+    }
+    appended();
+  }
+
+  // A vector, matrix, view or expression of frame_size() elements, evaluated
+  // straight into the block.
+  template <ExprLike E>
+    requires std::same_as<typename E::value_type, T>
+  void append(const E& e) {
+    assert(e.size() == frame_size_);
+    evaluate(next_frame(), e, 0, frame_size_);
+    appended();
+  }
+
+  // Hands the steps appended so far to the encoder thread.
+  void flush() { hand_off(false); }
+
+  // Waits for every step to be written, ends the current chunk, writes the
+  // index and fsync()s; the file is complete and readable afterwards.
+  void sync() {
+    hand_off(true);
+    {
+      std::unique_lock<std::mutex> lk(mutex_);
+      space_.wait(lk, [this] { return queue_.empty() && !encoding_; });
+      rethrow_error();
+    }
+    write_index();
+    if (::fsync(fd_) != 0) npy::throw_errno("series fsync failed");
+  }
+
+ private:
+  struct Block {
+    std::vector<T, AlignedAllocator<T>> values;
+    size_t steps = 0;
+    bool end_chunk = false;
+  };
+  struct Entry {
+    uint64_t offset;
+    uint64_t first;
+  };
+
+  std::vector<size_t> frame_shape_;
+  size_t frame_size_ = 0;
+  size_t chunk_steps_;
+  size_t block_steps_ = 1;
+  size_t queue_depth_;
+  int fd_;
+  size_t steps_ = 0;
+  Block block_;
+
+  // owned by the encoder thread, and by sync() and the destructor once it
+  // is idle
+  series::State<T> state_;
+  series::BitWriter bits_;
+  std::vector<Entry> index_;
+  size_t chunk_fill_ = 0;  // steps in the open chunk, 0 if none is open
+  size_t encoded_ = 0;
+  off_t chunk_offset_ = 0;
+  off_t offset_ = 0;
+  bool index_written_ = false;
+
+  // queue_, spare_, encoding_, stop_ and error_ are guarded by mutex_
+  std::thread encoder_;
+  std::mutex mutex_;
+  std::condition_variable ready_;
+  std::condition_variable space_;
+  std::deque<Block> queue_;
+  std::vector<Block> spare_;
+  bool encoding_ = false;
+  bool stop_ = false;
+  std::exception_ptr error_;
+
+  void rethrow_error() {
+    if (error_) std::rethrow_exception(std::exchange(error_, nullptr));
+  }
+
+  T* next_frame() noexcept {
+    return block_.values.data() + block_.steps * frame_size_;
+  }
+
+  void appended() {
+    steps_++;
+    if (++block_.steps == block_steps_) hand_off(false);
+  }
+
+  // Queues the current block, ending the open chunk after it if end_chunk.
+  void hand_off(bool end_chunk) {
+    std::unique_lock<std::mutex> lk(mutex_);
+    rethrow_error();
+    if (block_.steps == 0 && !end_chunk) return;
+    space_.wait(lk, [this] { return queue_.size() < queue_depth_; });
+    block_.end_chunk = end_chunk;
+    queue_.push_back(std::move(block_));
+    if (!spare_.empty()) {
+      block_ = std::move(spare_.back());
+      spare_.pop_back();
+    } else {
+      block_ = Block{};
+      block_.values.resize(block_steps_ * frame_size_);
+    }
+    block_.steps = 0;
+    lk.unlock();
+    ready_.notify_one();
+  }
+
+  // Encodes the queue until stopped; blocks are recycled through spare_.
+  void encoder_loop() {
+    std::unique_lock<std::mutex> lk(mutex_);
+    for (;;) {
+      ready_.wait(lk, [this] { return stop_ || !queue_.empty(); });
+      if (queue_.empty()) return;
+      Block block = std::move(queue_.front());
+      queue_.pop_front();
+      encoding_ = true;
+      lk.unlock();
+      space_.notify_all();
+
+      std::exception_ptr err;
+      try {
+        encode(block);
+      } catch (...) {
+        err = std::current_exception();
+      }
+
+      lk.lock();
+      if (err && !error_) error_ = err;
+      spare_.push_back(std::move(block));
+      encoding_ = false;
+      space_.notify_all();
+    }
+  }
+
+  void encode(const Block& block) {
+    const instrument::Region region("SeriesWriter::encode");
+    const instrument::Timer timer(instrument::Counter::series_ns);
+    for (size_t s = 0; s < block.steps; s++) {
+      if (chunk_fill_ == 0) open_chunk();
+      state_.encode(block.values.data() + s * frame_size_, bits_);
+      encoded_++;
+      if (++chunk_fill_ == chunk_steps_) close_chunk();
+    }
+    write_words();
+    if (block.end_chunk && chunk_fill_ > 0) close_chunk();
+    instrument::add(instrument::Counter::series_in_bytes,
+                    block.steps * frame_size_ * sizeof(T));
+  }
+
+  // Starts a chunk at offset_ with a header that marks it incomplete until
+  // close_chunk() rewrites it.
+  void open_chunk() {
+    if (index_written_) {
+      // so a reader never sees the old index behind an unfinished chunk
+      if (::ftruncate(fd_, offset_) != 0) {
+        npy::throw_errno("series truncate failed");
+      }
+      index_written_ = false;
+    }
+    chunk_offset_ = offset_;
+    index_.push_back({static_cast<uint64_t>(offset_), encoded_});
+    write_chunk_header(0, 0);
+    offset_ += series::chunk_header_size;
+    state_.reset(frame_size_);
+  }
+
+  void close_chunk() {
+    bits_.finish();
+    write_words();
+    const auto bytes = static_cast<uint64_t>(offset_ - chunk_offset_) -
+                       series::chunk_header_size;
+    write_chunk_header(static_cast<uint32_t>(chunk_fill_), bytes);
+    chunk_fill_ = 0;
+    instrument::add(instrument::Counter::series_chunks, 1);
+  }
+
+  void write_chunk_header(uint32_t steps, uint64_t bytes) {
+    std::string h;
+    series::put(h, series::chunk_magic);
+    series::put(h, steps);
+    series::put(h, bytes);
+    iovec iov{h.data(), h.size()};
+    npy::pwritev_all(fd_, &iov, 1, chunk_offset_);
+  }
+
+  // Writes the complete words of the open chunk.
+  void write_words() {
+    std::vector<uint64_t>& w = bits_.words;
+    if (w.empty()) return;
+    iovec iov{w.data(), w.size() * sizeof(uint64_t)};
+    npy::pwritev_all(fd_, &iov, 1, offset_);
+    offset_ += static_cast<off_t>(iov.iov_len);
+    instrument::add(instrument::Counter::series_bytes, iov.iov_len);
+    w.clear();
+  }
+
+  void write_header() {
+    const std::string descr = npy::descr<T>();
+    std::string h(series::magic);
+    series::put(h, series::version);
+    series::put(h, static_cast<uint32_t>(chunk_steps_));
+    series::put(h, static_cast<uint32_t>(descr.size()));
+    h += descr;
+    series::put(h, static_cast<uint32_t>(frame_shape_.size()));
+    for (size_t d : frame_shape_) series::put(h, static_cast<uint64_t>(d));
+    iovec iov{h.data(), h.size()};
+    npy::pwritev_all(fd_, &iov, 1, 0);
+    offset_ = static_cast<off_t>(h.size());
+  }
+
+  // The index goes after the last complete chunk; the next chunk replaces it.
+  void write_index() {
+    assert(chunk_fill_ == 0);
+    std::string s;
+    for (const Entry& e : index_) {
+      series::put(s, e.offset);
+      series::put(s, e.first);
+    }
+    series::put(s, static_cast<uint64_t>(index_.size()));
+    series::put(s, static_cast<uint64_t>(encoded_));
+    series::put(s, static_cast<uint64_t>(offset_));
+    s += series::index_magic;
+    iovec iov{s.data(), s.size()};
+    npy::pwritev_all(fd_, &iov, 1, offset_);
+    index_written_ = true;
+  }
+};
+
+SWNUMERIC_END
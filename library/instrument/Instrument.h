@@ -0,0 +1,267 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <ostream>
+#include <string_view>
+#include <vector>
+
+#include "library/dispatch/Namespace.h"
+
+//
+// Optional counters for where the library spends its time.
+//
+// Compiled in with SWNUMERIC_INSTRUMENT=1 (CMake option SWNUMERIC_INSTRUMENT);
+// otherwise every hook is an empty inline function and snapshots read zero.
+// Each thread increments its own set of counters with relaxed single-writer
+// stores, so the hot path never contends. snapshot() sums the counters of all
+// threads, including those that have exited; thread_snapshot() reads only the
+// calling thread's. Counters only grow, so measure an interval as a
+// difference:
+//
+//   const auto before = instrument::snapshot();
+//   solve(...);
+//   std::cout << instrument::snapshot() - before;
+//
+// With SWNUMERIC_ITT=1 and <ittnotify.h> available, Region additionally marks
+// a task on the "swnumeric" ITT domain, so library calls show up as named
+// tasks on the VTune timeline. Regions cover BLAS calls, parallel assignment,
+// CSVWriter::flush() and the SeriesWriter encoder.
+//
+
+#ifndef SWNUMERIC_INSTRUMENT
+#define SWNUMERIC_INSTRUMENT 0
+#endif
+
+#if defined(SWNUMERIC_ITT) && SWNUMERIC_ITT && __has_include(<ittnotify.h>)
+#include <ittnotify.h>
+#define SWNUMERIC_ITT_TASKS 1
+#else
+#define SWNUMERIC_ITT_TASKS 0
+#endif
+
+SWNUMERIC_BEGIN
+
+namespace instrument {
+
+inline constexpr bool enabled = SWNUMERIC_INSTRUMENT;
+
+enum class Counter : size_t {
+  assign_calls,     // elementwise expression assignments
+  assign_elements,  // destination elements written by them
+  assign_bytes,     // destination plus streamed operand bytes
+  blas_calls,       // BLAS routines dispatched
+  blas_flops,       // nominal floating point operations of those calls
+  alloc_calls,      // AlignedAllocator / HugePageAllocator allocations
+  alloc_bytes,      // bytes requested by them
+  csv_flushes,      // CSVWriter::flush() calls
+  csv_rows,         // rows handed over by them
+  csv_bytes,        // bytes handed over by them
+  csv_flush_ns,     // wall time spent inside them
+  series_chunks,    // SeriesWriter chunks completed
+  series_in_bytes,  // frame bytes encoded by its encoder thread
+  series_bytes,     // encoded bytes written
+  series_ns,        // encoder thread time spent encoding and writing
+  count
+};
+
+inline constexpr size_t counter_count = static_cast<size_t>(Counter::count);
+
+constexpr std::string_view name(Counter c) noexcept {
+  constexpr std::string_view names[counter_count] = {
+      "assign_calls", "assign_elements", "assign_bytes", "blas_calls",
+      "blas_flops",   "alloc_calls",     "alloc_bytes",  "csv_flushes",
+      "csv_rows",     "csv_bytes",       "csv_flush_ns", "series_chunks",
+      "series_in_bytes", "series_bytes", "series_ns"};
+  return names[static_cast<size_t>(c)];
+}
+
+// Counter values at one point in time.
+struct Snapshot {
+  std::array<uint64_t, counter_count> values{};
+
+  constexpr uint64_t operator[](Counter c) const noexcept {
+    return values[static_cast<size_t>(c)];
+  }
+  constexpr uint64_t& operator[](Counter c) noexcept {
+    return values[static_cast<size_t>(c)];
+  }
+
+  constexpr Snapshot& operator+=(const Snapshot& o) noexcept {
+    for (size_t i = 0; i < counter_count; i++) values[i] += o.values[i];
+    return *this;
+  }
+  constexpr Snapshot& operator-=(const Snapshot& o) noexcept {
+    for (size_t i = 0; i < counter_count; i++) values[i] -= o.values[i];
+    return *this;
+  }
+  friend constexpr Snapshot operator+(Snapshot a, const Snapshot& b) noexcept {
+    return a += b;
+  }
+  friend constexpr Snapshot operator-(Snapshot a, const Snapshot& b) noexcept {
+    return a -= b;
+  }
+
+  // one "name value" line per nonzero counter
+  friend std::ostream& operator<<(std::ostream& os, const Snapshot& s) {
+    for (size_t i = 0; i < counter_count; i++) {
+      if (s.values[i] == 0) continue;
+      os << name(static_cast<Counter>(i)) << ' ' << s.values[i] << '\n';
+    }
+    return os;
+  }
+};
+
+#if SWNUMERIC_INSTRUMENT
+
+namespace detail {
+
+struct ThreadCounters;
+
+// Live threads' counters and the totals of threads that have exited.
+struct Registry {
+  std::mutex mutex;
+  std::vector<const ThreadCounters*> live;
+  Snapshot retired;
+
+  static Registry& get() {
+    static Registry r;
+    return r;
+  }
+};
+
+struct ThreadCounters {
+  std::array<std::atomic<uint64_t>, counter_count> values{};
+
+  ThreadCounters() {
+    Registry& r = Registry::get();
+    std::lock_guard<std::mutex> lk(r.mutex);
+    r.live.push_back(this);
+  }
+  ~ThreadCounters() {
+    Registry& r = Registry::get();
+    std::lock_guard<std::mutex> lk(r.mutex);
+    r.retired += read();
+    std::erase(r.live, this);
+  }
+  ThreadCounters(const ThreadCounters&) = delete;
+  ThreadCounters& operator=(const ThreadCounters&) = delete;
+
+  Snapshot read() const noexcept {
+    Snapshot s;
+    for (size_t i = 0; i < counter_count; i++) {
+      s.values[i] = values[i].load(std::memory_order_relaxed);
+    }
+    return s;
+  }
+};
+
+inline ThreadCounters& local() {
+  thread_local ThreadCounters counters;
+  return counters;
+}
+
+}  // namespace detail
+
+// Adds n to counter c of the calling thread.
+inline void add(Counter c, uint64_t n) noexcept {
+  std::atomic<uint64_t>& v = detail::local().values[static_cast<size_t>(c)];
+  v.store(v.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+}
+
+inline Snapshot thread_snapshot() { return detail::local().read(); }
+
+inline Snapshot snapshot() {
+  detail::Registry& r = detail::Registry::get();
+  std::lock_guard<std::mutex> lk(r.mutex);
+  Snapshot s = r.retired;
+  for (const detail::ThreadCounters* t : r.live) s += t->read();
+  return s;
+}
+
+// Adds the wall time of its lifetime, in nanoseconds, to a counter.
+class Timer {
+ public:
+  explicit Timer(Counter c) noexcept
+      : counter_(c), start_(std::chrono::steady_clock::now()) {}
+  ~Timer() {
+    const auto dt = std::chrono::steady_clock::now() - start_;
+    add(counter_,
+        std::chrono::duration_cast<std::chrono::nanoseconds>(dt).count());
+  }
+  Timer(const Timer&) = delete;
+  Timer& operator=(const Timer&) = delete;
+
+ private:
+  Counter counter_;
+  std::chrono::steady_clock::time_point start_;
+};
+
+#else
+
+inline void add(Counter, uint64_t) noexcept {}
+inline Snapshot thread_snapshot() { return {}; }
+inline Snapshot snapshot() { return {}; }
+
+class Timer {
+ public:
+  explicit Timer(Counter) noexcept {}
+  Timer(const Timer&) = delete;
+  Timer& operator=(const Timer&) = delete;
+};
+
+#endif
+
+// A named task on the ITT timeline for its lifetime; empty without ITT.
+class Region {
+ public:
+#if SWNUMERIC_ITT_TASKS
+  explicit Region(const char* name) noexcept {
+    __itt_task_begin(domain(), __itt_null, __itt_null,
+                     __itt_string_handle_create(name));
+  }
+  ~Region() { __itt_task_end(domain()); }
+#else
+  explicit Region(const char*) noexcept {}
+#endif
+  Region(const Region&) = delete;
+  Region& operator=(const Region&) = delete;
+
+ private:
+#if SWNUMERIC_ITT_TASKS
+  static __itt_domain* domain() noexcept {
+    static __itt_domain* d = __itt_domain_create("swnumeric");
+    return d;
+  }
+#endif
+};
+
+// A BLAS dispatch of the given nominal flop count: counted, and marked as a
+// Region named after the routine.
+class BlasCall {
+ public:
+  BlasCall(const char* routine, uint64_t flops) noexcept : region_(routine) {
+    add(Counter::blas_calls, 1);
+    add(Counter::blas_flops, flops);
+  }
+
+ private:
+  Region region_;
+};
+
+// Counts an elementwise assignment of n elements of T that streams `reads`
+// operands besides the destination.
+template <typename T>
+inline void count_assign(size_t n, size_t reads) noexcept {
+  add(Counter::assign_calls, 1);
+  add(Counter::assign_elements, n);
+  add(Counter::assign_bytes, n * sizeof(T) * (reads + 1));
+}
+
+}  // namespace instrument
+
+SWNUMERIC_END
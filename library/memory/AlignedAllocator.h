@@ -0,0 +1,164 @@
+#pragma once
+
+#include <sys/mman.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+#include "library/dispatch/Namespace.h"
+#include "library/instrument/Instrument.h"
+
+SWNUMERIC_BEGIN
+
+// Tag for constructors that skip value-initialization of their storage.
+struct uninitialized_t {
+  explicit uninitialized_t() = default;
+};
+inline constexpr uninitialized_t uninitialized{};
+
+// Alignment guaranteed by an allocator: its `alignment` member when present,
+// otherwise alignof(value_type).
+template <typename Alloc>
+constexpr size_t allocator_alignment() noexcept {
+  if constexpr (requires { Alloc::alignment; }) {
+    return Alloc::alignment;
+  } else {
+    return alignof(typename Alloc::value_type);
+  }
+}
+
+//
+// Allocator returning Align-byte aligned storage (one cache line by default).
+// construct() without arguments default-initializes, so containers sized with
+// it leave trivial types uninitialized; pass a value to get zeros.
+//
+
+template <typename T, size_t Align = 64>
+struct AlignedAllocator {
+  static_assert((Align & (Align - 1)) == 0, "Alignment must be a power of 2.");
+  static_assert(Align >= alignof(T), "Alignment must be at least alignof(T).");
+
+  using value_type = T;
+  static constexpr size_t alignment = Align;
+
+  template <typename U>
+  struct rebind {
+    using other = AlignedAllocator<U, Align>;
+  };
+
+  constexpr AlignedAllocator() noexcept = default;
+  template <typename U>
+  constexpr AlignedAllocator(const AlignedAllocator<U, Align>&) noexcept {}
+
+  T* allocate(size_t n) {
+    instrument::add(instrument::Counter::alloc_calls, 1);
+    instrument::add(instrument::Counter::alloc_bytes, n * sizeof(T));
+    return static_cast<T*>(
+        ::operator new(n * sizeof(T), std::align_val_t{Align}));
+  }
+  void deallocate(T* p, size_t n) noexcept {
+    ::operator delete(p, n * sizeof(T), std::align_val_t{Align});
+  }
+
+  template <typename U>
+  void construct(U* p) noexcept(std::is_nothrow_default_constructible_v<U>) {
+    ::new (static_cast<void*>(p)) U;
+  }
+  template <typename U, typename... Args>
+  void construct(U* p, Args&&... args) {
+    ::new (static_cast<void*>(p)) U(std::forward<Args>(args)...);
+  }
+
+  template <typename U>
+  constexpr bool operator==(const AlignedAllocator<U, Align>&) const noexcept {
+    return true;
+  }
+};
+
+//
+// Allocator for large buffers. Requests below Threshold bytes fall through to
+// AlignedAllocator; larger ones are mmap'd in whole huge pages, from the
+// hugetlbfs pool when one is configured (MAP_HUGETLB) and otherwise as a
+// 2 MiB aligned anonymous mapping marked MADV_HUGEPAGE for transparent huge
+// pages.
+//
+
+inline constexpr size_t huge_page_size = size_t{2} << 20;
+
+template <typename T, size_t Threshold = huge_page_size>
+struct HugePageAllocator {
+  using value_type = T;
+  static constexpr size_t alignment = 64;
+
+  template <typename U>
+  struct rebind {
+    using other = HugePageAllocator<U, Threshold>;
+  };
+
+  constexpr HugePageAllocator() noexcept = default;
+  template <typename U>
+  constexpr HugePageAllocator(const HugePageAllocator<U, Threshold>&) noexcept {
+  }
+
+  T* allocate(size_t n) {
+    const size_t bytes = n * sizeof(T);
+    if (bytes < Threshold) return AlignedAllocator<T, alignment>{}.allocate(n);
+
+    instrument::add(instrument::Counter::alloc_calls, 1);
+    instrument::add(instrument::Counter::alloc_bytes, bytes);
+    const size_t len = round_up(bytes);
+#ifdef MAP_HUGETLB
+    void* p = mmap(nullptr, len, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    if (p != MAP_FAILED) return static_cast<T*>(p);
+#endif
+
+    // over-map by one huge page and trim, so THP can back the whole range
+    void* raw = mmap(nullptr, len + huge_page_size, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (raw == MAP_FAILED) throw std::bad_alloc();
+    const uintptr_t base = reinterpret_cast<uintptr_t>(raw);
+    const uintptr_t aligned = round_up(base);
+    const size_t head = aligned - base;
+    if (head > 0) munmap(raw, head);
+    munmap(reinterpret_cast<void*>(aligned + len), huge_page_size - head);
+#ifdef MADV_HUGEPAGE
+    madvise(reinterpret_cast<void*>(aligned), len, MADV_HUGEPAGE);
+#endif
+    return reinterpret_cast<T*>(aligned);
+  }
+
+  void deallocate(T* p, size_t n) noexcept {
+    const size_t bytes = n * sizeof(T);
+    if (bytes < Threshold) {
+      AlignedAllocator<T, alignment>{}.deallocate(p, n);
+    } else {
+      munmap(p, round_up(bytes));
+    }
+  }
+
+  template <typename U>
+  void construct(U* p) noexcept(std::is_nothrow_default_constructible_v<U>) {
+    ::new (static_cast<void*>(p)) U;
+  }
+  template <typename U, typename... Args>
+  void construct(U* p, Args&&... args) {
+    ::new (static_cast<void*>(p)) U(std::forward<Args>(args)...);
+  }
+
+  template <typename U>
+  constexpr bool operator==(
+      const HugePageAllocator<U, Threshold>&) const noexcept {
+    return true;
+  }
+
+ private:
+  static constexpr size_t round_up(size_t x) noexcept {
+    return (x + huge_page_size - 1) & ~(huge_page_size - 1);
+  }
+};
+
+SWNUMERIC_END
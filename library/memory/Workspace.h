@@ -0,0 +1,184 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdlib>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "library/dispatch/Namespace.h"
+
+SWNUMERIC_BEGIN
+
+//
+// Bump-pointer arena for temporary workspaces.
+//
+// Allocations are carved from one 64-byte aligned block and are released
+// together by rewinding to a Marker (or by a Scope going out of scope).
+// Requests that do not fit spill into overflow blocks; when the arena is next
+// fully rewound it regrows its main block to the high-water mark, so a loop
+// with a stable working set stops calling malloc after its first iteration.
+//
+// A Workspace is not thread-safe; use one per thread, e.g. Workspace::local().
+//
+
+class Workspace {
+ public:
+  static constexpr size_t alignment = 64;
+
+  struct Marker {
+    size_t offset;
+    size_t overflow;
+  };
+
+  // Rewinds the workspace to where it was on construction.
+  class Scope {
+   public:
+    explicit Scope(Workspace& ws) noexcept : ws_(ws), mark_(ws.mark()) {}
+    Scope(const Scope&) = delete;
+    Scope& operator=(const Scope&) = delete;
+    ~Scope() { ws_.release(mark_); }
+
+   private:
+    Workspace& ws_;
+    Marker mark_;
+  };
+
+  explicit Workspace(size_t bytes = 0) { grow(bytes); }
+  Workspace(const Workspace&) = delete;
+  Workspace& operator=(const Workspace&) = delete;
+  ~Workspace() {
+    free_overflow(0);
+    std::free(block_);
+  }
+
+  // per-thread workspace
+  static Workspace& local() {
+    thread_local Workspace ws;
+    return ws;
+  }
+
+  void* allocate(size_t bytes) {
+    bytes = round_up(bytes);
+    if (overflow_.empty() && offset_ + bytes <= capacity_) {
+      void* p = static_cast<char*>(block_) + offset_;
+      offset_ += bytes;
+      track();
+      return p;
+    }
+    void* p = std::aligned_alloc(alignment, bytes);
+    if (!p) throw std::bad_alloc();
+    overflow_.emplace_back(p, bytes);
+    overflow_bytes_ += bytes;
+    track();
+    return p;
+  }
+
+  template <typename T>
+  T* allocate(size_t n) {
+    static_assert(alignof(T) <= alignment);
+    static_assert(std::is_trivially_destructible_v<T>,
+                  "Workspace never runs destructors.");
+    return static_cast<T*>(allocate(n * sizeof(T)));
+  }
+
+  Marker mark() const noexcept { return {offset_, overflow_.size()}; }
+
+  void release(Marker m) noexcept {
+    free_overflow(m.overflow);
+    offset_ = m.offset;
+    if (offset_ == 0 && high_water_ > capacity_) {
+      std::free(block_);
+      block_ = nullptr;
+      capacity_ = 0;
+      grow(high_water_);
+    }
+  }
+
+  void reset() noexcept { release({0, 0}); }
+
+  Scope scope() noexcept { return Scope(*this); }
+
+  size_t used() const noexcept { return offset_ + overflow_bytes_; }
+  size_t capacity() const noexcept { return capacity_; }
+  size_t high_water() const noexcept { return high_water_; }
+
+ private:
+  void* block_ = nullptr;
+  size_t capacity_ = 0;
+  size_t offset_ = 0;
+  size_t high_water_ = 0;
+  size_t overflow_bytes_ = 0;
+  std::vector<std::pair<void*, size_t>> overflow_;
+
+  static constexpr size_t round_up(size_t x) noexcept {
+    return (x + alignment - 1) & ~(alignment - 1);
+  }
+
+  void track() noexcept {
+    if (used() > high_water_) high_water_ = used();
+  }
+
+  void free_overflow(size_t keep) noexcept {
+    while (overflow_.size() > keep) {
+      std::free(overflow_.back().first);
+      overflow_bytes_ -= overflow_.back().second;
+      overflow_.pop_back();
+    }
+  }
+
+  // only called with no live allocations; on failure the workspace stays
+  // empty and later requests go through the overflow path
+  void grow(size_t bytes) noexcept {
+    bytes = round_up(bytes);
+    if (bytes == 0) return;
+    block_ = std::aligned_alloc(alignment, bytes);
+    capacity_ = block_ ? bytes : 0;
+  }
+};
+
+//
+// Allocator drawing from a Workspace, for containers that live inside a
+// Workspace::Scope. deallocate() is a no-op; storage is reclaimed when the
+// workspace is rewound, so the container must not outlive the scope.
+//
+
+template <typename T>
+struct WorkspaceAllocator {
+  using value_type = T;
+  static constexpr size_t alignment = Workspace::alignment;
+
+  template <typename U>
+  struct rebind {
+    using other = WorkspaceAllocator<U>;
+  };
+
+  Workspace* ws;
+
+  explicit WorkspaceAllocator(
+      Workspace& workspace = Workspace::local()) noexcept
+      : ws(&workspace) {}
+  template <typename U>
+  WorkspaceAllocator(const WorkspaceAllocator<U>& other) noexcept
+      : ws(other.ws) {}
+
+  T* allocate(size_t n) { return ws->allocate<T>(n); }
+  void deallocate(T*, size_t) noexcept {}
+
+  template <typename U>
+  void construct(U* p) noexcept(std::is_nothrow_default_constructible_v<U>) {
+    ::new (static_cast<void*>(p)) U;
+  }
+  template <typename U, typename... Args>
+  void construct(U* p, Args&&... args) {
+    ::new (static_cast<void*>(p)) U(std::forward<Args>(args)...);
+  }
+
+  template <typename U>
+  bool operator==(const WorkspaceAllocator<U>& other) const noexcept {
+    return ws == other.ws;
+  }
+};
+
+SWNUMERIC_END
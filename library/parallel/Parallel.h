@@ -0,0 +1,84 @@
+#pragma once
+
+#include <cassert>
+#include <cstddef>
+
+#include "library/dispatch/Namespace.h"
+#include "library/expression/Expression.h"
+#include "library/instrument/Instrument.h"
+#include "library/parallel/ThreadPool.h"
+
+SWNUMERIC_BEGIN
+
+//
+// Parallel execution policy for expression assignment.
+//
+//   assign(par, x, a + b);
+//
+// splits [0, x.size()) into one contiguous range per thread, with boundaries
+// on cache-line multiples so threads never share a destination line, and
+// evaluates each range with the packet kernel; a thread that finishes early
+// steals chunks of at least policy.grain elements from one that falls behind.
+// Below policy.threshold elements it runs serially. The initial split is a
+// pure function of the size and policy, so a buffer allocated with
+// `uninitialized` and then initialized by first_touch(par, x) has each page
+// first touched, and therefore placed on the NUMA node, of the thread that
+// later evaluates it, up to the chunks stolen under uneven load. Strided and
+// padded views are assigned serially.
+//
+
+struct ParallelPolicy {
+  size_t threshold = size_t{1} << 16;  // smallest size run in parallel
+  size_t grain = size_t{1} << 14;      // smallest range given to one thread
+  ThreadPool* pool = nullptr;          // nullptr selects ThreadPool::global()
+
+  ThreadPool& executor() const { return pool ? *pool : ThreadPool::global(); }
+};
+
+inline constexpr ParallelPolicy par{};
+
+// Calls f(b, e) over a split of [0, n) whose boundaries are 64-byte multiples
+// of T.
+template <typename T, typename F>
+void parallel_range(const ParallelPolicy& policy, size_t n, F&& f) {
+  if (n < policy.threshold) {
+    f(size_t{0}, n);
+    return;
+  }
+  constexpr size_t line = 64 / sizeof(T) > 0 ? 64 / sizeof(T) : 1;
+  policy.executor().parallel_for(0, n, policy.grain, line, f);
+}
+
+// dst = src, in parallel
+template <typename Dst, typename ExprType>
+void assign(const ParallelPolicy& policy, Dst& dst, const ExprType& src) {
+  static_assert(ctime_sizes_agree_v<Dst, ExprType>,
+                "Assignment between different static sizes.");
+  assert(dst.size() == src.size());
+  if constexpr (AssignsTo<ExprType, Dst>) {
+    src.assign_to(dst);  // BLAS-backed nodes use the library's own threads
+  } else if (!is_contiguous(dst)) {
+    assign(dst, src);
+  } else {
+    using T = typename Dst::value_type;
+    const instrument::Region region("assign(par)");
+    instrument::count_assign<T>(dst.size(), streamed_operands_v<ExprType>);
+    T* out = dst.data();
+    parallel_range<T>(policy, dst.size(),
+                      [&](size_t b, size_t e) { evaluate(out, src, b, e); });
+  }
+}
+
+// Fills dst with value using the same split as assign(policy, dst, ...).
+template <typename Dst>
+void first_touch(const ParallelPolicy& policy, Dst& dst,
+                 typename Dst::value_type value = {}) {
+  using T = typename Dst::value_type;
+  assert(is_contiguous(dst));
+  T* out = dst.data();
+  parallel_range<T>(policy, dst.size(), [&](size_t b, size_t e) {
+    for (size_t i = b; i < e; i++) out[i] = value;
+  });
+}
+
+SWNUMERIC_END
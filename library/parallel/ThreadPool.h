@@ -0,0 +1,415 @@
+#pragma once
+
+#if defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+#if !defined(SWNUMERIC_NO_MKL_THREADS) && __has_include(<mkl_service.h>)
+#include <mkl_service.h>
+#define SWNUMERIC_MKL_THREADS 1
+#else
+#define SWNUMERIC_MKL_THREADS 0
+#endif
+
+#include <algorithm>
+#include <atomic>
+#include <charconv>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <exception>
+#include <filesystem>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "library/dispatch/Namespace.h"
+
+SWNUMERIC_BEGIN
+
+//
+// Persistent pool of worker threads shared by every parallel path of the
+// library: assign(par, ...), the reductions, spmv, the batched kernels and the
+// CSV reader. run(n, f) calls f(t) once for each participant t in [0, n); the
+// calling thread takes part as participant 0, so a pool of size() P has P - 1
+// workers. Calls made from inside a running task execute serially on the
+// calling thread instead of deadlocking or oversubscribing.
+//
+// parallel_for() balances by work stealing. The range is cut into chunks of
+// at least `grain` elements; each participant is seeded with a contiguous run
+// of them, takes its own chunks from the front and, once out of work, steals
+// the back half of the longest run left. Under even load every participant
+// covers the same range on every call; only one that falls behind loses
+// chunks to the others.
+//
+// MKL called from a task runs on one thread (mkl_set_num_threads_local), so a
+// BLAS call inside a parallel loop does not start a second team of threads.
+// Calls made outside the pool keep MKL's own threading.
+//
+// The global pool is sized from SWNUMERIC_NUM_THREADS when set, and from
+// std::thread::hardware_concurrency() otherwise. On Linux, SWNUMERIC_AFFINITY
+// pins the workers:
+//
+//   compact   worker t on the t-th CPU the process may run on
+//   scatter   the same CPUs, ordered round-robin over the NUMA nodes
+//
+// The calling thread is never pinned; position 0 of the order is left to it.
+// Unset, or with any other value, no thread is pinned.
+//
+
+class ThreadPool {
+ public:
+  enum class Affinity { none, compact, scatter };
+
+  explicit ThreadPool(size_t threads = default_threads(),
+                      Affinity affinity = default_affinity()) {
+    threads = std::max<size_t>(threads, 1);
+    const std::vector<int> cpus = placement(affinity);
+    workers_.reserve(threads - 1);
+    for (size_t t = 1; t < threads; t++) {
+      const int cpu = cpus.empty() ? -1 : cpus[t % cpus.size()];
+      workers_.emplace_back([this, t, cpu] { worker(t, cpu); });
+    }
+  }
+
+  ThreadPool(const ThreadPool&) = delete;
+  ThreadPool& operator=(const ThreadPool&) = delete;
+
+  ~ThreadPool() {
+    {
+      std::lock_guard<std::mutex> lk(mutex_);
+      stop_ = true;
+      generation_++;
+    }
+    wake_.notify_all();
+    for (auto& w : workers_) w.join();
+  }
+
+  static ThreadPool& global() {
+    static ThreadPool pool;
+    return pool;
+  }
+
+  static size_t default_threads() {
+    if (const char* env = std::getenv("SWNUMERIC_NUM_THREADS")) {
+      const long n = std::strtol(env, nullptr, 10);
+      if (n > 0) return static_cast<size_t>(n);
+    }
+    return std::max(1u, std::thread::hardware_concurrency());
+  }
+
+  static Affinity default_affinity() {
+    const char* env = std::getenv("SWNUMERIC_AFFINITY");
+    const std::string_view s = env ? env : "";
+    if (s == "compact") return Affinity::compact;
+    if (s == "scatter") return Affinity::scatter;
+    return Affinity::none;
+  }
+
+  // The CPUs workers are placed on, in order; empty when none are pinned.
+  static std::vector<int> placement(Affinity affinity) {
+    std::vector<int> cpus;
+#if defined(__linux__)
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    if (affinity == Affinity::none ||
+        sched_getaffinity(0, sizeof(set), &set) != 0) {
+      return cpus;
+    }
+    for (int c = 0; c < CPU_SETSIZE; c++) {
+      if (CPU_ISSET(c, &set)) cpus.push_back(c);
+    }
+    if (affinity == Affinity::scatter) cpus = interleave_nodes(cpus);
+#else
+    (void)affinity;
+#endif
+    return cpus;
+  }
+
+  size_t size() const noexcept { return workers_.size() + 1; }
+
+  // true on a thread currently executing a pool task
+  static bool in_task() noexcept { return in_task_; }
+
+  template <typename F>
+  void run(size_t n, F&& f) {
+    n = std::min(n, size());
+    if (n <= 1 || in_task_) {
+      for (size_t t = 0; t < n; t++) f(t);
+      return;
+    }
+
+    std::lock_guard<std::mutex> serial(run_mutex_);
+    {
+      std::lock_guard<std::mutex> lk(mutex_);
+      using Fn = std::remove_reference_t<F>;
+      job_ = Job{const_cast<void*>(static_cast<const void*>(&f)),
+                 [](void* ctx, size_t t) { (*static_cast<Fn*>(ctx))(t); }};
+      active_ = n;
+      pending_ = n - 1;
+      error_ = nullptr;
+      generation_++;
+    }
+    wake_.notify_all();
+
+    {
+      [[maybe_unused]] const SerialMKL mkl;
+      execute(job_, 0);
+    }
+
+    std::unique_lock<std::mutex> lk(mutex_);
+    done_.wait(lk, [this] { return pending_ == 0; });
+    if (error_) std::rethrow_exception(std::exchange(error_, nullptr));
+  }
+
+  // Calls f(b, e) over disjoint ranges covering [begin, end), each of at least
+  // `grain` elements (but the last) with interior boundaries on multiples of
+  // `align`, balanced across the participants by work stealing.
+  template <typename F>
+  void parallel_for(size_t begin, size_t end, size_t grain, size_t align,
+                    F&& f) {
+    if (end <= begin) return;
+    const size_t n = end - begin;
+    grain = std::max<size_t>(grain, 1);
+    align = std::max<size_t>(align, 1);
+    const size_t tasks = std::min(size(), std::max<size_t>(1, n / grain));
+    if (tasks <= 1 || in_task_) {
+      f(begin, end);
+      return;
+    }
+
+    const size_t most = tasks * chunks_per_task;
+    const size_t want = std::max(grain, (n + most - 1) / most);
+    const size_t step = (want + align - 1) / align * align;
+    const size_t chunks = (n + step - 1) / step;
+    auto bound = [&](size_t k) {
+      if (k == 0) return begin;
+      return std::min(end, (begin + k * step + align - 1) / align * align);
+    };
+
+    std::vector<Slot> slots(tasks);
+    for (size_t t = 0; t < tasks; t++) {
+      slots[t].store(chunks * t / tasks, chunks * (t + 1) / tasks);
+    }
+    run(tasks, [&](size_t t) {
+      size_t k;
+      do {
+        while (slots[t].take(k)) {
+          const size_t b = bound(k), e = bound(k + 1);
+          if (b < e) f(b, e);
+        }
+      } while (steal(slots, t));
+    });
+  }
+
+ private:
+  struct Job {
+    void* ctx = nullptr;
+    void (*invoke)(void*, size_t) = nullptr;
+  };
+
+  // A participant's run of chunks [lo, hi), in one word so that the owner
+  // (taking from the front) and thieves (splitting off the back) only CAS.
+  struct alignas(64) Slot {
+    std::atomic<uint64_t> range{0};
+
+    static constexpr uint64_t low = 0xffffffffu;
+
+    void store(uint64_t lo, uint64_t hi) noexcept {
+      range.store(hi << 32 | lo, std::memory_order_relaxed);
+    }
+
+    size_t remaining() const noexcept {
+      const uint64_t r = range.load(std::memory_order_relaxed);
+      const uint64_t lo = r & low, hi = r >> 32;
+      return lo < hi ? hi - lo : 0;
+    }
+
+    bool take(size_t& k) noexcept {
+      uint64_t r = range.load(std::memory_order_relaxed);
+      for (;;) {
+        const uint64_t lo = r & low, hi = r >> 32;
+        if (lo >= hi) return false;
+        if (range.compare_exchange_weak(r, hi << 32 | (lo + 1),
+                                        std::memory_order_relaxed)) {
+          k = lo;
+          return true;
+        }
+      }
+    }
+
+    // Removes the back half (rounded up) of the run into [lo, hi).
+    bool split(uint64_t& lo, uint64_t& hi) noexcept {
+      uint64_t r = range.load(std::memory_order_relaxed);
+      for (;;) {
+        const uint64_t a = r & low, b = r >> 32;
+        if (a >= b) return false;
+        const uint64_t mid = b - (b - a + 1) / 2;
+        if (range.compare_exchange_weak(r, mid << 32 | a,
+                                        std::memory_order_relaxed)) {
+          lo = mid;
+          hi = b;
+          return true;
+        }
+      }
+    }
+  };
+
+  // Limits MKL on the calling thread to one thread while alive.
+  struct SerialMKL {
+#if SWNUMERIC_MKL_THREADS
+    const int previous = mkl_set_num_threads_local(1);
+    ~SerialMKL() { mkl_set_num_threads_local(previous); }
+#endif
+  };
+
+  static constexpr size_t chunks_per_task = 8;
+
+  std::vector<std::thread> workers_;
+  std::mutex run_mutex_;
+  std::mutex mutex_;
+  std::condition_variable wake_;
+  std::condition_variable done_;
+  Job job_;
+  size_t active_ = 0;
+  size_t pending_ = 0;
+  size_t generation_ = 0;
+  bool stop_ = false;
+  std::exception_ptr error_;
+
+  static inline thread_local bool in_task_ = false;
+
+  // Moves the back half of the longest run left to participant t's slot;
+  // false once no participant has chunks left.
+  static bool steal(std::vector<Slot>& slots, size_t t) noexcept {
+    for (;;) {
+      size_t victim = t, most = 0;
+      for (size_t v = 0; v < slots.size(); v++) {
+        const size_t left = v == t ? 0 : slots[v].remaining();
+        if (left > most) {
+          most = left;
+          victim = v;
+        }
+      }
+      if (most == 0) return false;
+      uint64_t lo, hi;
+      if (slots[victim].split(lo, hi)) {
+        slots[t].store(lo, hi);
+        return true;
+      }
+    }
+  }
+
+  // "0-3,8,10-11" as a list of CPUs
+  static std::vector<int> parse_cpulist(std::string_view s) {
+    std::vector<int> cpus;
+    const char* p = s.data();
+    const char* const end = p + s.size();
+    while (p < end) {
+      int lo = 0, hi = 0;
+      auto r = std::from_chars(p, end, lo);
+      if (r.ec != std::errc()) break;
+      hi = lo;
+      if (r.ptr < end && *r.ptr == '-') {
+        r = std::from_chars(r.ptr + 1, end, hi);
+        if (r.ec != std::errc()) break;
+      }
+      for (int c = lo; c <= hi; c++) cpus.push_back(c);
+      p = r.ptr < end && *r.ptr == ',' ? r.ptr + 1 : end;
+    }
+    return cpus;
+  }
+
+  // cpus taken one NUMA node at a time in turn; unchanged without sysfs
+  static std::vector<int> interleave_nodes(const std::vector<int>& cpus) {
+    namespace fs = std::filesystem;
+    std::vector<std::vector<int>> nodes;
+    std::error_code ec;
+    for (fs::directory_iterator it("/sys/devices/system/node", ec), last;
+         !ec && it != last; it.increment(ec)) {
+      const std::string name = it->path().filename().string();
+      if (name.rfind("node", 0) != 0 || name.size() == 4) continue;
+      std::ifstream in(it->path() / "cpulist");
+      std::string list;
+      if (!std::getline(in, list)) continue;
+      std::vector<int> node;
+      for (const int c : parse_cpulist(list)) {
+        if (std::binary_search(cpus.begin(), cpus.end(), c)) node.push_back(c);
+      }
+      if (!node.empty()) nodes.push_back(std::move(node));
+    }
+    std::sort(nodes.begin(), nodes.end());
+
+    std::vector<int> order;
+    for (size_t i = 0; order.size() < cpus.size(); i++) {
+      const size_t before = order.size();
+      for (const auto& node : nodes) {
+        if (i < node.size()) order.push_back(node[i]);
+      }
+      if (order.size() == before) break;
+    }
+    // CPUs on no listed node keep their place at the end
+    for (const int c : cpus) {
+      if (std::find(order.begin(), order.end(), c) == order.end()) {
+        order.push_back(c);
+      }
+    }
+    return order;
+  }
+
+  static void pin(int cpu) noexcept {
+#if defined(__linux__)
+    if (cpu < 0) return;
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+#else
+    (void)cpu;
+#endif
+  }
+
+  void execute(const Job& job, size_t t) {
+    const bool outer = std::exchange(in_task_, true);
+    try {
+      job.invoke(job.ctx, t);
+    } catch (...) {
+      std::lock_guard<std::mutex> lk(mutex_);
+      if (!error_) error_ = std::current_exception();
+    }
+    in_task_ = outer;
+  }
+
+  void worker(size_t t, int cpu) {
+    pin(cpu);
+#if SWNUMERIC_MKL_THREADS
+    mkl_set_num_threads_local(1);  // workers only ever run tasks
+#endif
+    size_t seen = 0;
+    for (;;) {
+      Job job;
+      {
+        std::unique_lock<std::mutex> lk(mutex_);
+        wake_.wait(lk, [&] { return generation_ != seen; });
+        seen = generation_;
+        if (stop_) return;
+        if (t >= active_) continue;
+        job = job_;
+      }
+      execute(job, t);
+      {
+        std::lock_guard<std::mutex> lk(mutex_);
+        if (--pending_ == 0) done_.notify_one();
+      }
+    }
+  }
+};
+
+SWNUMERIC_END
@@ -0,0 +1,613 @@
+#pragma once
+
+#if !defined(SWNUMERIC_NO_MKL_SPARSE) && __has_include(<mkl_spblas.h>)
+#include <mkl_spblas.h>
+#define SWNUMERIC_MKL_SPARSE 1
+#else
+#define SWNUMERIC_MKL_SPARSE 0
+#endif
+
+#include <algorithm>
+#include <cassert>
+#include <concepts>
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "library/dispatch/Namespace.h"
+#include "library/expression/Expression.h"
+#include "library/memory/AlignedAllocator.h"
+#include "library/parallel/Parallel.h"
+#include "library/vectormatrix/Matrix.h"
+#include "library/vectormatrix/Product.h"
+#include "library/vectormatrix/Vector.h"
+#include "library/vectormatrix/View.h"
+
+SWNUMERIC_BEGIN
+
+//
+// Compressed sparse matrices.
+//
+// SparseMatrix<T> stores either CSR (rows compressed: outer index = row) or
+// CSC (columns compressed) with zero-based, sorted inner indices. COOBuilder
+// collects (i, j, v) triplets in any order and builds either layout, summing
+// duplicates.
+//
+//   spmv(alpha, A, x, beta, y)   y = alpha * A * x + beta * y
+//   spmm(alpha, A, B, beta, C)   C = alpha * A * B + beta * C  (B, C dense)
+//
+// and the lazy forms y = matmul(A, x), y = alpha * matmul(A, x) + beta * y,
+// C = matmul(A, B) resolve to the same calls.
+//
+// When MKL's sparse BLAS is available (and SWNUMERIC_NO_MKL_SPARSE is not
+// defined) float and double products on contiguous operands go through
+// mkl_sparse_?_mv/mm on a handle created with the matrix; optimize() passes
+// the inspector-executor hints. Otherwise CSR products run natively, split
+// across the ThreadPool into row ranges of equal nonzero count. Native CSC
+// products scatter into the output and run serially.
+//
+
+enum class SparseLayout { csr, csc };
+
+#if SWNUMERIC_MKL_SPARSE
+using sparse_index = MKL_INT;
+#else
+using sparse_index = std::int64_t;
+#endif
+
+template <std::floating_point T>
+class SparseMatrix {
+ public:
+  using value_type = T;
+  using index_vector =
+      std::vector<sparse_index, AlignedAllocator<sparse_index>>;
+  using value_vector = std::vector<T, AlignedAllocator<T>>;
+
+  SparseMatrix() = default;
+
+  // Takes compressed arrays: ptr has outer() + 1 entries, idx and val nnz().
+  SparseMatrix(size_t R, size_t C, SparseLayout layout, index_vector ptr,
+               index_vector idx, value_vector val)
+      : _R(R),
+        _C(C),
+        _layout(layout),
+        _ptr(std::move(ptr)),
+        _idx(std::move(idx)),
+        _val(std::move(val)) {
+    assert(_ptr.size() == outer() + 1 && _ptr.front() == 0);
+    assert(static_cast<size_t>(_ptr.back()) == _idx.size());
+    assert(_idx.size() == _val.size());
+    create_handle();
+  }
+
+  SparseMatrix(const SparseMatrix& other)
+      : _R(other._R),
+        _C(other._C),
+        _layout(other._layout),
+        _ptr(other._ptr),
+        _idx(other._idx),
+        _val(other._val) {
+    create_handle();
+  }
+  SparseMatrix(SparseMatrix&& other) noexcept { swap(other); }
+  SparseMatrix& operator=(SparseMatrix other) noexcept {
+    swap(other);
+    return *this;
+  }
+  ~SparseMatrix() { destroy_handle(); }
+
+  void swap(SparseMatrix& other) noexcept {
+    std::swap(_R, other._R);
+    std::swap(_C, other._C);
+    std::swap(_layout, other._layout);
+    _ptr.swap(other._ptr);
+    _idx.swap(other._idx);
+    _val.swap(other._val);
+#if SWNUMERIC_MKL_SPARSE
+    std::swap(_handle, other._handle);
+#endif
+  }
+
+  // size
+  size_t rows() const noexcept { return _R; }
+  size_t cols() const noexcept { return _C; }
+  size_t nnz() const noexcept { return _val.size(); }
+  SparseLayout layout() const noexcept { return _layout; }
+  // number of compressed rows (CSR) or columns (CSC)
+  size_t outer() const noexcept {
+    return _layout == SparseLayout::csr ? _R : _C;
+  }
+
+  // compressed storage
+  const sparse_index* outer_ptr() const noexcept { return _ptr.data(); }
+  const sparse_index* inner_idx() const noexcept { return _idx.data(); }
+  const T* values() const noexcept { return _val.data(); }
+
+  // element (i, j), zero when not stored; O(log) in the row/column length
+  T coeff(size_t i, size_t j) const noexcept {
+    assert(i < _R && j < _C);
+    const size_t o = _layout == SparseLayout::csr ? i : j;
+    const auto in = static_cast<sparse_index>(
+        _layout == SparseLayout::csr ? j : i);
+    const sparse_index* b = _idx.data() + _ptr[o];
+    const sparse_index* e = _idx.data() + _ptr[o + 1];
+    const sparse_index* p = std::lower_bound(b, e, in);
+    return p != e && *p == in ? _val[p - _idx.data()] : T{};
+  }
+
+  // the same matrix in the other layout
+  SparseMatrix converted(SparseLayout layout) const {
+    if (layout == _layout) return *this;
+    const size_t n_out = layout == SparseLayout::csr ? _R : _C;
+    index_vector ptr(n_out + 1, 0), idx(nnz());
+    value_vector val(nnz());
+    for (size_t k = 0; k < nnz(); k++) ptr[_idx[k] + 1]++;
+    for (size_t o = 0; o < n_out; o++) ptr[o + 1] += ptr[o];
+    index_vector next(ptr.begin(), ptr.end() - 1);
+    for (size_t o = 0; o < outer(); o++) {
+      for (sparse_index k = _ptr[o]; k < _ptr[o + 1]; k++) {
+        const sparse_index dst = next[_idx[k]]++;
+        idx[dst] = static_cast<sparse_index>(o);
+        val[dst] = _val[k];
+      }
+    }
+    return {_R, _C, layout, std::move(ptr), std::move(idx), std::move(val)};
+  }
+  SparseMatrix to_csr() const { return converted(SparseLayout::csr); }
+  SparseMatrix to_csc() const { return converted(SparseLayout::csc); }
+
+  Matrix<T> dense() const {
+    Matrix<T> D(_R, _C);
+    for (size_t o = 0; o < outer(); o++) {
+      for (sparse_index k = _ptr[o]; k < _ptr[o + 1]; k++) {
+        const size_t in = static_cast<size_t>(_idx[k]);
+        D[_layout == SparseLayout::csr ? o * _C + in : in * _C + o] = _val[k];
+      }
+    }
+    return D;
+  }
+
+  // Inspector-executor hints: the expected number of products (and, for
+  // spmm, the dense operand's column count) let MKL pick and precompute a
+  // kernel. A no-op without MKL.
+  void optimize(size_t expected_calls, size_t dense_cols = 0) {
+#if SWNUMERIC_MKL_SPARSE
+    if (!_handle) return;
+    const auto calls = static_cast<MKL_INT>(expected_calls);
+    mkl_sparse_set_mv_hint(_handle, SPARSE_OPERATION_NON_TRANSPOSE,
+                           general(), calls);
+    if (dense_cols > 0) {
+      mkl_sparse_set_mm_hint(_handle, SPARSE_OPERATION_NON_TRANSPOSE,
+                             general(), SPARSE_LAYOUT_ROW_MAJOR,
+                             static_cast<MKL_INT>(dense_cols), calls);
+    }
+    mkl_sparse_set_memory_hint(_handle, SPARSE_MEMORY_AGGRESSIVE);
+    check(mkl_sparse_optimize(_handle), "mkl_sparse_optimize");
+#else
+    (void)expected_calls;
+    (void)dense_cols;
+#endif
+  }
+
+#if SWNUMERIC_MKL_SPARSE
+  // MKL handle over this matrix's arrays, or nullptr for other value types
+  sparse_matrix_t handle() const noexcept { return _handle; }
+
+  static matrix_descr general() noexcept {
+    matrix_descr d{};
+    d.type = SPARSE_MATRIX_TYPE_GENERAL;
+    return d;
+  }
+
+  static void check(sparse_status_t status, const char* what) {
+    if (status != SPARSE_STATUS_SUCCESS) {
+      throw std::runtime_error(std::string(what) + " failed with status " +
+                               std::to_string(static_cast<int>(status)));
+    }
+  }
+#endif
+
+ private:
+  size_t _R = 0, _C = 0;
+  SparseLayout _layout = SparseLayout::csr;
+  index_vector _ptr{0};
+  index_vector _idx;
+  value_vector _val;
+#if SWNUMERIC_MKL_SPARSE
+  sparse_matrix_t _handle = nullptr;
+#endif
+
+  void create_handle() {
+#if SWNUMERIC_MKL_SPARSE
+    if constexpr (std::is_same_v<T, double> || std::is_same_v<T, float>) {
+      const auto R = static_cast<MKL_INT>(_R), C = static_cast<MKL_INT>(_C);
+      const auto base = SPARSE_INDEX_BASE_ZERO;
+      MKL_INT* b = _ptr.data();
+      MKL_INT* idx = _idx.data();
+      T* val = _val.data();
+      const bool csr = _layout == SparseLayout::csr;
+      sparse_status_t status;
+      if constexpr (std::is_same_v<T, double>) {
+        status = csr ? mkl_sparse_d_create_csr(&_handle, base, R, C, b, b + 1,
+                                               idx, val)
+                     : mkl_sparse_d_create_csc(&_handle, base, R, C, b, b + 1,
+                                               idx, val);
+      } else {
+        status = csr ? mkl_sparse_s_create_csr(&_handle, base, R, C, b, b + 1,
+                                               idx, val)
+                     : mkl_sparse_s_create_csc(&_handle, base, R, C, b, b + 1,
+                                               idx, val);
+      }
+      check(status, "mkl_sparse_?_create");
+    }
+#endif
+  }
+
+  void destroy_handle() noexcept {
+#if SWNUMERIC_MKL_SPARSE
+    if (_handle) mkl_sparse_destroy(_handle);
+    _handle = nullptr;
+#endif
+  }
+};
+
+// Collects triplets; build() sorts them and sums duplicates.
+template <std::floating_point T>
+class COOBuilder {
+ public:
+  COOBuilder(size_t R, size_t C) : _R(R), _C(C) {}
+
+  void reserve(size_t n) {
+    _i.reserve(n);
+    _j.reserve(n);
+    _v.reserve(n);
+  }
+
+  // A(i, j) += v
+  void add(size_t i, size_t j, T v) {
+    assert(i < _R && j < _C);
+    _i.push_back(static_cast<sparse_index>(i));
+    _j.push_back(static_cast<sparse_index>(j));
+    _v.push_back(v);
+  }
+
+  size_t size() const noexcept { return _v.size(); }
+  void clear() noexcept {
+    _i.clear();
+    _j.clear();
+    _v.clear();
+  }
+
+  SparseMatrix<T> build(SparseLayout layout = SparseLayout::csr) const {
+    using index_vector = typename SparseMatrix<T>::index_vector;
+    using value_vector = typename SparseMatrix<T>::value_vector;
+    const bool csr = layout == SparseLayout::csr;
+    const std::vector<sparse_index>& out = csr ? _i : _j;
+    const std::vector<sparse_index>& in = csr ? _j : _i;
+    const size_t n_out = csr ? _R : _C;
+
+    // bucket by outer index
+    index_vector ptr(n_out + 1, 0);
+    for (sparse_index o : out) ptr[o + 1]++;
+    for (size_t o = 0; o < n_out; o++) ptr[o + 1] += ptr[o];
+    std::vector<std::pair<sparse_index, T>> entries(size());
+    index_vector next(ptr.begin(), ptr.end() - 1);
+    for (size_t k = 0; k < size(); k++) {
+      entries[next[out[k]]++] = {in[k], _v[k]};
+    }
+
+    // sort each bucket by inner index and merge duplicates
+    index_vector idx;
+    value_vector val;
+    idx.reserve(size());
+    val.reserve(size());
+    for (size_t o = 0; o < n_out; o++) {
+      const auto b = entries.begin() + ptr[o], e = entries.begin() + ptr[o + 1];
+      std::sort(b, e, [](const auto& x, const auto& y) {
+        return x.first < y.first;
+      });
+      ptr[o] = static_cast<sparse_index>(idx.size());
+      for (auto p = b; p != e; ++p) {
+        if (p != b && p->first == idx.back()) {
+          val.back() += p->second;
+        } else {
+          idx.push_back(p->first);
+          val.push_back(p->second);
+        }
+      }
+    }
+    ptr[n_out] = static_cast<sparse_index>(idx.size());
+    return {_R, _C, layout, std::move(ptr), std::move(idx), std::move(val)};
+  }
+
+ private:
+  size_t _R, _C;
+  std::vector<sparse_index> _i, _j;
+  std::vector<T> _v;
+};
+
+//
+// products
+//
+
+namespace sparse {
+
+// Calls f(b, e) over outer ranges holding about equal numbers of nonzeros.
+template <typename T, typename F>
+void balanced_rows(const ParallelPolicy& policy, const SparseMatrix<T>& A,
+                   F&& f) {
+  const size_t n = A.outer(), nnz = A.nnz();
+  ThreadPool& pool = policy.executor();
+  const size_t tasks = nnz < policy.threshold
+                           ? 1
+                           : std::min(pool.size(), nnz / policy.grain + 1);
+  if (tasks <= 1) {
+    f(size_t{0}, n);
+    return;
+  }
+  const sparse_index* ptr = A.outer_ptr();
+  auto cut = [&](size_t t) {
+    if (t >= tasks) return n;
+    const auto target = static_cast<sparse_index>(nnz / tasks * t);
+    return static_cast<size_t>(std::lower_bound(ptr, ptr + n, target) - ptr);
+  };
+  pool.run(tasks, [&](size_t t) {
+    const size_t b = cut(t), e = cut(t + 1);
+    if (b < e) f(b, e);
+  });
+}
+
+template <typename T, typename VY>
+void scale(T beta, VY& y) {
+  if (beta == T{1}) return;
+  for (size_t i = 0; i < y.size(); i++) y[i] = beta == T{0} ? T{} : beta * y[i];
+}
+
+}  // namespace sparse
+
+// y = alpha * A * x + beta * y
+template <typename T, ExprLike VX, ExprLike VY>
+void spmv(T alpha, const SparseMatrix<T>& A, const VX& x, T beta, VY& y,
+          const ParallelPolicy& policy = par) {
+  assert(A.cols() == x.size() && A.rows() == y.size());
+  if constexpr (requires { x.data(); }) {
+    assert(!overlaps(x, y));
+  }
+#if SWNUMERIC_MKL_SPARSE
+  if constexpr (std::is_same_v<T, double> || std::is_same_v<T, float>) {
+    if constexpr (requires { x.data(); }) {
+      if (A.handle() && is_contiguous(x) && is_contiguous(y)) {
+        const auto op = SPARSE_OPERATION_NON_TRANSPOSE;
+        const auto d = SparseMatrix<T>::general();
+        sparse_status_t status;
+        if constexpr (std::is_same_v<T, double>) {
+          status = mkl_sparse_d_mv(op, alpha, A.handle(), d, x.data(), beta,
+                                   y.data());
+        } else {
+          status = mkl_sparse_s_mv(op, alpha, A.handle(), d, x.data(), beta,
+                                   y.data());
+        }
+        SparseMatrix<T>::check(status, "mkl_sparse_?_mv");
+        return;
+      }
+    }
+  }
+#endif
+  const sparse_index* ptr = A.outer_ptr();
+  const sparse_index* idx = A.inner_idx();
+  const T* val = A.values();
+  if (A.layout() == SparseLayout::csr) {
+    sparse::balanced_rows(policy, A, [&](size_t b, size_t e) {
+      for (size_t i = b; i < e; i++) {
+        T acc{};
+        for (sparse_index k = ptr[i]; k < ptr[i + 1]; k++) {
+          acc += val[k] * x[idx[k]];
+        }
+        y[i] = beta == T{0} ? alpha * acc : alpha * acc + beta * y[i];
+      }
+    });
+  } else {
+    sparse::scale(beta, y);
+    for (size_t j = 0; j < A.cols(); j++) {
+      const T xj = alpha * x[j];
+      for (sparse_index k = ptr[j]; k < ptr[j + 1]; k++) {
+        y[idx[k]] += val[k] * xj;
+      }
+    }
+  }
+}
+
+// C = alpha * A * B + beta * C, for row-major dense B and C (Matrix or view)
+template <typename T, MatrixLike MB, MatrixLike MC>
+void spmm(T alpha, const SparseMatrix<T>& A, const MB& B, T beta, MC& C,
+          const ParallelPolicy& policy = par) {
+  assert(A.cols() == B.rows());
+  assert(C.rows() == A.rows() && C.cols() == B.cols());
+  assert(!overlaps(B, C));
+  const size_t N = B.cols(), ldb = leading_dim(B), ldc = leading_dim(C);
+#if SWNUMERIC_MKL_SPARSE
+  if constexpr (std::is_same_v<T, double> || std::is_same_v<T, float>) {
+    if (A.handle() && A.layout() == SparseLayout::csr) {
+      const auto op = SPARSE_OPERATION_NON_TRANSPOSE;
+      const auto d = SparseMatrix<T>::general();
+      const auto layout = SPARSE_LAYOUT_ROW_MAJOR;
+      const auto n = static_cast<MKL_INT>(N);
+      const auto lb = static_cast<MKL_INT>(ldb), lc = static_cast<MKL_INT>(ldc);
+      sparse_status_t status;
+      if constexpr (std::is_same_v<T, double>) {
+        status = mkl_sparse_d_mm(op, alpha, A.handle(), d, layout, B.data(), n,
+                                 lb, beta, C.data(), lc);
+      } else {
+        status = mkl_sparse_s_mm(op, alpha, A.handle(), d, layout, B.data(), n,
+                                 lb, beta, C.data(), lc);
+      }
+      SparseMatrix<T>::check(status, "mkl_sparse_?_mm");
+      return;
+    }
+  }
+#endif
+  const sparse_index* ptr = A.outer_ptr();
+  const sparse_index* idx = A.inner_idx();
+  const T* val = A.values();
+  if (A.layout() == SparseLayout::csr) {
+    sparse::balanced_rows(policy, A, [&](size_t b, size_t e) {
+      for (size_t i = b; i < e; i++) {
+        T* c = C.data() + i * ldc;
+        for (size_t j = 0; j < N; j++) c[j] = beta == T{0} ? T{} : beta * c[j];
+        for (sparse_index k = ptr[i]; k < ptr[i + 1]; k++) {
+          const T a = alpha * val[k];
+          const T* r = B.data() + idx[k] * ldb;
+          for (size_t j = 0; j < N; j++) c[j] += a * r[j];
+        }
+      }
+    });
+  } else {
+    sparse::scale(beta, C);
+    for (size_t j = 0; j < A.cols(); j++) {
+      const T* r = B.data() + j * ldb;
+      for (sparse_index k = ptr[j]; k < ptr[j + 1]; k++) {
+        T* c = C.data() + idx[k] * ldc;
+        const T a = alpha * val[k];
+        for (size_t n = 0; n < N; n++) c[n] += a * r[n];
+      }
+    }
+  }
+}
+
+//
+// lazy products
+//
+// matmul(A, x) with a sparse A is a product node like MatVecProduct: assigned
+// to a vector it is one spmv, and ProductUpdate turns
+// alpha * matmul(A, x) + beta * y into spmv(alpha, A, x, beta, y).
+// matmul(A, B) with a dense matrix B assigns through spmm. The sparse matrix
+// is held by reference.
+//
+
+template <typename R, typename T>
+struct SparseProduct : Expr<SparseProduct<R, T>, T> {
+  using value_type = T;
+
+  const SparseMatrix<T>& A;
+  expr_storage_t<R> x;
+  T alpha;
+
+  SparseProduct(const SparseMatrix<T>& a, const R& v, T s = T{1})
+      : A(a), x(v), alpha(s) {
+    if constexpr (MatrixExpr<R>) {
+      assert(A.cols() == x.rows());
+    } else {
+      assert(A.cols() == x.size());
+    }
+  }
+
+  size_t rows() const
+    requires MatrixExpr<R>
+  {
+    return A.rows();
+  }
+  size_t cols() const
+    requires MatrixExpr<R>
+  {
+    return x.cols();
+  }
+  size_t size() const {
+    if constexpr (MatrixExpr<R>) {
+      return A.rows() * x.cols();
+    } else {
+      return A.rows();
+    }
+  }
+
+  // O(row length) per element for CSR, O(cols log nnz) for CSC
+  T operator[](size_t idx) const {
+    size_t i = idx, n = 0, N = 1;
+    if constexpr (MatrixExpr<R>) {
+      N = x.cols();
+      i = idx / N;
+      n = idx % N;
+    }
+    T acc{};
+    if (A.layout() == SparseLayout::csr) {
+      const sparse_index* ptr = A.outer_ptr();
+      for (sparse_index k = ptr[i]; k < ptr[i + 1]; k++) {
+        acc += A.values()[k] * x[A.inner_idx()[k] * N + n];
+      }
+    } else {
+      for (size_t k = 0; k < A.cols(); k++) acc += A.coeff(i, k) * x[k * N + n];
+    }
+    return alpha * acc;
+  }
+
+  template <typename Dst>
+  bool aliases(const Dst& y) const noexcept {
+    return overlaps(y, x);
+  }
+
+  auto eval() const {
+    if constexpr (MatrixExpr<R>) {
+      Matrix<T> tmp(rows(), cols(), uninitialized);
+      accumulate(T{0}, tmp);
+      return tmp;
+    } else {
+      Vector<T> tmp(size(), uninitialized);
+      accumulate(T{0}, tmp);
+      return tmp;
+    }
+  }
+
+  // y = alpha * A * x + beta * y
+  template <typename Dst>
+  void accumulate(T beta, Dst& y) const {
+    if (aliases(y)) {
+      const auto tmp = eval();
+      for (size_t i = 0; i < size(); i++) {
+        y[i] = beta == T{0} ? tmp[i] : tmp[i] + beta * y[i];
+      }
+    } else if constexpr (MatrixExpr<R>) {
+      spmm(alpha, A, x, beta, y);
+    } else {
+      spmv(alpha, A, x, beta, y);
+    }
+  }
+
+  template <typename Dst>
+  void assign_to(Dst& y) const {
+    accumulate(T{0}, y);
+  }
+};
+
+template <typename T, ExprLike R>
+  requires requires(const R& x) { x.data(); }
+auto matmul(const SparseMatrix<T>& A, const R& x) {
+  return SparseProduct<R, T>{A, x};
+}
+
+template <typename R, typename T>
+auto operator*(const T& s, const SparseProduct<R, T>& p) {
+  return SparseProduct<R, T>{p.A, p.x, s * p.alpha};
+}
+
+template <typename R, ExprLike Y, typename T>
+auto operator+(const SparseProduct<R, T>& p,
+               const BinaryExpr<ScalarExpr<T>, Y, Mul, T>& by) {
+  return ProductUpdate<SparseProduct<R, T>, Y, T>{p, by.rhs, by.lhs.value};
+}
+
+template <typename R, ExprLike Y, typename T>
+  requires requires(const Y& y) { y.data(); }
+auto operator+(const SparseProduct<R, T>& p, const Y& y) {
+  return ProductUpdate<SparseProduct<R, T>, Y, T>{p, y, T{1}};
+}
+
+template <typename R, ExprLike Y, typename T>
+  requires requires(const Y& y) { y.data(); }
+auto operator-(const SparseProduct<R, T>& p, const Y& y) {
+  return ProductUpdate<SparseProduct<R, T>, Y, T>{p, y, T{-1}};
+}
+
+SWNUMERIC_END
@@ -0,0 +1,311 @@
+#pragma once
+
+#if !defined(SWNUMERIC_NO_MKL_BATCH) && __has_include(<mkl_version.h>)
+#include <mkl_version.h>
+#endif
+#if defined(INTEL_MKL_VERSION) && INTEL_MKL_VERSION >= 20200002
+#define SWNUMERIC_MKL_BATCH 1
+#else
+#define SWNUMERIC_MKL_BATCH 0
+#endif
+
+#include <mkl_cblas.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <cstddef>
+#include <type_traits>
+
+#include "library/dispatch/Dispatch.h"
+#include "library/dispatch/Namespace.h"
+#include "library/expression/Packet.h"
+#include "library/instrument/Instrument.h"
+#include "library/parallel/Parallel.h"
+#include "library/vectormatrix/Matrix.h"
+#include "library/vectormatrix/StaticKernels.h"
+#include "library/vectormatrix/Vector.h"
+
+SWNUMERIC_BEGIN
+
+//
+// Batched operations on contiguous arrays of StaticMatrix / StaticVector, for
+// many independent small problems (e.g. element assembly):
+//
+//   batched::gemm(1.0, Ke, Bt, 0.0, out, n);  // out[i] = Ke[i] * Bt[i]
+//   batched::cholesky_solve(K, f, u, n);      // K[i] u[i] = f[i]
+//
+// The array is split across the policy's threads; each thread runs the
+// unrolled single-problem kernels from StaticKernels.h in a loop, without the
+// per-call dispatch. cholesky_solve additionally runs interleaved:
+// packet_size<T> problems are transposed into a stack tile so that each
+// packet holds the same element of every problem, and the factorization does
+// one packet operation where the single-problem code did one scalar
+// operation; tails are padded with identity problems. (For gemm and gemv the
+// transposition costs more than it saves, so they are not interleaved.) gemm
+// operands too large to unroll go to cblas_?gemm_batch_strided when MKL
+// provides it. With SWNUMERIC_DISPATCH, gemm and cholesky_solve of 2x2 to 4x4
+// problems run the kernels chosen for the CPU at run time (Dispatch.h).
+//
+// The solvers return the number of singular (or, for Cholesky, not positive
+// definite) problems; the outputs of those problems are unspecified.
+//
+
+namespace batched {
+
+namespace detail {
+
+// Calls f(b, e) over a split of [0, count) whose boundaries are multiples of
+// align; work is the number of scalars each problem touches.
+template <typename F>
+void split(const ParallelPolicy& policy, size_t count, size_t work,
+           size_t align, F&& f) {
+  if (count * work < policy.threshold) {
+    f(size_t{0}, count);
+    return;
+  }
+  const size_t grain = std::max<size_t>(policy.grain / work, 1);
+  policy.executor().parallel_for(0, count, grain, align, f);
+}
+
+// f(beta), with beta a literal zero in the zero case so the kernels drop
+// their reads of the output.
+template <typename T, typename F>
+__always_inline void unswitch_zero(T beta, F&& f) {
+  if (beta == T{0}) {
+    f(T{0});
+  } else {
+    f(beta);
+  }
+}
+
+#if SWNUMERIC_DISPATCH
+// true for the problem sizes with dispatched kernels (Dispatch.h)
+template <size_t N, typename T>
+inline constexpr bool dispatched_size_v =
+    N >= 2 && N <= 4 &&
+    (std::is_same_v<T, float> || std::is_same_v<T, double>);
+#endif
+
+// Problems handled together by one interleaved kernel call.
+template <typename T>
+inline constexpr size_t lanes = packet_size<T>;
+
+// A tile of S scalars for each of lanes<T> problems, element-major: row s
+// holds element s of every problem and loads as one packet.
+template <size_t S, typename T>
+struct Tile {
+  alignas(64) T v[S][lanes<T>];
+
+  __always_inline packet_t<T> get(size_t s) const noexcept {
+    return pload(v[s]);
+  }
+  __always_inline void put(size_t s, packet_t<T> p) noexcept {
+    pstore(v[s], p);
+  }
+
+  // Rows from n <= lanes<T> consecutive S-scalar problems at src; the other
+  // lanes are copies of pad.
+  void load(const T* src, size_t n, const T* pad) noexcept {
+    for (size_t l = 0; l < lanes<T>; l++) {
+      const T* p = l < n ? src + l * S : pad;
+      for (size_t s = 0; s < S; s++) v[s][l] = p[s];
+    }
+  }
+  void store(T* dst, size_t n) const noexcept {
+    for (size_t l = 0; l < n; l++) {
+      for (size_t s = 0; s < S; s++) dst[l * S + s] = v[s][l];
+    }
+  }
+};
+
+template <size_t N, typename T>
+constexpr auto identity_data() {
+  StaticMatrix<N, N, T> I{};
+  for (size_t i = 0; i < N; i++) I[i * N + i] = T{1};
+  return I;
+}
+
+// A = L L^T, then L L^T x = b, for n problems; padding lanes solve I x = 0.
+// Returns the number of the n problems with a non-positive pivot.
+template <size_t N, typename T>
+size_t cholesky_tile(const T* A, const T* b, T* x, size_t n) {
+  static constexpr StaticMatrix<N, N, T> I = identity_data<N, T>();
+  static constexpr T zeros[N] = {};
+  Tile<N * N, T> L;
+  Tile<N, T> y, pivot;
+  L.load(A, n, I.data());
+  y.load(b, n, zeros);
+
+  // factor in place, lower triangle; keeps 1 / L(j, j) on the diagonal
+  unroll<N>([&](auto j) {
+    packet_t<T> d = L.get(j * N + j);
+    unroll<j>([&](auto k) {
+      const packet_t<T> l = L.get(j * N + k);
+      d = psub(d, pmul(l, l));
+    });
+    pivot.put(j, d);
+    const packet_t<T> inv = pdiv(pset1(T{1}), psqrt(d));
+    L.put(j * N + j, inv);
+    unroll<N>([&](auto i) {
+      if constexpr (i > j) {
+        packet_t<T> s = L.get(i * N + j);
+        unroll<j>([&](auto k) {
+          s = psub(s, pmul(L.get(i * N + k), L.get(j * N + k)));
+        });
+        L.put(i * N + j, pmul(s, inv));
+      }
+    });
+  });
+
+  // L y = b, then L^T x = y
+  unroll<N>([&](auto i) {
+    packet_t<T> s = y.get(i);
+    unroll<i>([&](auto k) { s = psub(s, pmul(L.get(i * N + k), y.get(k))); });
+    y.put(i, pmul(s, L.get(i * N + i)));
+  });
+  unroll<N>([&](auto ic) {
+    constexpr size_t i = N - 1 - ic;
+    packet_t<T> s = y.get(i);
+    unroll<N - 1 - i>([&](auto kc) {
+      constexpr size_t k = i + 1 + kc;
+      s = psub(s, pmul(L.get(k * N + i), y.get(k)));
+    });
+    y.put(i, pmul(s, L.get(i * N + i)));
+  });
+  y.store(x, n);
+
+  size_t failed = 0;
+  for (size_t l = 0; l < n; l++) {
+    bool ok = true;
+    for (size_t j = 0; j < N; j++) ok = ok && pivot.v[j][l] > T{0};
+    failed += !ok;
+  }
+  return failed;
+}
+
+}  // namespace detail
+
+// D[i] = alpha * A[i] * B[i] + beta * D[i] for i in [0, count)
+template <size_t R, size_t K, size_t C, typename T>
+void gemm(T alpha, const StaticMatrix<R, K, T>* A,
+          const StaticMatrix<K, C, T>* B, T beta, StaticMatrix<R, C, T>* D,
+          size_t count, const ParallelPolicy& policy = par) {
+  static_assert(sizeof(StaticMatrix<R, K, T>) == R * K * sizeof(T));
+#if SWNUMERIC_MKL_BATCH
+  constexpr bool blas_type =
+      std::is_same_v<T, double> || std::is_same_v<T, float>;
+  if constexpr (R * K * C > static_unroll_limit && blas_type) {
+    const instrument::BlasCall call("cblas_?gemm_batch_strided",
+                                    2 * R * K * C * count);
+    if constexpr (std::is_same_v<T, double>) {
+      cblas_dgemm_batch_strided(CblasRowMajor, CblasNoTrans, CblasNoTrans, R,
+                                C, K, alpha, A->data(), K, R * K, B->data(),
+                                C, K * C, beta, D->data(), C, R * C, count);
+    } else {
+      cblas_sgemm_batch_strided(CblasRowMajor, CblasNoTrans, CblasNoTrans, R,
+                                C, K, alpha, A->data(), K, R * K, B->data(),
+                                C, K * C, beta, D->data(), C, R * C, count);
+    }
+    return;
+  }
+#endif
+  const size_t work = R * K + K * C + R * C;
+#if SWNUMERIC_DISPATCH
+  if constexpr (detail::dispatched_size_v<R, T> && R == K && K == C) {
+    if (auto* kernel = dispatch::kernels<T>().gemm[R - 2]) {
+      detail::split(policy, count, work, 1, [&](size_t b, size_t e) {
+        kernel(alpha, A->data(), B->data(), beta, D->data(), b, e);
+      });
+      return;
+    }
+  }
+#endif
+  detail::split(policy, count, work, 1, [&](size_t b, size_t e) {
+    detail::unswitch_zero(beta, [&](T beta0) {
+      for (size_t i = b; i < e; i++) {
+        static_gemm<R, K, C>(alpha, A[i].data(), B[i].data(), beta0,
+                             D[i].data());
+      }
+    });
+  });
+}
+
+// y[i] = alpha * A[i] * x[i] + beta * y[i] for i in [0, count)
+template <size_t R, size_t C, typename T>
+void gemv(T alpha, const StaticMatrix<R, C, T>* A, const StaticVector<C, T>* x,
+          T beta, StaticVector<R, T>* y, size_t count,
+          const ParallelPolicy& policy = par) {
+  detail::split(policy, count, R * C + R + C, 1, [&](size_t b, size_t e) {
+    detail::unswitch_zero(beta, [&](T beta0) {
+      for (size_t i = b; i < e; i++) {
+        static_gemv<R, C>(alpha, A[i].data(), x[i].data(), beta0, y[i].data());
+      }
+    });
+  });
+}
+
+// Solves A[i] x[i] = b[i] for symmetric positive definite A[i]; only the
+// lower triangles are read.
+template <size_t N, typename T>
+size_t cholesky_solve(const StaticMatrix<N, N, T>* A,
+                      const StaticVector<N, T>* b, StaticVector<N, T>* x,
+                      size_t count, const ParallelPolicy& policy = par) {
+  static_assert(N * N <= static_unroll_limit,
+                "cholesky_solve is unrolled for small N only.");
+  constexpr size_t W = detail::lanes<T>;
+  std::atomic<size_t> failed{0};
+#if SWNUMERIC_DISPATCH
+  if constexpr (detail::dispatched_size_v<N, T>) {
+    if (auto* kernel = dispatch::kernels<T>().cholesky_solve[N - 2]) {
+      auto run = [&](size_t b0, size_t e) {
+        const size_t f = kernel(A->data(), b->data(), x->data(), b0, e);
+        failed.fetch_add(f, std::memory_order_relaxed);
+      };
+      // boundaries at a multiple of the lanes of every level
+      detail::split(policy, count, N * N + 2 * N, 64 / sizeof(T), run);
+      return failed.load();
+    }
+  }
+#endif
+  detail::split(policy, count, N * N + 2 * N, W, [&](size_t b0, size_t e) {
+    size_t f = 0;
+    for (size_t i = b0; i < e; i += W) {
+      f += detail::cholesky_tile<N>(A[i].data(), b[i].data(), x[i].data(),
+                                    std::min(W, e - i));
+    }
+    failed.fetch_add(f, std::memory_order_relaxed);
+  });
+  return failed.load();
+}
+
+// Solves A[i] x[i] = b[i] by LU with partial pivoting.
+template <size_t N, typename T>
+size_t lu_solve(const StaticMatrix<N, N, T>* A, const StaticVector<N, T>* b,
+                StaticVector<N, T>* x, size_t count,
+                const ParallelPolicy& policy = par) {
+  std::atomic<size_t> failed{0};
+  detail::split(policy, count, N * N + 2 * N, 1, [&](size_t b0, size_t e) {
+    size_t f = 0;
+    for (size_t i = b0; i < e; i++) f += !solve(A[i], b[i], x[i]);
+    failed.fetch_add(f, std::memory_order_relaxed);
+  });
+  return failed.load();
+}
+
+// Ainv[i] = A[i]^{-1}
+template <size_t N, typename T>
+size_t inverse(const StaticMatrix<N, N, T>* A, StaticMatrix<N, N, T>* Ainv,
+               size_t count, const ParallelPolicy& policy = par) {
+  std::atomic<size_t> failed{0};
+  detail::split(policy, count, 2 * N * N, 1, [&](size_t b, size_t e) {
+    size_t f = 0;
+    for (size_t i = b; i < e; i++) f += !::inverse(A[i], Ainv[i]);
+    failed.fetch_add(f, std::memory_order_relaxed);
+  });
+  return failed.load();
+}
+
+}  // namespace batched
+
+SWNUMERIC_END
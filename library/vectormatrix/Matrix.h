@@ -7,21 +7,39 @@
 #include <type_traits>
 #include <vector>
 
+#include "library/dispatch/Namespace.h"
 #include "library/expression/Expression.h"
+#include "library/memory/AlignedAllocator.h"
+#include "library/vectormatrix/StaticKernels.h"
+#include "library/vectormatrix/Vector.h"
+#include "library/vectormatrix/View.h"
+
+SWNUMERIC_BEGIN
 
 // Row major
 template <size_t R, size_t C, typename T>
 struct StaticMatrix : Expr<StaticMatrix<R, C, T>, T> {
   static_assert(R > 0, "Rows to StaticMatrix must be positive.");
   static_assert(C > 0, "Cols to StaticMatrix must be positive.");
-  static_assert(std::is_floating_point_v<T>,
-                "StaticMatrix is only valid for floating point types.");
+  static_assert(Scalar<T>,
+                "StaticMatrix is only valid for scalar types.");
 
   //
   using value_type = T;
   static constexpr size_t N = R * C;
+  constexpr static size_t ctime_size = N;
   T _data[N];
 
+  // constructor
+  constexpr StaticMatrix() = default;
+  template <std::convertible_to<T>... Args>
+    requires(sizeof...(Args) == N)
+  constexpr StaticMatrix(Args... args) : _data{T(args)...} {}
+  template <typename ExprType>
+  constexpr StaticMatrix(const Expr<ExprType, T>& src) {
+    assign(*this, static_cast<const ExprType&>(src));
+  }
+
   // size
   constexpr size_t size() const noexcept { return N; }
   constexpr size_t rows() const noexcept { return R; }
@@ -45,30 +63,36 @@ struct StaticMatrix : Expr<StaticMatrix<R, C, T>, T> {
   constexpr T* begin() noexcept { return _data; }
   constexpr T* end() noexcept { return _data + N; }
 
+  // packet access
+  packet_t<T> packet(size_t i) const noexcept { return ploadu(data() + i); }
+
   // operator=
   constexpr StaticMatrix& operator=(const StaticMatrix& src) = default;
 
   template <typename ExprType>
   constexpr StaticMatrix& operator=(const Expr<ExprType, T>& src) {
-    for (size_t i = 0; i < size(); i++) {
-      data()[i] = src[i];
-    }
+    assign(*this, static_cast<const ExprType&>(src));
+    return *this;
   }
 };
 
 // Row major
-template <typename T>
-struct Matrix : Expr<Matrix<T>, T> {
-  static_assert(std::is_floating_point_v<T>,
-                "Matrix is only valid for floating point types.");
+template <typename T, typename Alloc = AlignedAllocator<T>>
+struct Matrix : Expr<Matrix<T, Alloc>, T> {
+  static_assert(Scalar<T>, "Matrix is only valid for scalar types.");
 
   //
   using value_type = T;
-  std::vector<T> _data;
+  using allocator_type = Alloc;
+  std::vector<T, Alloc> _data;
   size_t _R, _C;
 
   // constructor
-  explicit Matrix(size_t R, size_t C) : _data(R * C), _R(R), _C(C) {}
+  explicit Matrix(size_t R, size_t C, const Alloc& alloc = Alloc())
+      : _data(R * C, T{}, alloc), _R(R), _C(C) {}
+  explicit Matrix(size_t R, size_t C, uninitialized_t,
+                  const Alloc& alloc = Alloc())
+      : _data(R * C, alloc), _R(R), _C(C) {}
 
   // size
   constexpr size_t size() const noexcept { return _data.size(); }
@@ -93,57 +117,142 @@ struct Matrix : Expr<Matrix<T>, T> {
   constexpr T* begin() noexcept { return data(); }
   constexpr T* end() noexcept { return data() + size(); }
 
+  // slices as views
+  constexpr VectorView<T> row(size_t i) noexcept {
+    return MatrixView<T>(*this).row(i);
+  }
+  constexpr VectorView<T> col(size_t j) noexcept {
+    return MatrixView<T>(*this).col(j);
+  }
+  constexpr MatrixView<T> block(size_t r, size_t c, size_t h,
+                                size_t w) noexcept {
+    return MatrixView<T>(*this).block(r, c, h, w);
+  }
+
+  // packet access
+  packet_t<T> packet(size_t i) const noexcept {
+    if constexpr (allocator_alignment<Alloc>() >= sizeof(packet_t<T>)) {
+      return pload(data() + i);
+    } else {
+      return ploadu(data() + i);
+    }
+  }
+
   constexpr Matrix& operator=(const Matrix& src) = default;
 
   template <typename ExprType>
   constexpr Matrix& operator=(const Expr<ExprType, T>& src) {
-    for (size_t i = 0; i < size(); i++) {
-      data()[i] = src[i];
-    }
+    assign(*this, static_cast<const ExprType&>(src));
+    return *this;
   }
 };
 
+template <size_t R, size_t C, typename T>
+struct expr_storage<StaticMatrix<R, C, T>> {
+  using type = const StaticMatrix<R, C, T>&;
+};
+
+template <typename T, typename Alloc>
+struct expr_storage<Matrix<T, Alloc>> {
+  using type = const Matrix<T, Alloc>&;
+};
+
 //
-// concept vectorlike
+// concept matrixlike
 //
 
+// Refines VectorLike, so overloads on MatrixLike are preferred over vector
+// ones for types that model both.
 template <typename M>
-concept MatrixLike = requires(M m) {
-  typename M::value_type;
-
-  { m.size() } -> std::convertible_to<size_t>;
+concept MatrixLike = VectorLike<M> && requires(M m) {
   { m.rows() } -> std::convertible_to<size_t>;
   { m.cols() } -> std::convertible_to<size_t>;
-  { m[0] } -> std::convertible_to<typename M::value_type>;
-  { m.data() };
-  { m.begin() };
-  { m.end() };
 };
 
 //
-// operators
+// small square systems
+//
+// Closed forms for N <= 3 and unrolled LU with partial pivoting up to N = 6.
+// inverse() and solve() return false, leaving their output unspecified, when
+// the matrix is singular.
 //
 
-template <MatrixLike M1, MatrixLike M2>
-constexpr auto operator+(const M1& a, const M2& b) {
-  assert(a.size() == b.size());
-  return BinaryExpr<M1, M2, Add, typename M1::value_type>{a, b};
-}
+inline constexpr size_t static_solve_limit = 6;
 
-template <MatrixLike M1, MatrixLike M2>
-constexpr auto operator-(const M1& a, const M2& b) {
-  assert(a.size() == b.size());
-  return BinaryExpr<M1, M2, Sub, typename M1::value_type>{a, b};
+template <size_t N, typename T>
+constexpr T det(const StaticMatrix<N, N, T>& A) {
+  static_assert(N <= static_solve_limit, "det is unrolled for N <= 6 only.");
+  const T* a = A.data();
+  if constexpr (N == 1) {
+    return a[0];
+  } else if constexpr (N == 2) {
+    return a[0] * a[3] - a[1] * a[2];
+  } else if constexpr (N == 3) {
+    return a[0] * (a[4] * a[8] - a[5] * a[7]) -
+           a[1] * (a[3] * a[8] - a[5] * a[6]) +
+           a[2] * (a[3] * a[7] - a[4] * a[6]);
+  } else {
+    StaticMatrix<N, N, T> LU = A;
+    size_t perm[N];
+    T d = static_lu<N>(LU.data(), perm);
+    unroll<N>([&](auto i) { d *= LU[i * N + i]; });
+    return d;
+  }
 }
 
-template <MatrixLike M1, MatrixLike M2>
-constexpr auto operator*(const M1& a, const M2& b) {
-  assert(a.size() == b.size());
-  return BinaryExpr<M1, M2, Mul, typename M1::value_type>{a, b};
+template <size_t N, typename T>
+constexpr bool inverse(const StaticMatrix<N, N, T>& A,
+                       StaticMatrix<N, N, T>& Ainv) {
+  static_assert(N <= static_solve_limit,
+                "inverse is unrolled for N <= 6 only.");
+  const T* a = A.data();
+  T* b = Ainv.data();
+  if constexpr (N <= 3) {
+    const T d = det(A);
+    if (d == T{0}) return false;
+    const T s = T{1} / d;
+    if constexpr (N == 1) {
+      b[0] = s;
+    } else if constexpr (N == 2) {
+      b[0] = a[3] * s, b[1] = -a[1] * s;
+      b[2] = -a[2] * s, b[3] = a[0] * s;
+    } else {
+      b[0] = (a[4] * a[8] - a[5] * a[7]) * s;
+      b[1] = (a[2] * a[7] - a[1] * a[8]) * s;
+      b[2] = (a[1] * a[5] - a[2] * a[4]) * s;
+      b[3] = (a[5] * a[6] - a[3] * a[8]) * s;
+      b[4] = (a[0] * a[8] - a[2] * a[6]) * s;
+      b[5] = (a[2] * a[3] - a[0] * a[5]) * s;
+      b[6] = (a[3] * a[7] - a[4] * a[6]) * s;
+      b[7] = (a[1] * a[6] - a[0] * a[7]) * s;
+      b[8] = (a[0] * a[4] - a[1] * a[3]) * s;
+    }
+    return true;
+  } else {
+    StaticMatrix<N, N, T> LU = A;
+    size_t perm[N];
+    if (static_lu<N>(LU.data(), perm) == 0) return false;
+    unroll<N>([&](auto j) {
+      T e[N] = {};
+      e[j] = T{1};
+      T col[N];
+      static_lu_solve<N>(LU.data(), perm, e, col);
+      unroll<N>([&](auto i) { b[i * N + j] = col[i]; });
+    });
+    return true;
+  }
 }
 
-template <MatrixLike M1, MatrixLike M2>
-constexpr auto operator/(const M1& a, const M2& b) {
-  assert(a.size() == b.size());
-  return BinaryExpr<M1, M2, Div, typename M1::value_type>{a, b};
+// x = A^{-1} b
+template <size_t N, typename T>
+constexpr bool solve(const StaticMatrix<N, N, T>& A,
+                     const StaticVector<N, T>& b, StaticVector<N, T>& x) {
+  static_assert(N <= static_solve_limit, "solve is unrolled for N <= 6 only.");
+  StaticMatrix<N, N, T> LU = A;
+  size_t perm[N];
+  if (static_lu<N>(LU.data(), perm) == 0) return false;
+  static_lu_solve<N>(LU.data(), perm, b.data(), x.data());
+  return true;
 }
+
+SWNUMERIC_END
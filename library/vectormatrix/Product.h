@@ -0,0 +1,344 @@
+#pragma once
+
+#include <mkl_cblas.h>
+
+#include <cassert>
+#include <cstddef>
+#include <type_traits>
+
+#include "library/dispatch/Namespace.h"
+#include "library/expression/Expression.h"
+#include "library/instrument/Instrument.h"
+#include "library/vectormatrix/Matrix.h"
+#include "library/vectormatrix/StaticKernels.h"
+#include "library/vectormatrix/Vector.h"
+
+SWNUMERIC_BEGIN
+
+//
+// Dense matrix products. Dynamically sized operands dispatch to BLAS
+// (?gemm/?gemv); StaticMatrix/StaticVector operands use the unrolled kernels in
+// StaticKernels.h, where the cost of a BLAS call would dominate. Strided and
+// padded views pass their stride and leading dimension (leading_dim(),
+// stride_of() in Expression.h) straight to BLAS.
+//
+
+// Matrix-like operand that is only a vector (not a matrix as well).
+template <typename V>
+concept DenseVectorLike = VectorLike<V> && !MatrixLike<V>;
+
+template <typename T>
+inline bool overlaps(const T* a, size_t na, const T* b, size_t nb) noexcept {
+  return a < b + nb && b < a + na;
+}
+
+// true if the storage spans of two leaves overlap
+template <typename A, typename B>
+inline bool overlaps(const A& a, const B& b) noexcept {
+  return overlaps(a.data(), storage_extent(a), b.data(), storage_extent(b));
+}
+
+// C = alpha * A * B + beta * C
+template <typename T, MatrixLike MA, MatrixLike MB, MatrixLike MC>
+void gemm(T alpha, const MA& A, const MB& B, T beta, MC& C) {
+  assert(A.cols() == B.rows());
+  assert(C.rows() == A.rows() && C.cols() == B.cols());
+  const size_t M = A.rows(), N = B.cols(), K = A.cols();
+  if constexpr (std::is_same_v<T, double>) {
+    const instrument::BlasCall call("cblas_dgemm", 2 * M * N * K);
+    cblas_dgemm(CblasRowMajor, CblasNoTrans, CblasNoTrans, M, N, K, alpha,
+                A.data(), leading_dim(A), B.data(), leading_dim(B), beta,
+                C.data(), leading_dim(C));
+  } else if constexpr (std::is_same_v<T, float>) {
+    const instrument::BlasCall call("cblas_sgemm", 2 * M * N * K);
+    cblas_sgemm(CblasRowMajor, CblasNoTrans, CblasNoTrans, M, N, K, alpha,
+                A.data(), leading_dim(A), B.data(), leading_dim(B), beta,
+                C.data(), leading_dim(C));
+  } else {
+    const size_t lda = leading_dim(A), ldb = leading_dim(B),
+                 ldc = leading_dim(C);
+    for (size_t i = 0; i < M; i++) {
+      T* c = C.data() + i * ldc;
+      for (size_t j = 0; j < N; j++) c[j] = beta == T{0} ? T{} : beta * c[j];
+      for (size_t k = 0; k < K; k++) {
+        const T a = alpha * A.data()[i * lda + k];
+        const T* b = B.data() + k * ldb;
+        for (size_t j = 0; j < N; j++) c[j] += a * b[j];
+      }
+    }
+  }
+}
+
+template <typename T, size_t R, size_t K, size_t C>
+constexpr void gemm(T alpha, const StaticMatrix<R, K, T>& A,
+                    const StaticMatrix<K, C, T>& B, T beta,
+                    StaticMatrix<R, C, T>& D) {
+  static_gemm<R, K, C>(alpha, A.data(), B.data(), beta, D.data());
+}
+
+// y = alpha * A * x + beta * y
+template <typename T, MatrixLike MA, DenseVectorLike VX, DenseVectorLike VY>
+void gemv(T alpha, const MA& A, const VX& x, T beta, VY& y) {
+  assert(A.cols() == x.size() && A.rows() == y.size());
+  const size_t M = A.rows(), N = A.cols();
+  if constexpr (std::is_same_v<T, double>) {
+    const instrument::BlasCall call("cblas_dgemv", 2 * M * N);
+    cblas_dgemv(CblasRowMajor, CblasNoTrans, M, N, alpha, A.data(),
+                leading_dim(A), x.data(), stride_of(x), beta, y.data(),
+                stride_of(y));
+  } else if constexpr (std::is_same_v<T, float>) {
+    const instrument::BlasCall call("cblas_sgemv", 2 * M * N);
+    cblas_sgemv(CblasRowMajor, CblasNoTrans, M, N, alpha, A.data(),
+                leading_dim(A), x.data(), stride_of(x), beta, y.data(),
+                stride_of(y));
+  } else {
+    const size_t lda = leading_dim(A);
+    for (size_t i = 0; i < M; i++) {
+      T acc{};
+      for (size_t j = 0; j < N; j++) acc += A.data()[i * lda + j] * x[j];
+      y[i] = beta == T{0} ? alpha * acc : alpha * acc + beta * y[i];
+    }
+  }
+}
+
+template <typename T, size_t R, size_t C>
+constexpr void gemv(T alpha, const StaticMatrix<R, C, T>& A,
+                    const StaticVector<C, T>& x, T beta,
+                    StaticVector<R, T>& y) {
+  static_gemv<R, C>(alpha, A.data(), x.data(), beta, y.data());
+}
+
+//
+// lazy products
+//
+// matmul(A, B) and matmul(A, x) build product expressions that are resolved
+// when assigned, so
+//
+//   C = alpha * matmul(A, B) + beta * C;
+//   y = alpha * matmul(A, x) + beta * y;
+//
+// are each a single ?gemm/?gemv call. Product nodes also support
+// elementwise access, at O(K) per element, for use inside larger expressions.
+//
+
+template <typename MA, typename MB, typename T>
+struct MatProduct : Expr<MatProduct<MA, MB, T>, T> {
+  using value_type = T;
+
+  expr_storage_t<MA> A;
+  expr_storage_t<MB> B;
+  T alpha;
+
+  constexpr MatProduct(const MA& a, const MB& b, T s = T{1})
+      : A(a), B(b), alpha(s) {
+    assert(A.cols() == B.rows());
+  }
+
+  constexpr size_t rows() const { return A.rows(); }
+  constexpr size_t cols() const { return B.cols(); }
+  constexpr size_t size() const { return rows() * cols(); }
+
+  constexpr T operator[](size_t idx) const {
+    const size_t i = idx / cols(), j = idx % cols();
+    const size_t lda = leading_dim(A), ldb = leading_dim(B);
+    T acc{};
+    for (size_t k = 0; k < A.cols(); k++) {
+      acc += A.data()[i * lda + k] * B.data()[k * ldb + j];
+    }
+    return alpha * acc;
+  }
+
+  template <typename Dst>
+  bool aliases(const Dst& D) const noexcept {
+    return overlaps(D, A) || overlaps(D, B);
+  }
+
+  Matrix<T> eval() const {
+    Matrix<T> tmp(rows(), cols(), uninitialized);
+    gemm(alpha, A, B, T{0}, tmp);
+    return tmp;
+  }
+
+  // D = alpha * A * B + beta * D
+  template <MatrixLike Dst>
+  void accumulate(T beta, Dst& D) const {
+    if (!aliases(D)) {
+      gemm(alpha, A, B, beta, D);
+      return;
+    }
+    const Matrix<T> tmp = eval();
+    for (size_t i = 0; i < D.size(); i++) {
+      D[i] = beta == T{0} ? tmp[i] : tmp[i] + beta * D[i];
+    }
+  }
+
+  template <MatrixLike Dst>
+  void assign_to(Dst& D) const {
+    accumulate(T{0}, D);
+  }
+};
+
+template <typename MA, typename VX, typename T>
+struct MatVecProduct : Expr<MatVecProduct<MA, VX, T>, T> {
+  using value_type = T;
+
+  expr_storage_t<MA> A;
+  expr_storage_t<VX> x;
+  T alpha;
+
+  constexpr MatVecProduct(const MA& a, const VX& v, T s = T{1})
+      : A(a), x(v), alpha(s) {
+    assert(A.cols() == x.size());
+  }
+
+  constexpr size_t size() const { return A.rows(); }
+
+  constexpr T operator[](size_t i) const {
+    const T* a = A.data() + i * leading_dim(A);
+    T acc{};
+    for (size_t j = 0; j < A.cols(); j++) acc += a[j] * x[j];
+    return alpha * acc;
+  }
+
+  template <typename Dst>
+  bool aliases(const Dst& y) const noexcept {
+    return overlaps(y, A) || overlaps(y, x);
+  }
+
+  Vector<T> eval() const {
+    Vector<T> tmp(size(), uninitialized);
+    gemv(alpha, A, x, T{0}, tmp);
+    return tmp;
+  }
+
+  // y = alpha * A * x + beta * y
+  template <DenseVectorLike Dst>
+  void accumulate(T beta, Dst& y) const {
+    if (!aliases(y)) {
+      gemv(alpha, A, x, beta, y);
+      return;
+    }
+    const Vector<T> tmp = eval();
+    for (size_t i = 0; i < size(); i++) {
+      y[i] = beta == T{0} ? tmp[i] : tmp[i] + beta * y[i];
+    }
+  }
+
+  template <DenseVectorLike Dst>
+  void assign_to(Dst& y) const {
+    accumulate(T{0}, y);
+  }
+};
+
+// alpha * product + beta * C, evaluated as one ?gemm/?gemv into the
+// destination: C is copied into it first unless it already is the destination,
+// and the product goes through a temporary if the destination aliases it.
+template <typename Product, typename MC, typename T>
+struct ProductUpdate : Expr<ProductUpdate<Product, MC, T>, T> {
+  using value_type = T;
+
+  Product product;
+  expr_storage_t<MC> C;
+  T beta;
+
+  constexpr ProductUpdate(const Product& p, const MC& c, T b)
+      : product(p), C(c), beta(b) {
+    assert(product.size() == C.size());
+  }
+
+  constexpr size_t size() const { return C.size(); }
+  constexpr T operator[](size_t i) const { return product[i] + beta * C[i]; }
+
+  template <typename Dst>
+  void assign_to(Dst& D) const {
+    if (D.data() == C.data() && storage_extent(D) == storage_extent(C)) {
+      product.accumulate(beta, D);
+    } else if (!product.aliases(D)) {
+      assign(D, C);
+      product.accumulate(beta, D);
+    } else {
+      const auto tmp = product.eval();
+      for (size_t i = 0; i < D.size(); i++) D[i] = tmp[i] + beta * C[i];
+    }
+  }
+};
+
+template <MatrixLike MA, MatrixLike MB>
+constexpr auto matmul(const MA& A, const MB& B) {
+  using T = typename MA::value_type;
+  return MatProduct<MA, MB, T>{A, B};
+}
+
+template <MatrixLike MA, DenseVectorLike VX>
+constexpr auto matmul(const MA& A, const VX& x) {
+  using T = typename MA::value_type;
+  return MatVecProduct<MA, VX, T>{A, x};
+}
+
+// static sizes are evaluated eagerly with the unrolled kernels
+template <size_t R, size_t K, size_t C, typename T>
+constexpr StaticMatrix<R, C, T> matmul(const StaticMatrix<R, K, T>& A,
+                                       const StaticMatrix<K, C, T>& B) {
+  StaticMatrix<R, C, T> D;
+  static_gemm<R, K, C>(T{1}, A.data(), B.data(), T{0}, D.data());
+  return D;
+}
+
+template <size_t R, size_t C, typename T>
+constexpr StaticVector<R, T> matmul(const StaticMatrix<R, C, T>& A,
+                                    const StaticVector<C, T>& x) {
+  StaticVector<R, T> y;
+  static_gemv<R, C>(T{1}, A.data(), x.data(), T{0}, y.data());
+  return y;
+}
+
+// scaling
+
+template <typename MA, typename MB, typename T>
+constexpr auto operator*(const T& s, const MatProduct<MA, MB, T>& p) {
+  return MatProduct<MA, MB, T>{p.A, p.B, s * p.alpha};
+}
+
+template <typename MA, typename VX, typename T>
+constexpr auto operator*(const T& s, const MatVecProduct<MA, VX, T>& p) {
+  return MatVecProduct<MA, VX, T>{p.A, p.x, s * p.alpha};
+}
+
+// updates
+
+template <typename MA, typename MB, MatrixLike MC, typename T>
+constexpr auto operator+(
+    const MatProduct<MA, MB, T>& p,
+    const BinaryExpr<ScalarExpr<T>, MC, Mul, T>& bc) {
+  return ProductUpdate<MatProduct<MA, MB, T>, MC, T>{p, bc.rhs, bc.lhs.value};
+}
+
+template <typename MA, typename MB, MatrixLike MC, typename T>
+constexpr auto operator+(const MatProduct<MA, MB, T>& p, const MC& c) {
+  return ProductUpdate<MatProduct<MA, MB, T>, MC, T>{p, c, T{1}};
+}
+
+template <typename MA, typename MB, MatrixLike MC, typename T>
+constexpr auto operator-(const MatProduct<MA, MB, T>& p, const MC& c) {
+  return ProductUpdate<MatProduct<MA, MB, T>, MC, T>{p, c, T{-1}};
+}
+
+template <typename MA, typename VX, DenseVectorLike VY, typename T>
+constexpr auto operator+(
+    const MatVecProduct<MA, VX, T>& p,
+    const BinaryExpr<ScalarExpr<T>, VY, Mul, T>& by) {
+  return ProductUpdate<MatVecProduct<MA, VX, T>, VY, T>{p, by.rhs,
+                                                        by.lhs.value};
+}
+
+template <typename MA, typename VX, DenseVectorLike VY, typename T>
+constexpr auto operator+(const MatVecProduct<MA, VX, T>& p, const VY& y) {
+  return ProductUpdate<MatVecProduct<MA, VX, T>, VY, T>{p, y, T{1}};
+}
+
+template <typename MA, typename VX, DenseVectorLike VY, typename T>
+constexpr auto operator-(const MatVecProduct<MA, VX, T>& p, const VY& y) {
+  return ProductUpdate<MatVecProduct<MA, VX, T>, VY, T>{p, y, T{-1}};
+}
+
+SWNUMERIC_END
@@ -0,0 +1,326 @@
+#pragma once
+
+#include <algorithm>
+#include <cassert>
+#include <concepts>
+#include <cstddef>
+#include <span>
+#include <type_traits>
+#include <vector>
+
+#include "library/dispatch/Namespace.h"
+#include "library/expression/Expression.h"
+#include "library/expression/Packet.h"
+#include "library/memory/AlignedAllocator.h"
+#include "library/vectormatrix/StaticKernels.h"
+#include "library/vectormatrix/Vector.h"
+#include "library/vectormatrix/View.h"
+
+SWNUMERIC_BEGIN
+
+//
+// Collections of StaticVector<N, T> stored by component, so kernels over all
+// elements load full packets of one component instead of gathering.
+//
+//   SoAVector    N lanes of size() values each, in one allocation; lane c is
+//                a contiguous VectorView usable in expressions.
+//   AoSoAVector  tiles of W elements, each holding N runs of W values, so all
+//                components of a tile share a few cache lines.
+//
+// Both hand out element i as an SoARef proxy that converts to and assigns
+// from StaticVector<N, T>, and both describe their storage as a sequence of
+// blocks: block b holds elements [b * block_size(), ...), with component c
+// at block_data(b) + c * block_step(). The batched norm2, dot and axpy below
+// work block by block, so they run unchanged over either layout.
+//
+
+// Element i of a structure-of-arrays container.
+template <size_t N, typename T>
+struct SoARef {
+  using value_type = std::remove_const_t<T>;
+
+  T* p;         // component 0
+  size_t step;  // distance between components
+
+  constexpr size_t size() const noexcept { return N; }
+  constexpr T& operator[](size_t c) const noexcept {
+    assert(c < N);
+    return p[c * step];
+  }
+
+  constexpr operator StaticVector<N, value_type>() const noexcept {
+    StaticVector<N, value_type> v;
+    unroll<N>([&](auto c) { v[c] = p[c * step]; });
+    return v;
+  }
+
+  constexpr const SoARef& operator=(
+      const StaticVector<N, value_type>& v) const noexcept
+    requires(!std::is_const_v<T>)
+  {
+    unroll<N>([&](auto c) { p[c * step] = v[c]; });
+    return *this;
+  }
+  constexpr const SoARef& operator=(const SoARef& r) const noexcept
+    requires(!std::is_const_v<T>)
+  {
+    return *this = StaticVector<N, value_type>(r);
+  }
+};
+
+template <size_t N, std::floating_point T, typename Alloc = AlignedAllocator<T>>
+struct SoAVector {
+  static_assert(N > 0, "SoAVector needs at least one component.");
+
+  //
+  using value_type = T;
+  using allocator_type = Alloc;
+  static constexpr size_t components = N;
+
+  //
+  std::vector<T, Alloc> _data;
+  size_t _n = 0;
+  size_t _ld = 0;  // lane stride, a whole number of cache lines
+
+  // constructor
+  explicit SoAVector(size_t n, const Alloc& alloc = Alloc())
+      : _data(N * padded(n), T{}, alloc), _n(n), _ld(padded(n)) {}
+  explicit SoAVector(size_t n, uninitialized_t, const Alloc& alloc = Alloc())
+      : _data(N * padded(n), alloc), _n(n), _ld(padded(n)) {}
+  explicit SoAVector(std::span<const StaticVector<N, T>> aos,
+                     const Alloc& alloc = Alloc())
+      : SoAVector(aos.size(), uninitialized, alloc) {
+    for (size_t i = 0; i < _n; i++) (*this)[i] = aos[i];
+  }
+
+  // size
+  constexpr size_t size() const noexcept { return _n; }
+  constexpr size_t ld() const noexcept { return _ld; }
+
+  // data access
+  constexpr T* data() noexcept { return _data.data(); }
+  constexpr const T* data() const noexcept { return _data.data(); }
+  constexpr SoARef<N, T> operator[](size_t i) noexcept {
+    assert(i < size());
+    return {data() + i, _ld};
+  }
+  constexpr SoARef<N, const T> operator[](size_t i) const noexcept {
+    assert(i < size());
+    return {data() + i, _ld};
+  }
+
+  // component c of every element
+  constexpr T* lane_data(size_t c) noexcept {
+    assert(c < N);
+    return data() + c * _ld;
+  }
+  constexpr const T* lane_data(size_t c) const noexcept {
+    assert(c < N);
+    return data() + c * _ld;
+  }
+  constexpr VectorView<T> lane(size_t c) noexcept {
+    return {lane_data(c), _n};
+  }
+
+  // blocks: one, spanning every element
+  constexpr size_t block_count() const noexcept { return 1; }
+  constexpr size_t block_size() const noexcept { return _n; }
+  constexpr size_t block_step() const noexcept { return _ld; }
+  constexpr T* block_data(size_t) noexcept { return data(); }
+  constexpr const T* block_data(size_t) const noexcept { return data(); }
+
+ private:
+  static constexpr size_t padded(size_t n) noexcept {
+    constexpr size_t line = std::max<size_t>(64 / sizeof(T), 1);
+    return (n + line - 1) / line * line;
+  }
+};
+
+// W elements per tile; the default puts each component run of a tile in one
+// cache line.
+template <size_t N, std::floating_point T,
+          size_t W = std::max<size_t>(64 / sizeof(T), 1),
+          typename Alloc = AlignedAllocator<T>>
+struct AoSoAVector {
+  static_assert(N > 0, "AoSoAVector needs at least one component.");
+  static_assert(W % packet_size<T> == 0,
+                "Tile width must be a multiple of the packet size.");
+
+  //
+  using value_type = T;
+  using allocator_type = Alloc;
+  static constexpr size_t components = N;
+  static constexpr size_t tile_width = W;
+
+  //
+  std::vector<T, Alloc> _data;
+  size_t _n = 0;
+
+  // constructor
+  explicit AoSoAVector(size_t n, const Alloc& alloc = Alloc())
+      : _data(tiles_for(n) * N * W, T{}, alloc), _n(n) {}
+  explicit AoSoAVector(size_t n, uninitialized_t,
+                       const Alloc& alloc = Alloc())
+      : _data(tiles_for(n) * N * W, alloc), _n(n) {}
+  explicit AoSoAVector(std::span<const StaticVector<N, T>> aos,
+                       const Alloc& alloc = Alloc())
+      : AoSoAVector(aos.size(), uninitialized, alloc) {
+    for (size_t i = 0; i < _n; i++) (*this)[i] = aos[i];
+  }
+
+  // size
+  constexpr size_t size() const noexcept { return _n; }
+  constexpr size_t tiles() const noexcept { return tiles_for(_n); }
+
+  // data access
+  constexpr T* data() noexcept { return _data.data(); }
+  constexpr const T* data() const noexcept { return _data.data(); }
+  constexpr SoARef<N, T> operator[](size_t i) noexcept {
+    assert(i < size());
+    return {tile(i / W) + i % W, W};
+  }
+  constexpr SoARef<N, const T> operator[](size_t i) const noexcept {
+    assert(i < size());
+    return {tile(i / W) + i % W, W};
+  }
+
+  // the N x W values of tile t, component-major
+  constexpr T* tile(size_t t) noexcept { return data() + t * N * W; }
+  constexpr const T* tile(size_t t) const noexcept {
+    return data() + t * N * W;
+  }
+
+  // blocks: one per tile
+  constexpr size_t block_count() const noexcept { return tiles(); }
+  constexpr size_t block_size() const noexcept { return W; }
+  constexpr size_t block_step() const noexcept { return W; }
+  constexpr T* block_data(size_t b) noexcept { return tile(b); }
+  constexpr const T* block_data(size_t b) const noexcept { return tile(b); }
+
+ private:
+  static constexpr size_t tiles_for(size_t n) noexcept {
+    return (n + W - 1) / W;
+  }
+};
+
+// Either of the containers above.
+template <typename S>
+concept SoALayout = requires(const S& s, size_t b) {
+  typename S::value_type;
+  typename S::allocator_type;
+  S::components;
+  { s.size() } -> std::convertible_to<size_t>;
+  { s.block_count() } -> std::convertible_to<size_t>;
+  { s.block_size() } -> std::convertible_to<size_t>;
+  { s.block_step() } -> std::convertible_to<size_t>;
+  { s.block_data(b) } -> std::convertible_to<const typename S::value_type*>;
+};
+
+namespace soa {
+
+// Calls f(b, first, len) for each block of s.
+template <SoALayout S, typename F>
+void for_each_block(const S& s, F&& f) {
+  for (size_t b = 0; b < s.block_count(); b++) {
+    const size_t first = b * s.block_size();
+    f(b, first, std::min(s.block_size(), s.size() - first));
+  }
+}
+
+// Block data and every component run are packet aligned when the allocator
+// is: lanes and tiles are padded to whole cache lines.
+template <SoALayout S, typename T>
+packet_t<T> load(const T* p) noexcept {
+  if constexpr (allocator_alignment<typename S::allocator_type>() >= 64) {
+    return pload(p);
+  } else {
+    return ploadu(p);
+  }
+}
+
+}  // namespace soa
+
+//
+// batched operations
+//
+
+// out[i] = norm2(x[i])
+template <SoALayout S, typename Out>
+void norm2(const S& x, Out& out) {
+  using T = typename S::value_type;
+  constexpr size_t N = S::components, W = packet_size<T>;
+  assert(out.size() == x.size() && is_contiguous(out));
+  const size_t step = x.block_step();
+  T* o = out.data();
+  soa::for_each_block(x, [&](size_t b, size_t first, size_t len) {
+    const T* p = x.block_data(b);
+    size_t i = 0;
+    for (; i + W <= len; i += W) {
+      packet_t<T> acc = pset1(T{0});
+      unroll<N>([&](auto c) {
+        const packet_t<T> v = soa::load<S>(p + c * step + i);
+        acc = pmadd(v, v, acc);
+      });
+      pstoreu(o + first + i, psqrt(acc));
+    }
+    for (; i < len; i++) {
+      T acc{};
+      unroll<N>([&](auto c) { acc += p[c * step + i] * p[c * step + i]; });
+      o[first + i] = std::sqrt(acc);
+    }
+  });
+}
+
+// out[i] = dot(a[i], b[i])
+template <SoALayout S, typename Out>
+void dot(const S& a, const S& b, Out& out) {
+  using T = typename S::value_type;
+  constexpr size_t N = S::components, W = packet_size<T>;
+  assert(a.size() == b.size() && a.block_step() == b.block_step());
+  assert(out.size() == a.size() && is_contiguous(out));
+  const size_t step = a.block_step();
+  T* o = out.data();
+  soa::for_each_block(a, [&](size_t k, size_t first, size_t len) {
+    const T* pa = a.block_data(k);
+    const T* pb = b.block_data(k);
+    size_t i = 0;
+    for (; i + W <= len; i += W) {
+      packet_t<T> acc = pset1(T{0});
+      unroll<N>([&](auto c) {
+        acc = pmadd(soa::load<S>(pa + c * step + i),
+                    soa::load<S>(pb + c * step + i), acc);
+      });
+      pstoreu(o + first + i, acc);
+    }
+    for (; i < len; i++) {
+      T acc{};
+      unroll<N>([&](auto c) { acc += pa[c * step + i] * pb[c * step + i]; });
+      o[first + i] = acc;
+    }
+  });
+}
+
+// y[i] += alpha * x[i]
+template <SoALayout S>
+void axpy(typename S::value_type alpha, const S& x, S& y) {
+  using T = typename S::value_type;
+  constexpr size_t N = S::components, W = packet_size<T>;
+  assert(x.size() == y.size() && x.block_step() == y.block_step());
+  const size_t step = x.block_step();
+  const packet_t<T> a = pset1(alpha);
+  soa::for_each_block(x, [&](size_t k, size_t, size_t len) {
+    const T* px = x.block_data(k);
+    T* py = y.block_data(k);
+    unroll<N>([&](auto c) {
+      const T* xc = px + c * step;
+      T* yc = py + c * step;
+      size_t i = 0;
+      for (; i + W <= len; i += W) {
+        pstoreu(yc + i, pmadd(a, soa::load<S>(xc + i), soa::load<S>(yc + i)));
+      }
+      for (; i < len; i++) yc[i] += alpha * xc[i];
+    });
+  });
+}
+
+SWNUMERIC_END
@@ -0,0 +1,165 @@
+#pragma once
+
+#include <cstddef>
+#include <type_traits>
+#include <utility>
+
+#include "library/dispatch/Namespace.h"
+
+SWNUMERIC_BEGIN
+
+//
+// Compile-time unrolled kernels for small, statically sized operands. These
+// work on raw row-major pointers so StaticMatrix and StaticVector (and stack
+// arrays in batched code) can share them.
+//
+
+// Calls f(std::integral_constant<size_t, I>{}) for I in [0, N).
+template <size_t N, typename F>
+__always_inline constexpr void unroll(F&& f) {
+  [&]<size_t... I>(std::index_sequence<I...>) {
+    (f(std::integral_constant<size_t, I>{}), ...);
+  }(std::make_index_sequence<N>{});
+}
+
+// Above this many multiply-adds the kernels fall back to plain loops and let
+// the compiler decide how far to unroll.
+inline constexpr size_t static_unroll_limit = 512;
+
+// C(R x N) = alpha * A(R x K) * B(K x N) + beta * C. Each output row is
+// accumulated in registers across K before being written once. beta == 0
+// never reads C.
+template <size_t R, size_t K, size_t N, typename T>
+constexpr void static_gemm(T alpha, const T* A, const T* B, T beta, T* C) {
+  auto row = [&](size_t i) {
+    T acc[N] = {};
+    if constexpr (K * N <= static_unroll_limit) {
+      unroll<K>([&](auto k) {
+        const T a = A[i * K + k];
+        unroll<N>([&](auto j) { acc[j] += a * B[k * N + j]; });
+      });
+    } else {
+      for (size_t k = 0; k < K; k++) {
+        const T a = A[i * K + k];
+        for (size_t j = 0; j < N; j++) acc[j] += a * B[k * N + j];
+      }
+    }
+    if (beta == T{0}) {
+      for (size_t j = 0; j < N; j++) C[i * N + j] = alpha * acc[j];
+    } else {
+      for (size_t j = 0; j < N; j++) {
+        C[i * N + j] = alpha * acc[j] + beta * C[i * N + j];
+      }
+    }
+  };
+  if constexpr (R * K * N <= static_unroll_limit) {
+    unroll<R>([&](auto i) { row(i); });
+  } else {
+    for (size_t i = 0; i < R; i++) row(i);
+  }
+}
+
+// y(R) = alpha * A(R x C) * x(C) + beta * y. beta == 0 never reads y.
+template <size_t R, size_t C, typename T>
+constexpr void static_gemv(T alpha, const T* A, const T* x, T beta, T* y) {
+  auto row = [&](size_t i) {
+    T acc{};
+    if constexpr (C <= static_unroll_limit) {
+      unroll<C>([&](auto j) { acc += A[i * C + j] * x[j]; });
+    } else {
+      for (size_t j = 0; j < C; j++) acc += A[i * C + j] * x[j];
+    }
+    y[i] = beta == T{0} ? alpha * acc : alpha * acc + beta * y[i];
+  };
+  if constexpr (R * C <= static_unroll_limit) {
+    unroll<R>([&](auto i) { row(i); });
+  } else {
+    for (size_t i = 0; i < R; i++) row(i);
+  }
+}
+
+// Sum of a[i] * b[i] for i in [0, N).
+template <size_t N, typename T>
+constexpr T static_dot(const T* a, const T* b) noexcept {
+  T acc{};
+  if constexpr (N <= static_unroll_limit) {
+    unroll<N>([&](auto i) { acc += a[i] * b[i]; });
+  } else {
+    for (size_t i = 0; i < N; i++) acc += a[i] * b[i];
+  }
+  return acc;
+}
+
+template <typename T>
+constexpr T static_abs(T x) noexcept {
+  return x < T{0} ? -x : x;
+}
+
+// In-place LU factorization with partial pivoting of a row-major N x N matrix:
+// PA = LU with unit-diagonal L below the diagonal and U on and above it.
+// perm[i] is the original row now at row i. Returns the sign of the
+// permutation, or 0 if A is singular.
+template <size_t N, typename T>
+constexpr int static_lu(T* A, size_t* perm) noexcept {
+  int sign = 1;
+  bool singular = false;
+  unroll<N>([&](auto i) { perm[i] = i; });
+  unroll<N>([&](auto kc) {
+    constexpr size_t k = kc;
+    if (singular) return;
+
+    size_t p = k;
+    T best = static_abs(A[k * N + k]);
+    unroll<N>([&](auto i) {
+      if constexpr (i > k) {
+        const T v = static_abs(A[i * N + k]);
+        if (v > best) {
+          best = v;
+          p = i;
+        }
+      }
+    });
+    if (best == T{0}) {
+      singular = true;
+      return;
+    }
+    if (p != k) {
+      unroll<N>([&](auto j) { std::swap(A[k * N + j], A[p * N + j]); });
+      std::swap(perm[k], perm[p]);
+      sign = -sign;
+    }
+
+    const T inv = T{1} / A[k * N + k];
+    unroll<N>([&](auto i) {
+      if constexpr (i > k) {
+        const T l = A[i * N + k] *= inv;
+        unroll<N>([&](auto j) {
+          if constexpr (j > k) A[i * N + j] -= l * A[k * N + j];
+        });
+      }
+    });
+  });
+  return singular ? 0 : sign;
+}
+
+// Solves A x = b given PA = LU from static_lu. b and x may alias.
+template <size_t N, typename T>
+constexpr void static_lu_solve(const T* LU, const size_t* perm, const T* b,
+                               T* x) noexcept {
+  T y[N];
+  unroll<N>([&](auto i) { y[i] = b[perm[i]]; });
+  unroll<N>([&](auto i) {
+    unroll<i>([&](auto j) { y[i] -= LU[i * N + j] * y[j]; });
+  });
+  unroll<N>([&](auto ic) {
+    constexpr size_t i = N - 1 - ic;
+    unroll<N - 1 - i>([&](auto jc) {
+      constexpr size_t j = i + 1 + jc;
+      y[i] -= LU[i * N + j] * y[j];
+    });
+    y[i] /= LU[i * N + i];
+  });
+  unroll<N>([&](auto i) { x[i] = y[i]; });
+}
+
+SWNUMERIC_END
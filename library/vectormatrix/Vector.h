@@ -10,12 +10,18 @@
 #include <type_traits>
 #include <vector>
 
+#include "library/dispatch/Namespace.h"
 #include "library/expression/Expression.h"
+#include "library/expression/Reduction.h"
+#include "library/instrument/Instrument.h"
+#include "library/memory/AlignedAllocator.h"
+#include "library/vectormatrix/StaticKernels.h"
+#include "library/vectormatrix/View.h"
 
-template <size_t N, std::floating_point T>
-struct StaticVector
-// : Expr<StaticVector<N, T>, T>
-{
+SWNUMERIC_BEGIN
+
+template <size_t N, Scalar T>
+struct StaticVector : Expr<StaticVector<N, T>, T> {
   static_assert(N > 0, "Length to StaticVector must be positive.");
 
   //
@@ -24,6 +30,16 @@ struct StaticVector
   //
   T _data[N];
 
+  // constructor
+  constexpr StaticVector() = default;
+  template <std::convertible_to<T>... Args>
+    requires(sizeof...(Args) == N)
+  constexpr StaticVector(Args... args) : _data{T(args)...} {}
+  template <typename ExprType>
+  constexpr StaticVector(const Expr<ExprType, T>& src) {
+    assign(*this, static_cast<const ExprType&>(src));
+  }
+
   // size
   constexpr size_t size() const noexcept { return N; }
   constexpr bool is_alloc() const noexcept { return true; }
@@ -47,160 +63,99 @@ struct StaticVector
   constexpr T* begin() noexcept { return _data; }
   constexpr T* end() noexcept { return _data + N; }
 
+  // packet access
+  packet_t<T> packet(size_t i) const noexcept { return ploadu(data() + i); }
+
   // operator=
   constexpr StaticVector& operator=(const StaticVector& src) = default;
 
   template <typename ExprType>
   constexpr StaticVector& operator=(const Expr<ExprType, T>& src) {
-    for (size_t i = 0; i < size(); i++) {
-      data()[i] = src[i];
-    }
+    assign(*this, static_cast<const ExprType&>(src));
+    return *this;
   }
 };
 
-template <size_t N, std::floating_point T>
-__always_inline StaticVector<N, T> operator+(const StaticVector<N, T>& a,
-                                             const StaticVector<N, T>& b) {
-  StaticVector<N, T> c;
-  for (size_t i = 0; i < N; i++) c[i] = a[i] + b[i];
-}
-
-template <size_t N, std::floating_point T>
-__always_inline StaticVector<N, T> operator-(const StaticVector<N, T>& a,
-                                             const StaticVector<N, T>& b) {
-  StaticVector<N, T> c;
-  for (size_t i = 0; i < N; i++) c[i] = a[i] - b[i];
-}
-
-template <size_t N, std::floating_point T>
-__always_inline StaticVector<N, T> operator*(const StaticVector<N, T>& a,
-                                             const StaticVector<N, T>& b) {
-  StaticVector<N, T> c;
-  for (size_t i = 0; i < N; i++) c[i] = a[i] * b[i];
-}
-
-template <size_t N, std::floating_point T>
-__always_inline StaticVector<N, T> operator/(const StaticVector<N, T>& a,
-                                             const StaticVector<N, T>& b) {
-  StaticVector<N, T> c;
-  for (size_t i = 0; i < N; i++) c[i] = a[i] / b[i];
-}
-
-template <size_t N, std::floating_point T>
-__always_inline StaticVector<N, T> operator+(const StaticVector<N, T>& a,
-                                             const T& b) {
-  StaticVector<N, T> c;
-  for (size_t i = 0; i < N; i++) c[i] = a[i] + b;
-}
-
-template <size_t N, std::floating_point T>
-__always_inline StaticVector<N, T> operator-(const StaticVector<N, T>& a,
-                                             const T& b) {
-  StaticVector<N, T> c;
-  for (size_t i = 0; i < N; i++) c[i] = a[i] - b;
-}
-
-template <size_t N, std::floating_point T>
-__always_inline StaticVector<N, T> operator*(const StaticVector<N, T>& a,
-                                             const T& b) {
-  StaticVector<N, T> c;
-  for (size_t i = 0; i < N; i++) c[i] = a[i] * b;
-}
-
-template <size_t N, std::floating_point T>
-__always_inline StaticVector<N, T> operator/(const StaticVector<N, T>& a,
-                                             const T& b) {
-  StaticVector<N, T> c;
-  for (size_t i = 0; i < N; i++) c[i] = a[i] / b;
-}
-
-template <size_t N, std::floating_point T>
-__always_inline StaticVector<N, T> operator+(const T& a,
-                                             const StaticVector<N, T>& b) {
-  StaticVector<N, T> c;
-  for (size_t i = 0; i < N; i++) c[i] = a + b[i];
-}
-
-template <size_t N, std::floating_point T>
-__always_inline StaticVector<N, T> operator-(const T& a,
-                                             const StaticVector<N, T>& b) {
-  StaticVector<N, T> c;
-  for (size_t i = 0; i < N; i++) c[i] = a - b[i];
-}
-
-template <size_t N, std::floating_point T>
-__always_inline StaticVector<N, T> operator*(const T& a,
-                                             const StaticVector<N, T>& b) {
-  StaticVector<N, T> c;
-  for (size_t i = 0; i < N; i++) c[i] = a * b[i];
-}
+template <size_t N, typename T>
+struct expr_storage<StaticVector<N, T>> {
+  using type = const StaticVector<N, T>&;
+};
 
-template <size_t N, std::floating_point T>
-__always_inline StaticVector<N, T> operator/(const T& a,
-                                             const StaticVector<N, T>& b) {
-  StaticVector<N, T> c;
-  for (size_t i = 0; i < N; i++) c[i] = a / b[i];
-}
+// Arithmetic on static vectors goes through the expression operators in
+// Expression.h; a chain such as a + b * s - c is evaluated in one unrolled
+// pass when assigned, and mixing static sizes fails to compile.
 
 template <size_t N, std::floating_point T>
 __always_inline StaticVector<N, T>& operator+=(StaticVector<N, T>& a,
                                                const StaticVector<N, T>& b) {
-  for (size_t i = 0; i < N; i++) a[i] += b[i];
+  unroll<N>([&](auto i) { a[i] += b[i]; });
+  return a;
 }
 
 template <size_t N, std::floating_point T>
-__always_inline StaticVector<N, T> operator-=(StaticVector<N, T>& a,
-                                              const StaticVector<N, T>& b) {
-  for (size_t i = 0; i < N; i++) a[i] -= b[i];
+__always_inline StaticVector<N, T>& operator-=(StaticVector<N, T>& a,
+                                               const StaticVector<N, T>& b) {
+  unroll<N>([&](auto i) { a[i] -= b[i]; });
+  return a;
 }
 
 template <size_t N, std::floating_point T>
-__always_inline StaticVector<N, T> operator*=(StaticVector<N, T>& a,
-                                              const StaticVector<N, T>& b) {
-  for (size_t i = 0; i < N; i++) a[i] *= b[i];
+__always_inline StaticVector<N, T>& operator*=(StaticVector<N, T>& a,
+                                               const StaticVector<N, T>& b) {
+  unroll<N>([&](auto i) { a[i] *= b[i]; });
+  return a;
 }
 
 template <size_t N, std::floating_point T>
-__always_inline StaticVector<N, T> operator/=(StaticVector<N, T>& a,
-                                              const StaticVector<N, T>& b) {
-  for (size_t i = 0; i < N; i++) a[i] /= b[i];
+__always_inline StaticVector<N, T>& operator/=(StaticVector<N, T>& a,
+                                               const StaticVector<N, T>& b) {
+  unroll<N>([&](auto i) { a[i] /= b[i]; });
+  return a;
 }
 
 template <size_t N, std::floating_point T>
 __always_inline StaticVector<N, T>& operator+=(StaticVector<N, T>& a,
                                                const T& b) {
-  for (size_t i = 0; i < N; i++) a[i] += b;
+  unroll<N>([&](auto i) { a[i] += b; });
+  return a;
 }
 
 template <size_t N, std::floating_point T>
-__always_inline StaticVector<N, T> operator-=(StaticVector<N, T>& a,
-                                              const T& b) {
-  for (size_t i = 0; i < N; i++) a[i] -= b;
+__always_inline StaticVector<N, T>& operator-=(StaticVector<N, T>& a,
+                                               const T& b) {
+  unroll<N>([&](auto i) { a[i] -= b; });
+  return a;
 }
 
 template <size_t N, std::floating_point T>
-__always_inline StaticVector<N, T> operator*=(StaticVector<N, T>& a,
-                                              const T& b) {
-  for (size_t i = 0; i < N; i++) a[i] *= b;
+__always_inline StaticVector<N, T>& operator*=(StaticVector<N, T>& a,
+                                               const T& b) {
+  unroll<N>([&](auto i) { a[i] *= b; });
+  return a;
 }
 
 template <size_t N, std::floating_point T>
-__always_inline StaticVector<N, T> operator/=(StaticVector<N, T>& a,
-                                              const T& b) {
-  for (size_t i = 0; i < N; i++) a[i] /= b;
+__always_inline StaticVector<N, T>& operator/=(StaticVector<N, T>& a,
+                                               const T& b) {
+  unroll<N>([&](auto i) { a[i] /= b; });
+  return a;
 }
 
-template <std::floating_point T>
-struct Vector : Expr<Vector<T>, T> {
+template <Scalar T, typename Alloc = AlignedAllocator<T>>
+struct Vector : Expr<Vector<T, Alloc>, T> {
   //
   using value_type = T;
+  using allocator_type = Alloc;
   constexpr static size_t ctime_size = 0;
 
   //
-  std::vector<T> _data;
+  std::vector<T, Alloc> _data;
 
   // constructor
-  explicit Vector(size_t N) : _data(N) {}
+  explicit Vector(size_t N, const Alloc& alloc = Alloc())
+      : _data(N, T{}, alloc) {}
+  explicit Vector(size_t N, uninitialized_t, const Alloc& alloc = Alloc())
+      : _data(N, alloc) {}
   explicit Vector() {}
 
   // size
@@ -209,7 +164,7 @@ struct Vector : Expr<Vector<T>, T> {
   constexpr bool alloc(size_t N) {
     if (is_alloc()) [[unlikely]]
       return false;
-    _data.resize(N);
+    _data.resize(N, T{});
     return true;
   }
 
@@ -231,16 +186,35 @@ struct Vector : Expr<Vector<T>, T> {
   constexpr T* begin() noexcept { return data(); }
   constexpr T* end() noexcept { return data() + size(); }
 
+  // elements [i, i + n) as a view
+  constexpr VectorView<T> segment(size_t i, size_t n) noexcept {
+    assert(i + n <= size());
+    return {data() + i, n};
+  }
+
+  // packet access
+  packet_t<T> packet(size_t i) const noexcept {
+    if constexpr (allocator_alignment<Alloc>() >= sizeof(packet_t<T>)) {
+      return pload(data() + i);
+    } else {
+      return ploadu(data() + i);
+    }
+  }
+
   constexpr Vector& operator=(const Vector& src) = default;
 
   template <typename ExprType>
   constexpr Vector& operator=(const Expr<ExprType, T>& src) {
-    for (size_t i = 0; i < size(); i++) {
-      data()[i] = src[i];
-    }
+    assign(*this, static_cast<const ExprType&>(src));
+    return *this;
   }
 };
 
+template <typename T, typename Alloc>
+struct expr_storage<Vector<T, Alloc>> {
+  using type = const Vector<T, Alloc>&;
+};
+
 //
 // concept vectorlike
 //
@@ -256,57 +230,76 @@ concept VectorLike = requires(V v) {
   { v.end() };
 };
 
-//
-// operators
-//
+// Elementwise operators on vectors are the generic expression operators in
+// Expression.h.
+
+// other common operators
+
+// Static vectors up to this length use the unrolled kernels instead of BLAS.
+inline constexpr size_t static_blas_threshold = 64;
 
-template <VectorLike V1, VectorLike V2>
-constexpr auto operator+(const V1& a, const V2& b) {
-  assert(a.size() == b.size());
-  return BinaryExpr<V1, V2, Add, typename V1::value_type>{a, b};
+template <size_t N, typename T>
+constexpr T dot(const StaticVector<N, T>& a, const StaticVector<N, T>& b) {
+  return static_dot<N>(a.data(), b.data());
 }
 
-template <VectorLike V1, VectorLike V2>
-constexpr auto operator-(const V1& a, const V2& b) {
-  assert(a.size() == b.size());
-  return BinaryExpr<V1, V2, Sub, typename V1::value_type>{a, b};
+template <typename T>
+constexpr StaticVector<3, T> cross(const StaticVector<3, T>& a,
+                                   const StaticVector<3, T>& b) {
+  StaticVector<3, T> c;
+  c[0] = a[1] * b[2] - a[2] * b[1];
+  c[1] = a[2] * b[0] - a[0] * b[2];
+  c[2] = a[0] * b[1] - a[1] * b[0];
+  return c;
 }
 
-template <VectorLike V1, VectorLike V2>
-constexpr auto operator*(const V1& a, const V2& b) {
-  assert(a.size() == b.size());
-  return BinaryExpr<V1, V2, Mul, typename V1::value_type>{a, b};
+// y = alpha * x + y
+template <size_t N, typename T>
+constexpr void axpy(T alpha, const StaticVector<N, T>& x,
+                    StaticVector<N, T>& y) {
+  unroll<N>([&](auto i) { y[i] += alpha * x[i]; });
 }
 
-template <VectorLike V1, VectorLike V2>
-constexpr auto operator/(const V1& a, const V2& b) {
-  assert(a.size() == b.size());
-  return BinaryExpr<V1, V2, Div, typename V1::value_type>{a, b};
+template <size_t N, typename T>
+constexpr T norm1(const StaticVector<N, T>& x) {
+  T nrm{};
+  unroll<N>([&](auto i) { nrm += static_abs(x[i]); });
+  return nrm;
 }
 
-// other common operators
+template <size_t N, typename T>
+constexpr T normInf(const StaticVector<N, T>& x) {
+  T nrm{};
+  unroll<N>([&](auto i) {
+    const T v = static_abs(x[i]);
+    if (v > nrm) nrm = v;
+  });
+  return nrm;
+}
 
 template <size_t N, typename T>
 T norm2(const StaticVector<N, T>& x) {
-  if constexpr (std::is_same_v<T, double>) {
-    cblas_dnrm2(N, x.data(), 1);
+  if constexpr (N <= static_blas_threshold) {
+    return std::sqrt(static_dot<N>(x.data(), x.data()));
+  } else if constexpr (std::is_same_v<T, double>) {
+    const instrument::BlasCall call("cblas_dnrm2", 2 * N);
+    return cblas_dnrm2(N, x.data(), 1);
   } else if constexpr (std::is_same_v<T, float>) {
-    cblas_snrm2(N, x.data(), 1);
+    const instrument::BlasCall call("cblas_snrm2", 2 * N);
+    return cblas_snrm2(N, x.data(), 1);
   } else {
-    T nrm{};
-    for (size_t i = 0; i < x.size(); i++) {
-      nrm += x[i] * x[i];
-    }
-    return std::sqrt(nrm);
+    return std::sqrt(static_dot<N>(x.data(), x.data()));
   }
 }
 
-template <typename T>
-T norm2(const Vector<T>& x) {
+template <typename T, typename Alloc>
+T norm2(const Vector<T, Alloc>& x) {
   if constexpr (std::is_same_v<T, double>) {
-    cblas_dnrm2(x.size(), x.data(), 1);
+    const instrument::BlasCall call("cblas_dnrm2", 2 * x.size());
+    return cblas_dnrm2(x.size(), x.data(), 1);
   } else if constexpr (std::is_same_v<T, float>) {
-    cblas_snrm2(x.size(), x.data(), 1);
+    const instrument::BlasCall call("cblas_snrm2", 2 * x.size());
+    return cblas_snrm2(x.size(), x.data(), 1);
   } else {
     T nrm{};
     for (size_t i = 0; i < x.size(); i++) {
@@ -320,11 +313,75 @@ T norm2(const Vector<T>& x) {
 #define SIZE_CONDITIONED_VECTOR_T \
   std::conditional_t<(N > 0), StaticVector<N, T>, Vector<T>>  // no-semi!
 
-// vector with possibly custom vector norm
-template <size_t N = 0, std::floating_point T = double>  //
+//
+// norm policies
+//
+// Stateless (L2Norm, LinfNorm) or tolerance-carrying (WRMSNorm) functors that
+// take any vector expression, so a norm of a difference is one fused pass:
+//
+//   const double err = WRMSNorm<double>{atol, rtol}(y_new - y_old, y_new);
+//
+// Overload resolution picks the container kernels above (unrolled or BLAS)
+// and the streaming reductions in Reduction.h for everything else.
+//
+
+// sqrt(mean((e_i / (atol + rtol * |y_i|))^2)), the weighted RMS norm used for
+// step-size control
+template <ExprLike E, ExprLike Y>
+typename E::value_type wrms(const E& e, const Y& y,
+                            typename E::value_type atol,
+                            typename E::value_type rtol) {
+  assert(e.size() == y.size());
+  using T = typename E::value_type;
+  if (e.size() == 0) return T{0};
+  return norm2(e / (atol + rtol * abs(y))) / std::sqrt(T(e.size()));
+}
+
+struct L2Norm {
+  template <ExprLike E>
+  typename E::value_type operator()(const E& x) const {
+    return norm2(x);
+  }
+};
+
+struct LinfNorm {
+  template <ExprLike E>
+  typename E::value_type operator()(const E& x) const {
+    return normInf(x);
+  }
+};
+
+// Weighted RMS norm. With one argument the weights come from x itself.
+template <std::floating_point T>
+struct WRMSNorm {
+  T atol = T{0};
+  T rtol = T{0};
+
+  template <ExprLike E>
+  T operator()(const E& x) const {
+    return wrms(x, x, atol, rtol);
+  }
+  template <ExprLike E, ExprLike Y>
+  T operator()(const E& err, const Y& y) const {
+    return wrms(err, y, atol, rtol);
+  }
+};
+
+// A norm chosen at run time through a function pointer.
+template <typename V>
+struct FunctionNorm {
+  typename V::value_type (*norm)(const V& x) = norm2;
+
+  typename V::value_type operator()(const V& x) const { return norm(x); }
+};
+
+// Vector with a norm fixed by its type: nv.norm(nv.v). Stateless policies
+// take no space and are inlined; FunctionNorm restores a per-instance choice.
+template <size_t N = 0, std::floating_point T = double,
+          typename NormPolicy = L2Norm>
 struct NormedVector {
   SIZE_CONDITIONED_VECTOR_T v;
-  T (*norm)(const SIZE_CONDITIONED_VECTOR_T& x) = norm2;
+  [[no_unique_address]] NormPolicy norm{};
 };
 
 // convenient aliases
@@ -339,3 +396,5 @@ using FVector3 = StaticVector<3, float>;
 using FVector4 = StaticVector<4, float>;
 using FVector5 = StaticVector<5, float>;
 using FVector6 = StaticVector<6, float>;
+
+SWNUMERIC_END
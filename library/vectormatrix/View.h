@@ -0,0 +1,222 @@
+#pragma once
+
+#include <mkl_cblas.h>
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <concepts>
+#include <cstddef>
+#include <type_traits>
+
+#include "library/dispatch/Namespace.h"
+#include "library/expression/Expression.h"
+#include "library/instrument/Instrument.h"
+#include "library/memory/AlignedAllocator.h"
+#include "library/memory/Workspace.h"
+
+SWNUMERIC_BEGIN
+
+//
+// Non-owning views. Views have reference semantics: copying a view aliases the
+// same data, while assigning to a view (from another view or an expression)
+// writes through to the viewed elements.
+//
+// VectorView holds a pointer, a size and an element stride; MatrixView a
+// pointer, a row-major shape and a leading dimension (the distance between row
+// starts). row(i), col(j), block(r, c, h, w) and segment(i, n) slice a
+// Vector, Matrix or view without copying, and BLAS calls on the result take
+// the stride or leading dimension directly.
+//
+
+// Contiguous storage a view can be taken over: Vector, StaticVector, Matrix...
+template <typename V, typename T>
+concept DenseStorage =
+    requires(V& v) {
+      { v.data() } -> std::convertible_to<T*>;
+      { v.size() } -> std::convertible_to<size_t>;
+    } && !requires(V& v) { v.stride(); } && !requires(V& v) { v.ld(); };
+
+template <Scalar T>
+struct VectorView : Expr<VectorView<T>, T> {
+  //
+  using value_type = T;
+  constexpr static size_t ctime_size = 0;
+
+  //
+  T* _data;
+  size_t _N;
+  size_t _stride = 1;
+
+  // constructor
+  constexpr VectorView(T* data, size_t N, size_t stride = 1) noexcept
+      : _data(data), _N(N), _stride(stride) {}
+  template <DenseStorage<T> V>
+    requires(!MatrixExpr<V>)
+  constexpr VectorView(V& v) noexcept : _data(v.data()), _N(v.size()) {}
+  VectorView(Workspace& ws, size_t N)
+      : _data(ws.allocate<T>(N)), _N(N) {
+    std::fill_n(_data, N, T{});
+  }
+  VectorView(Workspace& ws, size_t N, uninitialized_t)
+      : _data(ws.allocate<T>(N)), _N(N) {}
+  constexpr VectorView(const VectorView&) = default;
+
+  // size
+  constexpr size_t size() const noexcept { return _N; }
+  constexpr size_t stride() const noexcept { return _stride; }
+
+  // data access
+  constexpr T* data() const noexcept { return _data; }
+  constexpr T& operator[](size_t i) const noexcept {
+    assert(i < size());
+    return _data[i * _stride];
+  }
+
+  // iterator access, contiguous views only
+  constexpr T* begin() const noexcept {
+    assert(is_contiguous(*this));
+    return data();
+  }
+  constexpr T* end() const noexcept {
+    assert(is_contiguous(*this));
+    return data() + size();
+  }
+
+  // packet access
+  packet_t<T> packet(size_t i) const noexcept {
+    if (_stride == 1) return ploadu(data() + i);
+    return pgenerate<T>([&](size_t k) { return _data[(i + k) * _stride]; });
+  }
+
+  // elements [i, i + n)
+  constexpr VectorView segment(size_t i, size_t n) const noexcept {
+    assert(i + n <= size());
+    return {_data + i * _stride, n, _stride};
+  }
+
+  constexpr VectorView& operator=(const VectorView& src) {
+    assign(*this, src);
+    return *this;
+  }
+
+  template <typename ExprType>
+  constexpr VectorView& operator=(const Expr<ExprType, T>& src) {
+    assign(*this, static_cast<const ExprType&>(src));
+    return *this;
+  }
+};
+
+// Row major
+template <Scalar T>
+struct MatrixView : Expr<MatrixView<T>, T> {
+  //
+  using value_type = T;
+
+  //
+  T* _data;
+  size_t _R, _C;
+  size_t _ld;
+
+  // constructor
+  constexpr MatrixView(T* data, size_t R, size_t C) noexcept
+      : _data(data), _R(R), _C(C), _ld(C) {}
+  constexpr MatrixView(T* data, size_t R, size_t C, size_t ld) noexcept
+      : _data(data), _R(R), _C(C), _ld(ld) {
+    assert(ld >= C);
+  }
+  template <DenseStorage<T> M>
+    requires MatrixExpr<M>
+  constexpr MatrixView(M& m) noexcept
+      : _data(m.data()), _R(m.rows()), _C(m.cols()), _ld(m.cols()) {}
+  MatrixView(Workspace& ws, size_t R, size_t C)
+      : _data(ws.allocate<T>(R * C)), _R(R), _C(C), _ld(C) {
+    std::fill_n(_data, R * C, T{});
+  }
+  MatrixView(Workspace& ws, size_t R, size_t C, uninitialized_t)
+      : _data(ws.allocate<T>(R * C)), _R(R), _C(C), _ld(C) {}
+  constexpr MatrixView(const MatrixView&) = default;
+
+  // size
+  constexpr size_t size() const noexcept { return _R * _C; }
+  constexpr size_t rows() const noexcept { return _R; }
+  constexpr size_t cols() const noexcept { return _C; }
+  constexpr size_t ld() const noexcept { return _ld; }
+
+  // data access
+  constexpr T* data() const noexcept { return _data; }
+  constexpr T& operator[](size_t i) const noexcept {
+    assert(i < size());
+    if (_ld == _C) return _data[i];
+    return _data[i / _C * _ld + i % _C];
+  }
+  constexpr T& operator()(size_t i, size_t j) const noexcept {
+    assert(i < rows() && j < cols());
+    return _data[i * _ld + j];
+  }
+
+  // iterator access, contiguous views only
+  constexpr T* begin() const noexcept {
+    assert(is_contiguous(*this));
+    return data();
+  }
+  constexpr T* end() const noexcept {
+    assert(is_contiguous(*this));
+    return data() + size();
+  }
+
+  // packet access; a packet that stays within one row is a single load
+  packet_t<T> packet(size_t i) const noexcept {
+    constexpr size_t W = packet_size<T>;
+    if (_ld == _C) return ploadu(data() + i);
+    const size_t r = i / _C, j = i % _C;
+    if (j + W <= _C) return ploadu(_data + r * _ld + j);
+    return pgenerate<T>([&](size_t k) { return (*this)[i + k]; });
+  }
+
+  // slicing
+  constexpr VectorView<T> row(size_t i) const noexcept {
+    assert(i < rows());
+    return {_data + i * _ld, _C, 1};
+  }
+  constexpr VectorView<T> col(size_t j) const noexcept {
+    assert(j < cols());
+    return {_data + j, _R, _ld};
+  }
+  // the h x w block with top-left element (r, c)
+  constexpr MatrixView block(size_t r, size_t c, size_t h,
+                             size_t w) const noexcept {
+    assert(r + h <= rows() && c + w <= cols());
+    return {_data + r * _ld + c, h, w, _ld};
+  }
+
+  constexpr MatrixView& operator=(const MatrixView& src) {
+    assign(*this, src);
+    return *this;
+  }
+
+  template <typename ExprType>
+  constexpr MatrixView& operator=(const Expr<ExprType, T>& src) {
+    assign(*this, static_cast<const ExprType&>(src));
+    return *this;
+  }
+};
+
+template <typename T>
+T norm2(const VectorView<T>& x) {
+  if constexpr (std::is_same_v<T, double>) {
+    const instrument::BlasCall call("cblas_dnrm2", 2 * x.size());
+    return cblas_dnrm2(x.size(), x.data(), x.stride());
+  } else if constexpr (std::is_same_v<T, float>) {
+    const instrument::BlasCall call("cblas_snrm2", 2 * x.size());
+    return cblas_snrm2(x.size(), x.data(), x.stride());
+  } else {
+    T nrm{};
+    for (size_t i = 0; i < x.size(); i++) {
+      nrm += x[i] * x[i];
+    }
+    return std::sqrt(nrm);
+  }
+}
+
+SWNUMERIC_END
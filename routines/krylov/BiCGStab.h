@@ -0,0 +1,96 @@
+#pragma once
+
+#include <cassert>
+#include <cmath>
+#include <concepts>
+#include <cstddef>
+
+#include "library/expression/Reduction.h"
+#include "library/vectormatrix/Vector.h"
+#include "routines/krylov/Krylov.h"
+
+//
+// BiCGStab for general A, right preconditioned.
+//
+//   krylov::BiCGStab<double> bicg(n);
+//   auto res = bicg.solve(A, b, x, krylov::Jacobi<double>(A));
+//
+// Each iteration applies A and M twice and makes four reductions: (r0, v),
+// |s|, the fused (t, s) and (t, t), and the fused (r0, r) and |r| that also
+// start the next iteration. A zero rho or omega is a breakdown; the solve
+// then stops with converged == false.
+//
+
+namespace krylov {
+
+template <std::floating_point T>
+class BiCGStab {
+ public:
+  Options<T> options;
+
+  explicit BiCGStab(size_t n, const Options<T>& opt = {})
+      : options(opt),
+        _r(n), _r0(n), _p(n), _v(n), _s(n), _t(n), _ph(n), _sh(n) {}
+
+  size_t size() const noexcept { return _r.size(); }
+
+  template <typename Op, VectorLike VB, VectorLike VX, typename Pre = Identity>
+    requires LinearOperator<Op, T> && LinearOperator<Pre, T>
+  Result<T> solve(const Op& A, const VB& b, VX& x, const Pre& M = {}) {
+    assert(b.size() == size() && x.size() == size());
+    const ParallelPolicy& pol = options.policy;
+    // without M, p and s are used unpreconditioned
+    constexpr bool plain = detail::is_identity_v<Pre>;
+    Vector<T>& ph = plain ? _p : _ph;
+    Vector<T>& sh = plain ? _s : _sh;
+
+    Result<T> res;
+    const T tol = detail::tolerance(options, norm2(pol, b));
+    detail::residual(A, b, x, _r, pol);
+    assign(pol, _r0, _r);
+    T rr = dot(pol, _r, _r);
+    T rho = rr, rho_prev{1}, alpha{1}, omega{1};
+    res.residual = std::sqrt(rr);
+
+    while (res.residual > tol && res.iterations < options.max_iterations) {
+      if (rho == T{0}) break;
+      if (res.iterations == 0) {
+        assign(pol, _p, _r);
+      } else {
+        const T beta = (rho / rho_prev) * (alpha / omega);
+        assign(pol, _p, _r + beta * (_p - omega * _v));
+      }
+      if constexpr (!plain) apply(M, _p, ph, pol);
+      apply(A, ph, _v, pol);
+      alpha = rho / dot(pol, _r0, _v);
+      assign(pol, _s, _r - alpha * _v);
+      res.iterations++;
+
+      const T snorm = norm2(pol, _s);
+      if (snorm <= tol) {
+        assign(pol, x, x + alpha * ph);
+        res.residual = snorm;
+        break;
+      }
+
+      if constexpr (!plain) apply(M, _s, sh, pol);
+      apply(A, sh, _t, pol);
+      const auto [ts, tt] = fused_sum(pol, _t * _s, _t * _t);
+      omega = tt == T{0} ? T{0} : ts / tt;
+      assign(pol, x, x + alpha * ph + omega * sh);
+      assign(pol, _r, _s - omega * _t);
+      rho_prev = rho;
+      const auto [r0r, rr_next] = fused_sum(pol, _r0 * _r, _r * _r);
+      rho = r0r;
+      res.residual = std::sqrt(rr_next);
+      if (omega == T{0}) break;
+    }
+    res.converged = res.residual <= tol;
+    return res;
+  }
+
+ private:
+  Vector<T> _r, _r0, _p, _v, _s, _t, _ph, _sh;
+};
+
+}  // namespace krylov
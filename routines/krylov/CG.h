@@ -0,0 +1,147 @@
+#pragma once
+
+#include <cassert>
+#include <cmath>
+#include <concepts>
+#include <cstddef>
+
+#include "library/expression/Reduction.h"
+#include "library/vectormatrix/Vector.h"
+#include "routines/krylov/Krylov.h"
+
+//
+// Conjugate gradients for symmetric positive definite A (and M).
+//
+//   krylov::CG<double> cg(n);
+//   auto res = cg.solve(A, b, x);                        // x holds x0
+//   auto res = cg.solve(A, b, x, krylov::Jacobi<double>(A));
+//
+// CG makes two global reductions per iteration: (p, A p), then (r, z) fused
+// with |r|. PipelinedCG (Ghysels and Vanroose's pipelined PCG) carries four
+// more recurrences so that all three dot products of an iteration come from
+// one fused reduction, taken before that iteration's A and M applications,
+// which then depend only on vectors already known; this halves the
+// synchronizations per iteration at the cost of more vector traffic and a
+// somewhat larger drift of the recursive residual.
+//
+
+namespace krylov {
+
+template <std::floating_point T>
+class CG {
+ public:
+  Options<T> options;
+
+  explicit CG(size_t n, const Options<T>& opt = {})
+      : options(opt), _r(n), _z(n), _p(n), _q(n) {}
+
+  size_t size() const noexcept { return _r.size(); }
+
+  template <typename Op, VectorLike VB, VectorLike VX, typename Pre = Identity>
+    requires LinearOperator<Op, T> && LinearOperator<Pre, T>
+  Result<T> solve(const Op& A, const VB& b, VX& x, const Pre& M = {}) {
+    assert(b.size() == size() && x.size() == size());
+    const ParallelPolicy& pol = options.policy;
+    constexpr bool plain = detail::is_identity_v<Pre>;
+    Vector<T>& z = plain ? _r : _z;
+
+    Result<T> res;
+    const T tol = detail::tolerance(options, norm2(pol, b));
+    detail::residual(A, b, x, _r, pol);
+    if constexpr (!plain) apply(M, _r, z, pol);
+    auto [rz, rr] = fused_sum(pol, _r * z, _r * _r);
+    res.residual = std::sqrt(rr);
+    assign(pol, _p, z);
+
+    while (res.residual > tol && res.iterations < options.max_iterations) {
+      apply(A, _p, _q, pol);
+      const T alpha = rz / dot(pol, _p, _q);
+      assign(pol, x, x + alpha * _p);
+      assign(pol, _r, _r - alpha * _q);
+      if constexpr (!plain) apply(M, _r, z, pol);
+      const auto [rz_next, rr_next] = fused_sum(pol, _r * z, _r * _r);
+      res.iterations++;
+      res.residual = std::sqrt(rr_next);
+
+      const T beta = rz_next / rz;
+      rz = rz_next;
+      assign(pol, _p, z + beta * _p);
+    }
+    res.converged = res.residual <= tol;
+    return res;
+  }
+
+ private:
+  Vector<T> _r, _z, _p, _q;
+};
+
+template <std::floating_point T>
+class PipelinedCG {
+ public:
+  Options<T> options;
+
+  explicit PipelinedCG(size_t n, const Options<T>& opt = {})
+      : options(opt),
+        _r(n), _u(n), _w(n), _m(n), _n(n), _z(n), _q(n), _s(n), _p(n) {}
+
+  size_t size() const noexcept { return _r.size(); }
+
+  template <typename Op, VectorLike VB, VectorLike VX, typename Pre = Identity>
+    requires LinearOperator<Op, T> && LinearOperator<Pre, T>
+  Result<T> solve(const Op& A, const VB& b, VX& x, const Pre& M = {}) {
+    assert(b.size() == size() && x.size() == size());
+    const ParallelPolicy& pol = options.policy;
+    // without M, u = r, m = w and q = s, so those recurrences are dropped
+    constexpr bool plain = detail::is_identity_v<Pre>;
+    Vector<T>& u = plain ? _r : _u;
+    Vector<T>& m = plain ? _w : _m;
+    Vector<T>& q = plain ? _s : _q;
+
+    Result<T> res;
+    const T tol = detail::tolerance(options, norm2(pol, b));
+    detail::residual(A, b, x, _r, pol);
+    if constexpr (!plain) apply(M, _r, u, pol);
+    apply(A, u, _w, pol);
+
+    T gamma_prev{1}, alpha_prev{1};
+    for (;; res.iterations++) {
+      // the only reduction of the iteration
+      const auto [gamma, delta, rr] =
+          fused_sum(pol, _r * u, _w * u, _r * _r);
+      res.residual = std::sqrt(rr);
+      if (res.residual <= tol || res.iterations >= options.max_iterations) {
+        break;
+      }
+
+      if constexpr (!plain) apply(M, _w, m, pol);
+      apply(A, m, _n, pol);
+
+      T alpha, beta;
+      if (res.iterations == 0) {
+        beta = T{0};
+        alpha = gamma / delta;
+      } else {
+        beta = gamma / gamma_prev;
+        alpha = gamma / (delta - beta * gamma / alpha_prev);
+      }
+      gamma_prev = gamma;
+      alpha_prev = alpha;
+
+      assign(pol, _z, _n + beta * _z);
+      if constexpr (!plain) assign(pol, q, m + beta * q);
+      assign(pol, _s, _w + beta * _s);
+      assign(pol, _p, u + beta * _p);
+      assign(pol, x, x + alpha * _p);
+      assign(pol, _r, _r - alpha * _s);
+      if constexpr (!plain) assign(pol, u, u - alpha * q);
+      assign(pol, _w, _w - alpha * _z);
+    }
+    res.converged = res.residual <= tol;
+    return res;
+  }
+
+ private:
+  Vector<T> _r, _u, _w, _m, _n, _z, _q, _s, _p;
+};
+
+}  // namespace krylov
@@ -0,0 +1,149 @@
+#pragma once
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <concepts>
+#include <cstddef>
+#include <vector>
+
+#include "library/expression/Reduction.h"
+#include "library/vectormatrix/Vector.h"
+#include "routines/krylov/Krylov.h"
+
+//
+// Restarted GMRES(m) for general A, preconditioned on the right so the
+// residual it minimizes and reports is the true |b - A x|.
+//
+//   krylov::GMRES<double> gmres(n, 30);   // restart length 30
+//   auto res = gmres.solve(A, b, x, krylov::Jacobi<double>(A));
+//
+// The Arnoldi basis is orthogonalized with modified Gram-Schmidt and the
+// small least-squares problem is kept triangular with Givens rotations, so
+// the residual norm is known after every iteration without forming x. The
+// m + 1 basis vectors and the Hessenberg matrix are allocated once.
+//
+
+namespace krylov {
+
+template <std::floating_point T>
+class GMRES {
+ public:
+  Options<T> options;
+
+  GMRES(size_t n, size_t restart, const Options<T>& opt = {})
+      : options(opt),
+        _m(restart),
+        _r(n),
+        _z(n),
+        _V(restart + 1, Vector<T>(n)),
+        _H((restart + 1) * restart),
+        _cs(restart),
+        _sn(restart),
+        _g(restart + 1) {
+    assert(restart > 0);
+  }
+
+  size_t size() const noexcept { return _r.size(); }
+  size_t restart() const noexcept { return _m; }
+
+  template <typename Op, VectorLike VB, VectorLike VX, typename Pre = Identity>
+    requires LinearOperator<Op, T> && LinearOperator<Pre, T>
+  Result<T> solve(const Op& A, const VB& b, VX& x, const Pre& M = {}) {
+    assert(b.size() == size() && x.size() == size());
+    const ParallelPolicy& pol = options.policy;
+
+    Result<T> res;
+    const T tol = detail::tolerance(options, norm2(pol, b));
+    for (;;) {
+      detail::residual(A, b, x, _r, pol);
+      const T beta = norm2(pol, _r);
+      res.residual = beta;
+      if (beta <= tol || res.iterations >= options.max_iterations) break;
+
+      assign(pol, _V[0], _r / beta);
+      std::fill(_g.begin(), _g.end(), T{0});
+      _g[0] = beta;
+      size_t k = 0;  // columns of H built in this cycle
+      while (k < _m && res.iterations < options.max_iterations) {
+        // on breakdown the solution is in the Krylov space and g[k] is 0
+        const bool breakdown = arnoldi(A, M, k, pol);
+        k++;
+        res.iterations++;
+        res.residual = std::abs(_g[k]);
+        if (breakdown || res.residual <= tol) break;
+      }
+      update(M, x, k, pol);
+      if (res.residual <= tol) break;
+    }
+    res.converged = res.residual <= tol;
+    return res;
+  }
+
+ private:
+  size_t _m;
+  Vector<T> _r, _z;
+  std::vector<Vector<T>> _V;
+  std::vector<T> _H;  // (m + 1) x m, column j at _H[j * (m + 1)]
+  std::vector<T> _cs, _sn, _g;
+
+  T& H(size_t i, size_t j) noexcept { return _H[j * (_m + 1) + i]; }
+
+  // Extends the basis by V[j + 1] and triangularizes column j; true on
+  // breakdown.
+  template <typename Op, typename Pre>
+  bool arnoldi(const Op& A, const Pre& M, size_t j,
+               const ParallelPolicy& pol) {
+    Vector<T>& w = _V[j + 1];
+    if constexpr (detail::is_identity_v<Pre>) {
+      apply(A, _V[j], w, pol);
+    } else {
+      apply(M, _V[j], _z, pol);
+      apply(A, _z, w, pol);
+    }
+    for (size_t i = 0; i <= j; i++) {
+      H(i, j) = dot(pol, w, _V[i]);
+      assign(pol, w, w - H(i, j) * _V[i]);
+    }
+    const T h = norm2(pol, w);
+    H(j + 1, j) = h;
+    if (h != T{0}) assign(pol, w, w / h);
+
+    // previous rotations, then one that zeroes H(j + 1, j)
+    for (size_t i = 0; i < j; i++) {
+      const T a = H(i, j), c = H(i + 1, j);
+      H(i, j) = _cs[i] * a + _sn[i] * c;
+      H(i + 1, j) = -_sn[i] * a + _cs[i] * c;
+    }
+    const T a = H(j, j), c = H(j + 1, j);
+    const T rho = std::hypot(a, c);
+    _cs[j] = rho == T{0} ? T{1} : a / rho;
+    _sn[j] = rho == T{0} ? T{0} : c / rho;
+    H(j, j) = rho;
+    H(j + 1, j) = T{0};
+    _g[j + 1] = -_sn[j] * _g[j];
+    _g[j] = _cs[j] * _g[j];
+    return h == T{0};
+  }
+
+  // x += M V y for the k x k triangular system H y = g; y overwrites g.
+  template <typename Pre, typename VX>
+  void update(const Pre& M, VX& x, size_t k, const ParallelPolicy& pol) {
+    if (k == 0) return;
+    for (size_t i = k; i-- > 0;) {
+      T s = _g[i];
+      for (size_t l = i + 1; l < k; l++) s -= H(i, l) * _g[l];
+      _g[i] = s / H(i, i);
+    }
+    assign(pol, _r, _g[0] * _V[0]);
+    for (size_t i = 1; i < k; i++) assign(pol, _r, _r + _g[i] * _V[i]);
+    if constexpr (detail::is_identity_v<Pre>) {
+      assign(pol, x, x + _r);
+    } else {
+      apply(M, _r, _z, pol);
+      assign(pol, x, x + _z);
+    }
+  }
+};
+
+}  // namespace krylov
@@ -0,0 +1,142 @@
+#pragma once
+
+#include <cassert>
+#include <cmath>
+#include <concepts>
+#include <cstddef>
+#include <type_traits>
+
+#include "library/expression/Expression.h"
+#include "library/expression/Reduction.h"
+#include "library/parallel/Parallel.h"
+#include "library/sparse/SparseMatrix.h"
+#include "library/vectormatrix/Matrix.h"
+#include "library/vectormatrix/Product.h"
+#include "library/vectormatrix/Vector.h"
+
+//
+// Common pieces of the Krylov solvers in CG.h, GMRES.h and BiCGStab.h.
+//
+// A linear operator is anything krylov::apply(A, x, y, policy) accepts, which
+// computes y = A x:
+//
+//   Matrix<T> (or any dense MatrixLike)   one ?gemv
+//   SparseMatrix<T>                       one spmv
+//   a callable f(x, y)                    matrix-free; called with the
+//                                         solver's own Vector<T> workspaces
+//                                         and with the caller's x, so a
+//                                         generic lambda is the easy form
+//
+// A preconditioner is a linear operator approximating A^{-1}, applied as
+// z = M r. Identity (the default) is recognized by the solvers and costs
+// nothing; Jacobi scales by the inverse diagonal.
+//
+// Each solver owns its workspace vectors, sized once on construction, so
+// repeated solves and every iteration after the first run without allocating
+// (fused_sum's partials come from the per-thread Workspace arena). Vector
+// updates are single expression assignments and the dot products of a step
+// are fused into as few reductions as the recurrence allows.
+//
+
+namespace krylov {
+
+// y = A x for a dense matrix
+template <MatrixLike MA, typename VX, typename VY>
+void apply(const MA& A, const VX& x, VY& y, const ParallelPolicy&) {
+  gemv(typename MA::value_type{1}, A, x, typename MA::value_type{0}, y);
+}
+
+// y = A x for a sparse matrix
+template <typename T, typename VX, typename VY>
+void apply(const SparseMatrix<T>& A, const VX& x, VY& y,
+           const ParallelPolicy& policy) {
+  spmv(T{1}, A, x, T{0}, y, policy);
+}
+
+// y = f(x), matrix-free
+template <typename F, typename VX, typename VY>
+  requires std::invocable<const F&, const VX&, VY&>
+void apply(const F& f, const VX& x, VY& y, const ParallelPolicy&) {
+  f(x, y);
+}
+
+// M = I
+struct Identity {};
+
+template <typename VX, typename VY>
+void apply(Identity, const VX& x, VY& y, const ParallelPolicy& policy) {
+  assign(policy, y, x);
+}
+
+// M = diag(A)^{-1}
+template <std::floating_point T>
+struct Jacobi {
+  Vector<T> inv_diag;
+
+  template <MatrixLike MA>
+  explicit Jacobi(const MA& A) : inv_diag(A.rows(), uninitialized) {
+    assert(A.rows() == A.cols());
+    const size_t ld = leading_dim(A);
+    for (size_t i = 0; i < A.rows(); i++) set(i, A.data()[i * ld + i]);
+  }
+  explicit Jacobi(const SparseMatrix<T>& A)
+      : inv_diag(A.rows(), uninitialized) {
+    assert(A.rows() == A.cols());
+    for (size_t i = 0; i < A.rows(); i++) set(i, A.coeff(i, i));
+  }
+
+ private:
+  void set(size_t i, T d) noexcept {
+    assert(d != T{0});
+    inv_diag[i] = T{1} / d;
+  }
+};
+
+template <typename T, typename VX, typename VY>
+void apply(const Jacobi<T>& M, const VX& x, VY& y,
+           const ParallelPolicy& policy) {
+  assign(policy, y, M.inv_diag * x);
+}
+
+template <typename Op, typename T>
+concept LinearOperator =
+    requires(const Op& A, const Vector<T>& x, Vector<T>& y) {
+      krylov::apply(A, x, y, par);
+    };
+
+template <std::floating_point T>
+struct Options {
+  T rtol = std::is_same_v<T, float> ? T(1e-5) : T(1e-10);
+  T atol = T{0};                 // converged: |r| <= max(rtol |b|, atol)
+  size_t max_iterations = 1000;  // iterations, across restarts for GMRES
+  ParallelPolicy policy = par;   // for the vector updates and reductions
+};
+
+template <std::floating_point T>
+struct Result {
+  size_t iterations = 0;
+  T residual = T{0};  // |b - A x| as tracked by the recurrence
+  bool converged = false;
+};
+
+namespace detail {
+
+// r = b - A x
+template <typename Op, typename VB, typename VX, typename T>
+void residual(const Op& A, const VB& b, const VX& x, Vector<T>& r,
+              const ParallelPolicy& policy) {
+  apply(A, x, r, policy);
+  assign(policy, r, b - r);
+}
+
+template <typename T>
+T tolerance(const Options<T>& opt, T bnorm) noexcept {
+  return std::max(opt.rtol * bnorm, opt.atol);
+}
+
+template <typename M>
+inline constexpr bool is_identity_v = std::is_same_v<M, Identity>;
+
+}  // namespace detail
+
+}  // namespace krylov
@@ -0,0 +1,301 @@
+#pragma once
+
+#include <mkl_cblas.h>
+#include <mkl_lapacke.h>
+
+#include <cassert>
+#include <concepts>
+#include <cstddef>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include "library/expression/Expression.h"
+#include "library/instrument/Instrument.h"
+#include "library/memory/AlignedAllocator.h"
+#include "library/vectormatrix/Matrix.h"
+#include "library/vectormatrix/Vector.h"
+#include "library/vectormatrix/View.h"
+
+//
+// Dense factorizations in place over a Matrix or MatrixView.
+//
+//   LU<T> lu(A);          // PA = LU, partial pivoting
+//   lu.solve(b);          // b <- A^{-1} b
+//   lu.solve(B);          // every column of B at once (one trsm pair)
+//
+//   Cholesky<T> ch(S);    // S = L L^T, reads the lower triangle of S
+//   QR<T> qr(M);          // M = QR, rows >= cols; solve() is least squares
+//
+// The factors overwrite the matrix, which must outlive the factorization and
+// not be modified while it is in use; the object itself holds only the pivots
+// or Householder scalars. Nothing is copied: LAPACK is column-major, so a
+// row-major A is handed to it as A^T, and each factorization is picked so
+// that one of A^T really is the one wanted for A (getrf of A^T gives A =
+// U^T L^T P^T; potrf with 'U' gives A = L L^T; gelqf of A^T = LQ gives
+// A = Q^T L^T). Solves then run as cblas_?trsm in row-major layout, which
+// takes any row stride, so b may be a strided VectorView (a column of a
+// matrix) and B a padded MatrixView.
+//
+// Singular (LU) or not positive definite (Cholesky) matrices are reported by
+// info() > 0, the LAPACK convention; solve() requires ok(). Other LAPACK
+// failures throw std::runtime_error.
+//
+
+namespace lapack {
+
+inline lapack_int getrf(lapack_int m, lapack_int n, double* a, lapack_int lda,
+                        lapack_int* ipiv) {
+  return LAPACKE_dgetrf(LAPACK_COL_MAJOR, m, n, a, lda, ipiv);
+}
+inline lapack_int getrf(lapack_int m, lapack_int n, float* a, lapack_int lda,
+                        lapack_int* ipiv) {
+  return LAPACKE_sgetrf(LAPACK_COL_MAJOR, m, n, a, lda, ipiv);
+}
+
+inline lapack_int potrf(char uplo, lapack_int n, double* a, lapack_int lda) {
+  return LAPACKE_dpotrf(LAPACK_COL_MAJOR, uplo, n, a, lda);
+}
+inline lapack_int potrf(char uplo, lapack_int n, float* a, lapack_int lda) {
+  return LAPACKE_spotrf(LAPACK_COL_MAJOR, uplo, n, a, lda);
+}
+
+inline lapack_int gelqf(lapack_int m, lapack_int n, double* a, lapack_int lda,
+                        double* tau) {
+  return LAPACKE_dgelqf(LAPACK_COL_MAJOR, m, n, a, lda, tau);
+}
+inline lapack_int gelqf(lapack_int m, lapack_int n, float* a, lapack_int lda,
+                        float* tau) {
+  return LAPACKE_sgelqf(LAPACK_COL_MAJOR, m, n, a, lda, tau);
+}
+
+inline lapack_int ormlq(char side, char trans, lapack_int m, lapack_int n,
+                        lapack_int k, const double* a, lapack_int lda,
+                        const double* tau, double* c, lapack_int ldc) {
+  return LAPACKE_dormlq(LAPACK_COL_MAJOR, side, trans, m, n, k, a, lda, tau, c,
+                        ldc);
+}
+inline lapack_int ormlq(char side, char trans, lapack_int m, lapack_int n,
+                        lapack_int k, const float* a, lapack_int lda,
+                        const float* tau, float* c, lapack_int ldc) {
+  return LAPACKE_sormlq(LAPACK_COL_MAJOR, side, trans, m, n, k, a, lda, tau, c,
+                        ldc);
+}
+
+// B <- op(A)^{-1} B for a triangular n x n A; B is n x k, both row-major.
+inline void trsm(CBLAS_UPLO uplo, CBLAS_TRANSPOSE trans, CBLAS_DIAG diag,
+                 size_t n, size_t k, const double* a, size_t lda, double* b,
+                 size_t ldb) {
+  cblas_dtrsm(CblasRowMajor, CblasLeft, uplo, trans, diag, n, k, 1.0, a, lda,
+              b, ldb);
+}
+inline void trsm(CBLAS_UPLO uplo, CBLAS_TRANSPOSE trans, CBLAS_DIAG diag,
+                 size_t n, size_t k, const float* a, size_t lda, float* b,
+                 size_t ldb) {
+  cblas_strsm(CblasRowMajor, CblasLeft, uplo, trans, diag, n, k, 1.0f, a, lda,
+              b, ldb);
+}
+
+inline void swap_rows(size_t k, double* x, double* y) {
+  cblas_dswap(k, x, 1, y, 1);
+}
+inline void swap_rows(size_t k, float* x, float* y) {
+  cblas_sswap(k, x, 1, y, 1);
+}
+
+inline void check(lapack_int info, const char* what) {
+  if (info < 0) {
+    throw std::runtime_error(std::string(what) + " failed with info " +
+                             std::to_string(info));
+  }
+}
+
+// A right-hand side as a row-major rows x cols block: a vector is one
+// column whose row stride is its element stride.
+template <typename T>
+struct RHS {
+  T* data;
+  size_t rows, cols, ld;
+
+  RHS(const VectorView<T>& b)
+      : data(b.data()), rows(b.size()), cols(1), ld(b.stride()) {}
+  RHS(const MatrixView<T>& B)
+      : data(B.data()), rows(B.rows()), cols(B.cols()), ld(B.ld()) {}
+};
+
+// The factored matrix. Views assign through, so the factorizations keep the
+// pointer and shape rather than a MatrixView member.
+template <typename T>
+struct Storage {
+  T* data = nullptr;
+  size_t rows = 0, cols = 0, ld = 0;
+
+  Storage() = default;
+  Storage(const MatrixView<T>& A)
+      : data(A.data()), rows(A.rows()), cols(A.cols()), ld(A.ld()) {}
+
+  MatrixView<T> view() const noexcept { return {data, rows, cols, ld}; }
+};
+
+}  // namespace lapack
+
+template <std::floating_point T>
+class LU {
+ public:
+  explicit LU(MatrixView<T> A) { factor(A); }
+
+  // Factors a new matrix of the same or another size, reusing the pivots.
+  void factor(MatrixView<T> A) {
+    assert(A.rows() == A.cols());
+    _A = A;
+    _ipiv.resize(A.rows());
+    const size_t n = A.rows();
+    const instrument::BlasCall call("LAPACKE_?getrf", 2 * n * n * n / 3);
+    _info = lapack::getrf(n, n, A.data(), A.ld(), _ipiv.data());
+    lapack::check(_info, "LAPACKE_?getrf");
+  }
+
+  size_t size() const noexcept { return _A.rows; }
+  lapack_int info() const noexcept { return _info; }
+  bool ok() const noexcept { return _info == 0; }
+
+  // The packed factors: U^T on and below the diagonal, L^T above it.
+  MatrixView<T> factors() const noexcept { return _A.view(); }
+
+  // A X = B in place, for a vector or for each column of a matrix
+  void solve(VectorView<T> b) const { solve_rhs(b); }
+  void solve(MatrixView<T> B) const { solve_rhs(B); }
+
+  // det(A), from the diagonal of U and the pivot parity
+  T det() const noexcept {
+    T d{1};
+    for (size_t i = 0; i < size(); i++) {
+      d *= _A.data[i * _A.ld + i];
+      if (_ipiv[i] != lapack_int(i + 1)) d = -d;
+    }
+    return d;
+  }
+
+ private:
+  lapack::Storage<T> _A;
+  std::vector<lapack_int> _ipiv;
+  lapack_int _info = 0;
+
+  void solve_rhs(lapack::RHS<T> B) const {
+    assert(ok() && B.rows == size());
+    const size_t n = size();
+    // A = U^T L^T P^T: solve U^T, then L^T, then undo P^T
+    const instrument::BlasCall call("cblas_?trsm", 2 * n * n * B.cols);
+    lapack::trsm(CblasLower, CblasNoTrans, CblasNonUnit, n, B.cols, _A.data,
+                 _A.ld, B.data, B.ld);
+    lapack::trsm(CblasUpper, CblasNoTrans, CblasUnit, n, B.cols, _A.data,
+                 _A.ld, B.data, B.ld);
+    for (size_t i = n; i-- > 0;) {
+      const size_t p = _ipiv[i] - 1;
+      if (p != i) {
+        lapack::swap_rows(B.cols, B.data + i * B.ld, B.data + p * B.ld);
+      }
+    }
+  }
+};
+
+template <std::floating_point T>
+class Cholesky {
+ public:
+  explicit Cholesky(MatrixView<T> A) { factor(A); }
+
+  // Factors a new symmetric positive definite matrix; only its lower
+  // triangle is read, and L replaces it.
+  void factor(MatrixView<T> A) {
+    assert(A.rows() == A.cols());
+    _A = A;
+    const size_t n = A.rows();
+    const instrument::BlasCall call("LAPACKE_?potrf", n * n * n / 3);
+    // column-major upper of the storage is row-major lower: A = U^T U = L L^T
+    _info = lapack::potrf('U', n, A.data(), A.ld());
+    lapack::check(_info, "LAPACKE_?potrf");
+  }
+
+  size_t size() const noexcept { return _A.rows; }
+  lapack_int info() const noexcept { return _info; }
+  bool ok() const noexcept { return _info == 0; }
+
+  // L on and below the diagonal; the strict upper triangle is untouched.
+  MatrixView<T> factors() const noexcept { return _A.view(); }
+
+  // A X = B in place, for a vector or for each column of a matrix
+  void solve(VectorView<T> b) const { solve_rhs(b); }
+  void solve(MatrixView<T> B) const { solve_rhs(B); }
+
+ private:
+  lapack::Storage<T> _A;
+  lapack_int _info = 0;
+
+  void solve_rhs(lapack::RHS<T> B) const {
+    assert(ok() && B.rows == size());
+    const size_t n = size();
+    const instrument::BlasCall call("cblas_?trsm", 2 * n * n * B.cols);
+    lapack::trsm(CblasLower, CblasNoTrans, CblasNonUnit, n, B.cols, _A.data,
+                 _A.ld, B.data, B.ld);
+    lapack::trsm(CblasLower, CblasTrans, CblasNonUnit, n, B.cols, _A.data,
+                 _A.ld, B.data, B.ld);
+  }
+};
+
+template <std::floating_point T>
+class QR {
+ public:
+  explicit QR(MatrixView<T> A) { factor(A); }
+
+  // Factors a new rows() >= cols() matrix, reusing the Householder scalars.
+  void factor(MatrixView<T> A) {
+    assert(A.rows() >= A.cols());
+    _A = A;
+    _tau.resize(A.cols());
+    const size_t m = A.rows(), n = A.cols();
+    const instrument::BlasCall call("LAPACKE_?gelqf",
+                                    2 * n * n * (m - n / 3));
+    // LQ of the column-major A^T is QR of A
+    lapack::check(lapack::gelqf(n, m, A.data(), A.ld(), _tau.data()),
+                  "LAPACKE_?gelqf");
+  }
+
+  size_t rows() const noexcept { return _A.rows; }
+  size_t cols() const noexcept { return _A.cols; }
+
+  // R on and above the diagonal of the top cols() x cols() block.
+  MatrixView<T> factors() const noexcept { return _A.view(); }
+
+  // B <- Q^T B, for a vector or matrix with rows() rows
+  void apply_qt(VectorView<T> b) const { apply_qt_rhs(b); }
+  void apply_qt(MatrixView<T> B) const { apply_qt_rhs(B); }
+
+  // Least-squares min |A x - b| in place, for a vector or for each column of
+  // a matrix: on return the first cols() rows hold the solution and the
+  // remaining rows the residual components, whose norm is the residual norm.
+  void solve(VectorView<T> b) const { solve_rhs(b); }
+  void solve(MatrixView<T> B) const { solve_rhs(B); }
+
+ private:
+  lapack::Storage<T> _A;
+  std::vector<T, AlignedAllocator<T>> _tau;
+
+  void apply_qt_rhs(lapack::RHS<T> B) const {
+    assert(B.rows == rows());
+    const size_t m = rows(), n = cols();
+    // B^T is column-major, and B^T Q_lq^T = (Q_lq B)^T = (Q^T B)^T
+    const instrument::BlasCall call("LAPACKE_?ormlq", 4 * m * n * B.cols);
+    lapack::check(lapack::ormlq('R', 'T', B.cols, m, n, _A.data, _A.ld,
+                                _tau.data(), B.data, B.ld),
+                  "LAPACKE_?ormlq");
+  }
+
+  void solve_rhs(lapack::RHS<T> B) const {
+    apply_qt_rhs(B);
+    const size_t n = cols();
+    const instrument::BlasCall call("cblas_?trsm", n * n * B.cols);
+    lapack::trsm(CblasUpper, CblasNoTrans, CblasNonUnit, n, B.cols, _A.data,
+                 _A.ld, B.data, B.ld);
+  }
+};
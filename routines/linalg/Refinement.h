@@ -0,0 +1,135 @@
+#pragma once
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <concepts>
+#include <cstddef>
+#include <limits>
+#include <optional>
+
+#include "library/expression/Expression.h"
+#include "library/expression/Reduction.h"
+#include "library/vectormatrix/Matrix.h"
+#include "library/vectormatrix/Product.h"
+#include "library/vectormatrix/Vector.h"
+#include "library/vectormatrix/View.h"
+#include "routines/linalg/Factorization.h"
+
+//
+// Mixed-precision iterative refinement: A x = b to the accuracy of T with the
+// O(n^3) factorization done in a cheaper type Low.
+//
+//   RefinedLU<double> lu(A);          // LU of A rounded to float
+//   auto res = lu.solve(b, x);        // x in double; A is not modified
+//
+// Each step computes r = b - A x in T (one ?gemv), solves A d = r with the
+// Low factors and updates x += d. It stops, like LAPACK's ?sgesv, once
+// |r|_inf <= |x|_inf |A|_inf eps sqrt(n) with eps the precision of T. When
+// the Low factorization is singular or refinement does not converge in
+// max_iterations steps, A is copied and factored once in T and the solve
+// falls back to it; fallback() reports that this happened.
+//
+
+template <std::floating_point T, std::floating_point Low = float>
+class RefinedLU {
+ public:
+  struct Result {
+    size_t iterations = 0;  // refinement steps
+    T residual = T{0};      // |b - A x|_inf
+    bool converged = false;
+  };
+
+  size_t max_iterations = 30;
+
+  // A must outlive the solver and not be modified while it is in use.
+  explicit RefinedLU(MatrixView<T> A)
+      : _A(A),
+        _low(A.rows(), A.cols(), uninitialized),
+        _lu(round(A, _low)),
+        _r(A.rows(), uninitialized),
+        _d(A.rows(), uninitialized) {
+    for (size_t i = 0; i < size(); i++) {
+      _anorm = std::max(_anorm, norm1(A.row(i)));
+    }
+  }
+
+  // the factors point into _low and _high
+  RefinedLU(const RefinedLU&) = delete;
+  RefinedLU& operator=(const RefinedLU&) = delete;
+
+  size_t size() const noexcept { return _A.rows; }
+  bool fallback() const noexcept { return _exact.has_value(); }
+
+  // x = A^{-1} b
+  template <VectorLike VB>
+  Result solve(const VB& b, VectorView<T> x) {
+    assert(b.size() == size() && x.size() == size());
+    Result res;
+    if (!_lu.ok()) return solve_exact(b, x);
+
+    assign(_d, cast<Low>(b));
+    _lu.solve(_d);
+    assign(x, cast<T>(_d));
+    const T cte = _anorm * std::numeric_limits<T>::epsilon() *
+                  std::sqrt(T(size()));
+    for (;;) {
+      residual(b, x);
+      res.residual = normInf(_r);
+      if (res.residual <= normInf(x) * cte) {
+        res.converged = true;
+        return res;
+      }
+      if (!std::isfinite(res.residual) || res.iterations == max_iterations) {
+        break;
+      }
+      assign(_d, cast<Low>(_r));
+      _lu.solve(_d);
+      assign(x, x + _d);
+      res.iterations++;
+    }
+    const size_t steps = res.iterations;
+    res = solve_exact(b, x);
+    res.iterations = steps;
+    return res;
+  }
+
+ private:
+  lapack::Storage<T> _A;
+  Matrix<Low> _low;
+  LU<Low> _lu;
+  Vector<T> _r;
+  Vector<Low> _d;
+  T _anorm = T{0};  // |A|_inf
+  Matrix<T> _high{0, 0, uninitialized};  // A in T, once fallen back
+  std::optional<LU<T>> _exact;
+
+  static MatrixView<Low> round(MatrixView<T> A, Matrix<Low>& low) {
+    low = cast<Low>(A);
+    return low;
+  }
+
+  // _r = b - A x
+  template <VectorLike VB>
+  void residual(const VB& b, VectorView<T> x) {
+    assign(_r, b);
+    gemv(T{-1}, _A.view(), x, T{1}, _r);
+  }
+
+  template <VectorLike VB>
+  Result solve_exact(const VB& b, VectorView<T> x) {
+    if (!_exact) {
+      _high = Matrix<T>(size(), size(), uninitialized);
+      _high = _A.view();
+      _exact.emplace(_high);
+    }
+    Result res;
+    if (!_exact->ok()) return res;
+    assign(x, b);
+    _exact->solve(x);
+    residual(b, x);
+    res.residual = normInf(_r);
+    res.converged = true;
+    return res;
+  }
+};